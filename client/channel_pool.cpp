@@ -0,0 +1,79 @@
+#include "channel_pool.hpp"
+#include <grpcpp/grpcpp.h>
+
+ChannelPool::ChannelPool(size_t aChannelsPerEndpoint, std::chrono::steady_clock::duration anIdleTimeout)
+    : theChannelsPerEndpoint{aChannelsPerEndpoint == 0 ? 1 : aChannelsPerEndpoint},
+      theIdleTimeout{anIdleTimeout},
+      theLastSweep{std::chrono::steady_clock::now()} {}
+
+ChannelPool::StubPtr ChannelPool::CreateStub(const std::string& address, size_t channelIndex) {
+    grpc::ChannelArguments args;
+    // Channels with identical arguments share one connection through the
+    // global subchannel pool; a local pool gives each channel its own
+    args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    args.SetInt("minidfs.channel_index", static_cast<int>(channelIndex));
+
+    auto channel = grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(), args);
+    return StubPtr(DataNodeService::NewStub(channel));
+}
+
+ChannelPool::StubPtr ChannelPool::GetStub(const std::string& address) {
+    std::lock_guard<std::mutex> lock(theMutex);
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - theLastSweep >= theIdleTimeout) {
+        EvictIdle(now);
+        theLastSweep = now;
+    }
+
+    Endpoint& endpoint = theEndpoints[address];
+    endpoint.last_used = now;
+
+    // Prefer a channel nobody else is using (the pool holds the only reference)
+    for (const auto& stub : endpoint.stubs) {
+        if (stub.use_count() == 1) {
+            return stub;
+        }
+    }
+
+    if (endpoint.stubs.size() < theChannelsPerEndpoint) {
+        endpoint.stubs.push_back(CreateStub(address, endpoint.stubs.size()));
+        return endpoint.stubs.back();
+    }
+
+    // At the per-endpoint limit: share, HTTP/2 multiplexes the calls
+    endpoint.next = (endpoint.next + 1) % endpoint.stubs.size();
+    return endpoint.stubs[endpoint.next];
+}
+
+void ChannelPool::Invalidate(const std::string& address) {
+    std::lock_guard<std::mutex> lock(theMutex);
+    theEndpoints.erase(address);  // In-flight callers keep their stub alive until they finish
+}
+
+void ChannelPool::EvictIdle(std::chrono::steady_clock::time_point now) {
+    for (auto it = theEndpoints.begin(); it != theEndpoints.end();) {
+        bool busy = false;
+        for (const auto& stub : it->second.stubs) {
+            if (stub.use_count() > 1) {
+                busy = true;
+                break;
+            }
+        }
+
+        if (!busy && now - it->second.last_used >= theIdleTimeout) {
+            it = theEndpoints.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+size_t ChannelPool::Size() const {
+    std::lock_guard<std::mutex> lock(theMutex);
+    size_t total = 0;
+    for (const auto& [address, endpoint] : theEndpoints) {
+        total += endpoint.stubs.size();
+    }
+    return total;
+}
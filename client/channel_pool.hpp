@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "dfs.grpc.pb.h"
+
+// Reusable DataNode connections keyed by address.
+// Each endpoint keeps up to channelsPerEndpoint channels (separate HTTP/2
+// connections); a caller is handed an idle one when available, otherwise a new
+// one is opened until the limit is hit, after which callers share channels
+// round-robin. Endpoints unused for idleTimeout are closed.
+class ChannelPool {
+private:
+    using StubPtr = std::shared_ptr<DataNodeService::Stub>;
+
+    struct Endpoint {
+        std::vector<StubPtr> stubs;
+        size_t next = 0;  // Round-robin cursor once every channel is busy
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+    mutable std::mutex theMutex;
+    std::unordered_map<std::string, Endpoint> theEndpoints;
+    size_t theChannelsPerEndpoint;
+    std::chrono::steady_clock::duration theIdleTimeout;
+    std::chrono::steady_clock::time_point theLastSweep;
+
+    StubPtr CreateStub(const std::string& address, size_t channelIndex);
+
+    // Close endpoints that have been idle too long; called with theMutex held
+    void EvictIdle(std::chrono::steady_clock::time_point now);
+
+public:
+    ChannelPool(size_t aChannelsPerEndpoint, std::chrono::steady_clock::duration anIdleTimeout);
+
+    ChannelPool(const ChannelPool&) = delete;
+    ChannelPool& operator=(const ChannelPool&) = delete;
+
+    // Get a stub for the DataNode at address. Callers hold the returned
+    // pointer for the duration of their RPC; that is what marks it busy.
+    StubPtr GetStub(const std::string& address);
+
+    // Drop every channel to address, e.g. after it was found unreachable, so
+    // the next call reconnects instead of waiting out the channel's backoff
+    void Invalidate(const std::string& address);
+
+    // Number of open channels across all endpoints
+    size_t Size() const;
+};
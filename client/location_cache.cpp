@@ -0,0 +1,63 @@
+#include "location_cache.hpp"
+
+LocationCache::LocationCache(size_t aCapacity, std::chrono::steady_clock::duration aTtl)
+    : theCapacity{aCapacity}, theTtl{aTtl} {}
+
+LocationCache::LocationsPtr LocationCache::Get(const std::string& fileName) {
+    std::lock_guard<std::mutex> lock(theMutex);
+
+    auto it = theIndex.find(fileName);
+    if (it == theIndex.end()) {
+        return nullptr;
+    }
+
+    if (std::chrono::steady_clock::now() >= it->second->expires_at) {
+        theEntries.erase(it->second);
+        theIndex.erase(it);
+        return nullptr;
+    }
+
+    // Mark as most recently used
+    theEntries.splice(theEntries.begin(), theEntries, it->second);
+    return it->second->locations;
+}
+
+void LocationCache::Put(const std::string& fileName, LocationsPtr aLocations) {
+    if (theCapacity == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(theMutex);
+    auto expiresAt = std::chrono::steady_clock::now() + theTtl;
+
+    auto it = theIndex.find(fileName);
+    if (it != theIndex.end()) {
+        it->second->locations = std::move(aLocations);
+        it->second->expires_at = expiresAt;
+        theEntries.splice(theEntries.begin(), theEntries, it->second);
+        return;
+    }
+
+    if (theEntries.size() >= theCapacity) {
+        theIndex.erase(theEntries.back().filename);
+        theEntries.pop_back();
+    }
+
+    theEntries.push_front({fileName, std::move(aLocations), expiresAt});
+    theIndex[fileName] = theEntries.begin();
+}
+
+void LocationCache::Invalidate(const std::string& fileName) {
+    std::lock_guard<std::mutex> lock(theMutex);
+
+    auto it = theIndex.find(fileName);
+    if (it != theIndex.end()) {
+        theEntries.erase(it->second);
+        theIndex.erase(it);
+    }
+}
+
+size_t LocationCache::Size() const {
+    std::lock_guard<std::mutex> lock(theMutex);
+    return theEntries.size();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "dfs.pb.h"
+
+// Bounded LRU of filename -> chunk locations with a TTL, so repeatedly
+// opened files don't cost a MetaServer round trip each time.
+// Entries are immutable and shared; invalidating one doesn't disturb readers
+// that already hold it.
+class LocationCache {
+public:
+    using LocationsPtr = std::shared_ptr<const FileLocationResponse>;
+
+private:
+    struct Entry {
+        std::string filename;
+        LocationsPtr locations;
+        std::chrono::steady_clock::time_point expires_at;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    mutable std::mutex theMutex;
+    EntryList theEntries;  // front = most recently used
+    std::unordered_map<std::string, EntryList::iterator> theIndex;
+    size_t theCapacity;
+    std::chrono::steady_clock::duration theTtl;
+
+public:
+    // A capacity of 0 disables caching
+    LocationCache(size_t aCapacity, std::chrono::steady_clock::duration aTtl);
+
+    // Returns nullptr on a miss or if the entry has expired
+    LocationsPtr Get(const std::string& fileName);
+
+    void Put(const std::string& fileName, LocationsPtr aLocations);
+
+    // Drop fileName, e.g. after one of its DataNodes turned out to be stale
+    void Invalidate(const std::string& fileName);
+
+    size_t Size() const;
+};
@@ -15,17 +15,18 @@ std::vector<std::string> ParseCommand(const std::string& line) {
     return tokens;
 }
 
-void RunClient(const std::string& address) {
+void RunClient(const std::string& address, const TransferOptions& options) {
     std::shared_ptr<grpc::ChannelInterface> channel{
         grpc::CreateChannel(address, grpc::InsecureChannelCredentials())
     };
     
-    MiniDfsClient client{channel}; 
+    MiniDfsClient client{channel, options}; 
 
     std::cout << "MiniDFS++ Client Started\n";
     std::cout << "Commands:\n";
     std::cout << "  upload <filename>\n";
     std::cout << "  download <filename>\n";
+    std::cout << "  delete <filename>\n";
     std::cout << "  exit\n";
 
     std::string line;
@@ -43,12 +44,42 @@ void RunClient(const std::string& address) {
             client.UploadFile(tokens[1]);
         } else if (cmd == "download" && tokens.size() == 2) {
             client.DownloadFile(tokens[1]);
+        } else if (cmd == "delete" && tokens.size() == 2) {
+            client.DeleteFile(tokens[1]);
         } else {
             std::cout << "[ERROR] Invalid command.\n";
         }
     }
 }
 
-int main() {
-    RunClient("0.0.0.0:50051");
+int main(int argc, char* argv[]) {
+    TransferOptions options;
+
+    // Simple argument parsing
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--parallelism" && i + 1 < argc) {
+            options.parallelism = std::stoul(argv[++i]);
+        } else if (arg == "--max-inflight-mb" && i + 1 < argc) {
+            options.maxInflightBytes = std::stoul(argv[++i]) * 1024 * 1024;  // Convert MB to bytes
+        } else if (arg == "--chunk-size-mb" && i + 1 < argc) {
+            options.chunkSize = std::stoul(argv[++i]) * 1024 * 1024;  // Convert MB to bytes
+        } else if (arg == "--channels-per-datanode" && i + 1 < argc) {
+            options.channelsPerEndpoint = std::stoul(argv[++i]);
+        } else if (arg == "--replication" && i + 1 < argc) {
+            options.replicationFactor = std::stoi(argv[++i]);
+        } else if (arg == "--help") {
+            std::cout << "Usage: " << argv[0] << " [options]\n"
+                      << "Options:\n"
+                      << "  --parallelism <n>          Concurrent chunk transfers (default: 8)\n"
+                      << "  --max-inflight-mb <MB>     Chunk data buffered per transfer (default: 64)\n"
+                      << "  --chunk-size-mb <MB>       Chunk size for uploaded files (default: 1)\n"
+                      << "  --channels-per-datanode <n> Connections kept open per DataNode (default: 4)\n"
+                      << "  --replication <n>          DataNodes each chunk is stored on (default: MetaServer's, 3)\n"
+                      << "  --help                     Show this help message\n";
+            return 0;
+        }
+    }
+
+    RunClient("0.0.0.0:50051", options);
 }
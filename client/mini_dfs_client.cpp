@@ -1,47 +1,254 @@
 #include "mini_dfs_client.hpp"
+#include "transfer_pool.hpp"
 #include <fstream>
 #include <iostream>
 #include <grpcpp/grpcpp.h>
 #include <sstream>
 #include <iomanip>
 #include <filesystem>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+constexpr size_t STREAM_FRAME_SIZE = 64 * 1024; // Bytes per StoreChunkStream frame
+
+// pwrite() until the whole buffer is written
+static bool WriteAt(int fd, const char* data, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t written = ::pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+MiniDfsClient::MiniDfsClient(std::shared_ptr<grpc::ChannelInterface> aChannel,
+                             const TransferOptions& anOptions)
+    : theStub{aChannel},
+      theOptions{anOptions},
+      theChannelPool{anOptions.channelsPerEndpoint, anOptions.channelIdleTimeout},
+      theLocationCache{anOptions.locationCacheCapacity, anOptions.locationCacheTtl} {}
 
-constexpr size_t CHUNK_SIZE = 1024 * 1024; // 1 MB Chunks
+size_t MiniDfsClient::GetOpenChannelCount() const {
+    return theChannelPool.Size();
+}
+
+bool MiniDfsClient::AllocateChunks(const std::string& fileName, size_t firstIndex, size_t count,
+                                   uintmax_t fileSize, size_t fileChunkSize,
+                                   std::vector<ChunkLocation>& locations) {
+    // Request allocation of the whole batch from MetaServer in one round trip
+    ChunkBatchAllocationRequest allocRequest;
+    allocRequest.set_filename(fileName);
+    allocRequest.set_file_chunk_size(fileChunkSize);
+    allocRequest.set_replication_factor(theOptions.replicationFactor);
+    for (size_t chunkIndex = firstIndex; chunkIndex < firstIndex + count; ++chunkIndex) {
+        uintmax_t chunkStart = static_cast<uintmax_t>(chunkIndex) * fileChunkSize;
+        ChunkSpec* spec = allocRequest.add_chunks();
+        spec->set_chunk_index(chunkIndex);
+        spec->set_chunk_size(std::min<uintmax_t>(fileChunkSize, fileSize - chunkStart));
+    }
 
-MiniDfsClient::MiniDfsClient(std::shared_ptr<grpc::ChannelInterface> aChannel) : theStub{aChannel} {}
+    ChunkBatchAllocationResponse allocResponse;
+    grpc::ClientContext allocContext;
+    grpc::Status allocStatus = theStub.AllocateChunks(&allocContext, allocRequest, &allocResponse);
+
+    if (!allocStatus.ok()) {
+        std::cerr << "[ERROR] Failed to allocate chunks " << firstIndex << "-" << firstIndex + count - 1
+                  << " from MetaServer: " << allocStatus.error_message() << "\n";
+        return false;
+    }
+
+    if (allocResponse.chunks_size() != static_cast<int>(count)) {
+        std::cerr << "[ERROR] MetaServer allocated " << allocResponse.chunks_size() 
+                  << " of " << count << " chunks\n";
+        return false;
+    }
+
+    locations.assign(allocResponse.chunks().begin(), allocResponse.chunks().end());
+    return true;
+}
+
+bool MiniDfsClient::StoreChunk(const ChunkLocation& chunkLocation, const std::vector<char>& data) {
+    const int32_t chunkIndex = chunkLocation.chunk_index();
+
+    if (chunkLocation.datanode_addresses_size() == 0) {
+        std::cerr << "[ERROR] No DataNode assigned for chunk " << chunkIndex << "\n";
+        return false;
+    }
+
+    const std::string& datanodeAddr = chunkLocation.datanode_addresses(0);
+    std::cout << "[INFO] Storing chunk " << chunkLocation.chunk_id() 
+              << " (index " << chunkIndex << ") to DataNode: " << datanodeAddr;
+    if (chunkLocation.datanode_addresses_size() > 1) {
+        std::cout << " (pipeline of " << chunkLocation.datanode_addresses_size() << ")";
+    }
+    std::cout << "\n";
+
+    // Reuse a pooled connection to the DataNode
+    auto datanodeStub = theChannelPool.GetStub(datanodeAddr);
+
+    // Stream the chunk in frames; the first carries the MetaServer-assigned
+    // chunk_id and the replicas the head passes it on to
+    Ack ack;
+    grpc::ClientContext dnContext;
+    auto writer = datanodeStub->StoreChunkStream(&dnContext, &ack);
+
+    size_t sent = 0;
+    do {
+        size_t frameSize = std::min(STREAM_FRAME_SIZE, data.size() - sent);
+        ChunkData frame;
+        if (sent == 0) {
+            frame.set_chunk_id(chunkLocation.chunk_id());
+            for (int i = 1; i < chunkLocation.datanode_addresses_size(); ++i) {
+                frame.add_downstream_addresses(chunkLocation.datanode_addresses(i));
+            }
+        }
+        frame.set_data(data.data() + sent, frameSize);
+        if (!writer->Write(frame)) {
+            break;  // Stream broken; Finish() reports why
+        }
+        sent += frameSize;
+    } while (sent < data.size());
+
+    writer->WritesDone();
+    grpc::Status dnStatus = writer->Finish();
+    if (dnStatus.error_code() == grpc::StatusCode::UNAVAILABLE) {
+        theChannelPool.Invalidate(datanodeAddr);
+    }
+
+    if (!dnStatus.ok() || !ack.ok()) {
+        std::cerr << "[ERROR] Could not store chunk " << chunkIndex << " via " << datanodeAddr 
+                  << ": " << (dnStatus.ok() ? ack.message() : dnStatus.error_message()) << "\n";
+        return false;
+    }
+
+    std::cout << "[SUCCESS] Chunk " << chunkLocation.chunk_id() 
+              << " stored on " << chunkLocation.datanode_addresses_size() << " DataNodes\n";
+    return true;
+}
+
+void MiniDfsClient::UploadFile(const std::string& fileName, size_t aChunkSize) {
+    const size_t chunkSize = aChunkSize > 0 ? aChunkSize : theOptions.chunkSize;
 
-void MiniDfsClient::UploadFile(const std::string& fileName) {
     std::ifstream file(fileName, std::ios::binary);
-    std::vector<std::vector<char>> chunks; 
 
     if(!file.is_open()) {
         std::cerr << "[ERROR] Cannot open file: " << fileName << "\n"; 
         return;
     }
 
-    // Read file into chunks
-    while (!file.eof()) {
-        std::vector<char> buffer(CHUNK_SIZE);
-        file.read(buffer.data(), CHUNK_SIZE);
-        std::streamsize bytesRead = file.gcount();
-        buffer.resize(bytesRead);  // trim unused part
-        if (bytesRead > 0) {
-            chunks.push_back(std::move(buffer));
-        }
+    std::error_code sizeError;
+    uintmax_t fileSize = std::filesystem::file_size(fileName, sizeError);
+    if (sizeError) {
+        std::cerr << "[ERROR] Cannot determine size of file: " << fileName << "\n";
+        return;
     }
-    file.close();
-
-    std::cout << "[INFO] File split into " << chunks.size() << " chunks\n";
+    std::cout << "[INFO] File split into " << (fileSize + chunkSize - 1) / chunkSize
+              << " chunks of up to " << chunkSize << " bytes\n";
 
     // Extract just the filename (not the full path) for MetaServer storage
     std::string filename_only = std::filesystem::path(fileName).filename().string();
 
+    // Any cached locations for the previous version are about to go stale
+    theLocationCache.Invalidate(filename_only);
+
+    // Pipeline: this thread reads chunks while the pool stores earlier ones.
+    // Locations are allocated ahead in batches, so the MetaServer round trip
+    // isn't on every chunk's path. Submit() blocks once maxInflightBytes of
+    // chunk data is buffered, so memory stays bounded regardless of file size.
+    const size_t totalChunks = (fileSize + chunkSize - 1) / chunkSize;
+    const size_t batchSize = std::max<size_t>(theOptions.allocationBatchSize, 1);
+    std::vector<ChunkLocation> batch;
+    size_t batchStart = 0;
+
+    std::atomic<bool> failed{false};
+    bool allocated = false;
+    size_t chunkCount = 0;
+    {
+        TransferPool pool(theOptions.parallelism, theOptions.maxInflightBytes);
+
+        while (!failed.load()) {
+            auto buffer = std::make_shared<std::vector<char>>(chunkSize);
+            file.read(buffer->data(), chunkSize);
+            std::streamsize bytesRead = file.gcount();
+            if (bytesRead <= 0) {
+                break;
+            }
+            buffer->resize(bytesRead);  // trim unused part
+
+            size_t chunkIndex = chunkCount++;
+
+            // Chunk sizes were allocated from the size the file had when we started
+            uintmax_t expectedSize = chunkIndex < totalChunks
+                ? std::min<uintmax_t>(chunkSize, fileSize - static_cast<uintmax_t>(chunkIndex) * chunkSize)
+                : 0;
+            if (buffer->size() != expectedSize) {
+                std::cerr << "[ERROR] File changed while uploading: " << fileName << "\n";
+                failed = true;
+                break;
+            }
+
+            if (chunkIndex == batchStart + batch.size()) {
+                batchStart = chunkIndex;
+                size_t count = std::min(batchSize, totalChunks - chunkIndex);
+                if (!AllocateChunks(filename_only, chunkIndex, count, fileSize, chunkSize, batch)) {
+                    failed = true;
+                    break;
+                }
+                allocated = true;
+            }
+
+            ChunkLocation location = batch[chunkIndex - batchStart];
+            pool.Submit(buffer->size(), [this, &failed, location, buffer] {
+                if (failed.load()) {
+                    return;  // Another chunk already failed, don't waste the RPCs
+                }
+                if (!StoreChunk(location, *buffer)) {
+                    failed = true;
+                }
+            });
+        }
+
+        if (file.bad()) {
+            std::cerr << "[ERROR] Read error on file: " << fileName << "\n";
+            failed = true;
+        } else if (!failed.load() && chunkCount != totalChunks) {
+            std::cerr << "[ERROR] File changed while uploading: " << fileName << "\n";
+            failed = true;
+        }
+
+        pool.Wait();
+    }
+    file.close();
+
+    if (failed.load()) {
+        std::cerr << "[ERROR] Upload failed for file: " << fileName << "\n";
+        // The allocations already replaced any earlier version; don't leave
+        // a file behind that lists chunks which were never stored
+        if (allocated) {
+            DeleteFile(filename_only);
+        }
+        return;
+    }
+
     // Handle empty files by registering them with MetaServer
-    if (chunks.empty()) {
+    if (chunkCount == 0) {
         ChunkAllocationRequest allocRequest;
         allocRequest.set_filename(filename_only);
         allocRequest.set_chunk_index(0);
         allocRequest.set_chunk_size(0);
+        allocRequest.set_file_chunk_size(chunkSize);
+        allocRequest.set_replication_factor(theOptions.replicationFactor);
 
         ChunkLocation chunkLocation;
         grpc::ClientContext allocContext;
@@ -56,89 +263,167 @@ void MiniDfsClient::UploadFile(const std::string& fileName) {
         std::cout << "[SUCCESS] Empty file registered with MetaServer\n";
     }
 
-    // For each chunk, request allocation from MetaServer and upload to DataNode
-    for (size_t i = 0; i < chunks.size(); ++i) {
-        // Request chunk allocation from MetaServer
-        ChunkAllocationRequest allocRequest;
-        allocRequest.set_filename(filename_only);
-        allocRequest.set_chunk_index(i);
-        allocRequest.set_chunk_size(chunks[i].size());
-
-        ChunkLocation chunkLocation;
-        grpc::ClientContext allocContext;
-        grpc::Status allocStatus = theStub.AllocateChunkLocation(&allocContext, allocRequest, &chunkLocation);
+    std::cout << "[SUCCESS] Upload completed for file: " << fileName << "\n";
+}
 
-        if (!allocStatus.ok()) {
-            std::cerr << "[ERROR] Failed to allocate chunk " << i << " from MetaServer: " 
-                      << allocStatus.error_message() << "\n";
-            return;
+grpc::Status MiniDfsClient::ReadFromReplicas(const std::string& fileName, const ChunkLocation& chunkLoc,
+                                             int64_t offset, int64_t length, size_t expectedSize,
+                                             size_t maxSize, const FrameSink& sink) {
+    grpc::Status lastStatus(grpc::StatusCode::UNAVAILABLE, "No DataNode holds the chunk");
+
+    // Try each DataNode address until successful
+    for (const std::string& datanodeAddr : chunkLoc.datanode_addresses()) {
+        std::cout << "[INFO] Retrieving chunk " << chunkLoc.chunk_id() 
+                  << " from DataNode: " << datanodeAddr << "\n";
+
+        // Reuse a pooled connection to the DataNode
+        auto datanodeStub = theChannelPool.GetStub(datanodeAddr);
+
+        // Request chunk, or just the wanted range of it
+        ChunkRequest chunkRequest;
+        chunkRequest.set_chunk_id(chunkLoc.chunk_id());
+        chunkRequest.set_offset(offset);
+        chunkRequest.set_length(length);
+
+        // Hand frames on as they arrive; a retry against the next replica
+        // starts again from position 0 and overwrites what this one delivered
+        grpc::ClientContext dnContext;
+        auto reader = datanodeStub->ReadChunkStream(&dnContext, chunkRequest);
+
+        ChunkData frame;
+        size_t received = 0;
+        bool sinkFailed = false;
+        bool oversized = false;
+        while (reader->Read(&frame)) {
+            // A frame running past the range would land on a neighbour's bytes
+            if (frame.data().size() > maxSize - received) {
+                oversized = true;
+                dnContext.TryCancel();
+                break;
+            }
+            if (!sink(received, frame.data())) {
+                sinkFailed = true;
+                dnContext.TryCancel();
+                break;
+            }
+            received += frame.data().size();
         }
+        grpc::Status dnStatus = reader->Finish();
 
-        if (chunkLocation.datanode_addresses_size() == 0) {
-            std::cerr << "[ERROR] No DataNode assigned for chunk " << i << "\n";
-            return;
+        if (sinkFailed) {
+            return grpc::Status(grpc::StatusCode::ABORTED, "Failed to consume chunk data");
         }
 
-        // Try to store chunk to assigned DataNodes (with retry logic)
-        bool stored = false;
-        for (const std::string& datanodeAddr : chunkLocation.datanode_addresses()) {
-            std::cout << "[INFO] Storing chunk " << chunkLocation.chunk_id() 
-                      << " (index " << i << ") to DataNode: " << datanodeAddr << "\n";
+        if (oversized) {
+            std::cerr << "[WARNING] Chunk " << chunkLoc.chunk_id() << " from " << datanodeAddr
+                      << " runs past " << maxSize << " bytes\n";
+            lastStatus = grpc::Status(grpc::StatusCode::DATA_LOSS, "Oversized chunk");
+            continue;
+        }
 
-            // Create a channel to the DataNode
-            auto channel = grpc::CreateChannel(datanodeAddr, grpc::InsecureChannelCredentials());
-            DataNodeService::Stub datanodeStub(channel);
+        if (dnStatus.error_code() == grpc::StatusCode::UNAVAILABLE) {
+            theChannelPool.Invalidate(datanodeAddr);
+        }
 
-            // Prepare chunk data with MetaServer-assigned chunk_id
-            ChunkData chunkData;
-            chunkData.set_chunk_id(chunkLocation.chunk_id());
-            chunkData.set_data(chunks[i].data(), chunks[i].size());
+        // The replica set we were given is out of date
+        if (dnStatus.error_code() == grpc::StatusCode::UNAVAILABLE ||
+            dnStatus.error_code() == grpc::StatusCode::NOT_FOUND) {
+            theLocationCache.Invalidate(fileName);
+        }
 
-            // Send chunk to DataNode
-            Ack ack;
-            grpc::ClientContext dnContext;
-            grpc::Status dnStatus = datanodeStub.StoreChunk(&dnContext, chunkData, &ack);
+        // Reading past the end of a chunk is the caller's mistake, not the replica's
+        if (dnStatus.error_code() == grpc::StatusCode::OUT_OF_RANGE) {
+            return dnStatus;
+        }
 
-            if (dnStatus.ok() && ack.ok()) {
-                std::cout << "[SUCCESS] Chunk " << chunkLocation.chunk_id() 
-                          << " stored successfully\n";
-                stored = true;
-                break;
-            } else {
-                std::cerr << "[WARNING] Failed to store chunk to " << datanodeAddr 
-                          << ": " << (dnStatus.ok() ? ack.message() : dnStatus.error_message()) << "\n";
-            }
+        if (!dnStatus.ok() || received == 0) {
+            std::cerr << "[WARNING] Failed to retrieve chunk from " << datanodeAddr 
+                      << ": " << dnStatus.error_message() << "\n";
+            lastStatus = dnStatus.ok() ? grpc::Status(grpc::StatusCode::DATA_LOSS, "Empty chunk") : dnStatus;
+            continue;
         }
 
-        if (!stored) {
-            std::cerr << "[ERROR] Could not store chunk " << i << " to any DataNode\n";
-            return;
+        // Only the end of a file may come back short
+        if (expectedSize != 0 && received != expectedSize) {
+            std::cerr << "[WARNING] Chunk " << chunkLoc.chunk_id() << " from " << datanodeAddr
+                      << " has unexpected size " << received << "\n";
+            lastStatus = grpc::Status(grpc::StatusCode::DATA_LOSS, "Unexpected chunk size");
+            continue;
         }
+
+        return grpc::Status::OK;
     }
 
-    std::cout << "[SUCCESS] Upload completed for file: " << fileName << "\n";
+    std::cerr << "[ERROR] Could not retrieve chunk " << chunkLoc.chunk_id() 
+              << " from any DataNode\n";
+    return lastStatus;
 }
 
-void MiniDfsClient::DownloadFile(const std::string& fileName) {
+bool MiniDfsClient::DownloadChunk(const std::string& fileName, const ChunkLocation& chunkLoc,
+                                  int fd, off_t offset, size_t expectedSize, size_t chunkSize) {
+    // Each frame goes straight to its place in the output file
+    size_t chunkBytes = 0;
+    auto writeFrame = [fd, offset, &chunkBytes](size_t position, const std::string& frame) {
+        chunkBytes = position + frame.size();
+        return WriteAt(fd, frame.data(), frame.size(), offset + static_cast<off_t>(position));
+    };
+
+    grpc::Status status = ReadFromReplicas(fileName, chunkLoc, 0, 0, expectedSize, chunkSize, writeFrame);
+    if (status.error_code() == grpc::StatusCode::ABORTED) {
+        std::cerr << "[ERROR] Failed to write chunk " << chunkLoc.chunk_id() 
+                  << " to output file\n";
+    }
+    if (!status.ok()) {
+        return false;
+    }
+
+    // The last chunk ends the file; cut off what an abandoned replica wrote past it
+    if (expectedSize == 0 && ::ftruncate(fd, offset + static_cast<off_t>(chunkBytes)) != 0) {
+        std::cerr << "[ERROR] Failed to truncate output file after chunk " << chunkLoc.chunk_id() << "\n";
+        return false;
+    }
+
+    std::cout << "[SUCCESS] Retrieved chunk " << chunkLoc.chunk_id() 
+              << " (" << chunkBytes << " bytes)\n";
+    return true;
+}
+
+LocationCache::LocationsPtr MiniDfsClient::LookupFile(const std::string& fileName, bool& fromCache) {
+    fromCache = false;
+    if (auto cached = theLocationCache.Get(fileName)) {
+        fromCache = true;
+        return cached;
+    }
+
     // Request file location from MetaServer
     FileLocationRequest request;
     request.set_filename(fileName);
 
-    FileLocationResponse response;
+    auto response = std::make_shared<FileLocationResponse>();
     grpc::ClientContext context;
-    grpc::Status status = theStub.GetFileLocation(&context, request, &response);
+    grpc::Status status = theStub.GetFileLocation(&context, request, response.get());
 
     if (!status.ok()) {
         std::cerr << "[ERROR] Failed to get file location from MetaServer: " 
                   << status.error_message() << "\n";
-        return;
+        return nullptr;
     }
 
-    if (!response.found()) {
+    if (!response->found()) {
         std::cerr << "[ERROR] File not found: " << fileName << "\n";
-        return;
+        return nullptr;
+    }
+
+    if (response->chunk_size() <= 0) {
+        std::cerr << "[ERROR] MetaServer sent no chunk size for file: " << fileName << "\n";
+        return nullptr;
     }
 
+    theLocationCache.Put(fileName, response);
+    return response;
+}
+
+bool MiniDfsClient::FetchChunks(const std::string& fileName, const FileLocationResponse& response) {
     // Handle empty files (0 chunks is valid)
     if (response.chunks_size() == 0) {
         std::cout << "[INFO] Downloading empty file: " << fileName << "\n";
@@ -147,73 +432,185 @@ void MiniDfsClient::DownloadFile(const std::string& fileName) {
         std::ofstream outFile(fileName, std::ios::binary);
         if (!outFile.is_open()) {
             std::cerr << "[ERROR] Cannot create output file: " << fileName << "\n";
-            return;
+            return false;
         }
         outFile.close();
-        
-        std::cout << "[SUCCESS] Download completed for empty file: " << fileName << "\n";
-        return;
+        return true;
     }
 
     std::cout << "[INFO] Downloading " << response.chunks_size() << " chunks for file: " << fileName << "\n";
 
-    // Open output file
-    std::ofstream outFile(fileName, std::ios::binary);
-    if (!outFile.is_open()) {
+    // Every chunk is written at its own offset, so the location list must be
+    // complete; a gap means the MetaServer had no live replica for a chunk
+    for (int i = 0; i < response.chunks_size(); ++i) {
+        const ChunkLocation& chunkLoc = response.chunks(i);
+        if (chunkLoc.chunk_index() != i || chunkLoc.datanode_addresses_size() == 0) {
+            std::cerr << "[ERROR] No DataNode available for chunk " << i << " of " << fileName << "\n";
+            return false;
+        }
+    }
+
+    // Open output file for positional writes
+    int fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
         std::cerr << "[ERROR] Cannot create output file: " << fileName << "\n";
-        return;
+        return false;
     }
 
-    // Download each chunk from DataNodes
-    for (const ChunkLocation& chunkLoc : response.chunks()) {
-        if (chunkLoc.datanode_addresses_size() == 0) {
-            std::cerr << "[ERROR] No DataNode available for chunk " << chunkLoc.chunk_id() << "\n";
-            outFile.close();
-            std::remove(fileName.c_str());
-            return;
+    // Fetch chunks concurrently; each worker writes its chunk straight to its
+    // offset, so completion order doesn't matter and at most maxInflightBytes
+    // of chunk data is held in memory at once
+    std::atomic<bool> failed{false};
+    {
+        TransferPool pool(theOptions.parallelism, theOptions.maxInflightBytes);
+        const int lastIndex = response.chunks_size() - 1;
+        const size_t chunkSize = static_cast<size_t>(response.chunk_size());
+
+        for (const ChunkLocation& chunkLoc : response.chunks()) {
+            pool.Submit(chunkSize, [this, &failed, &fileName, &chunkLoc, fd, lastIndex, chunkSize] {
+                if (failed.load()) {
+                    return;
+                }
+                // Only the last chunk of a file may be short
+                size_t expectedSize = chunkLoc.chunk_index() == lastIndex ? 0 : chunkSize;
+                off_t offset = static_cast<off_t>(chunkLoc.chunk_index()) * chunkSize;
+                if (!DownloadChunk(fileName, chunkLoc, fd, offset, expectedSize, chunkSize)) {
+                    failed = true;
+                }
+            });
         }
 
-        bool chunkRetrieved = false;
-        
-        // Try each DataNode address until successful
-        for (const std::string& datanodeAddr : chunkLoc.datanode_addresses()) {
-            std::cout << "[INFO] Retrieving chunk " << chunkLoc.chunk_id() 
-                      << " from DataNode: " << datanodeAddr << "\n";
-
-            // Create a channel to the DataNode
-            auto channel = grpc::CreateChannel(datanodeAddr, grpc::InsecureChannelCredentials());
-            DataNodeService::Stub datanodeStub(channel);
-
-            // Request chunk
-            ChunkRequest chunkRequest;
-            chunkRequest.set_chunk_id(chunkLoc.chunk_id());
-
-            ChunkData chunkData;
-            grpc::ClientContext dnContext;
-            grpc::Status dnStatus = datanodeStub.ReadChunk(&dnContext, chunkRequest, &chunkData);
-
-            if (dnStatus.ok() && chunkData.data().size() > 0) {
-                // Write chunk to file
-                outFile.write(chunkData.data().c_str(), chunkData.data().size());
-                std::cout << "[SUCCESS] Retrieved chunk " << chunkLoc.chunk_id() 
-                          << " (" << chunkData.data().size() << " bytes)\n";
-                chunkRetrieved = true;
-                break;
-            } else {
-                std::cerr << "[WARNING] Failed to retrieve chunk from " << datanodeAddr 
-                          << ": " << dnStatus.error_message() << "\n";
-            }
+        pool.Wait();
+    }
+
+    ::close(fd);
+
+    if (failed.load()) {
+        std::remove(fileName.c_str());  // Remove incomplete file
+        return false;
+    }
+    return true;
+}
+
+void MiniDfsClient::DownloadFile(const std::string& fileName) {
+    // A cached location list may point at replicas that have since moved;
+    // if downloading with it fails, look the file up again once
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool fromCache = false;
+        auto locations = LookupFile(fileName, fromCache);
+        if (!locations) {
+            return;
         }
 
-        if (!chunkRetrieved) {
-            std::cerr << "[ERROR] Could not retrieve chunk " << chunkLoc.chunk_id() 
-                      << " from any DataNode\n";
-            outFile.close();
-            std::remove(fileName.c_str());  // Remove incomplete file
+        if (FetchChunks(fileName, *locations)) {
+            std::cout << "[SUCCESS] Download completed for file: " << fileName << "\n";
             return;
         }
+
+        theLocationCache.Invalidate(fileName);
+        if (!fromCache) {
+            break;
+        }
+        std::cout << "[INFO] Cached locations for " << fileName << " are stale, retrying with fresh lookup\n";
+    }
+
+    std::cerr << "[ERROR] Download failed for file: " << fileName << "\n";
+}
+
+bool MiniDfsClient::DeleteFile(const std::string& fileName) {
+    FileDeletionRequest request;
+    request.set_filename(fileName);
+
+    Ack ack;
+    grpc::ClientContext context;
+    grpc::Status status = theStub.DeleteFile(&context, request, &ack);
+    theLocationCache.Invalidate(fileName);
+
+    if (!status.ok()) {
+        std::cerr << "[ERROR] Failed to delete file " << fileName << ": " << status.error_message() << "\n";
+        return false;
+    }
+    if (!ack.ok()) {
+        std::cerr << "[ERROR] Failed to delete file " << fileName << ": " << ack.message() << "\n";
+        return false;
+    }
+
+    std::cout << "[SUCCESS] Deleted file: " << fileName << "\n";
+    return true;
+}
+
+bool MiniDfsClient::FetchRange(const std::string& fileName, const FileLocationResponse& response,
+                               int64_t offset, int64_t length, std::vector<char>& out) {
+    out.clear();
+    if (length <= 0) {
+        return true;
+    }
+
+    const int64_t chunkSize = response.chunk_size();
+    const int64_t chunkCount = response.chunks_size();
+    const int64_t firstIndex = offset / chunkSize;
+    const int64_t lastIndex = std::min((offset + length - 1) / chunkSize, chunkCount - 1);
+
+    // Only the chunks overlapping the range are contacted, and each DataNode
+    // returns just the overlapping bytes
+    for (int64_t index = firstIndex; index <= lastIndex; ++index) {
+        const ChunkLocation& chunkLoc = response.chunks(static_cast<int>(index));
+        if (chunkLoc.chunk_index() != index || chunkLoc.datanode_addresses_size() == 0) {
+            std::cerr << "[ERROR] No DataNode available for chunk " << index << " of " << fileName << "\n";
+            return false;
+        }
+
+        int64_t chunkOffset = std::max(offset, index * chunkSize) - index * chunkSize;
+        int64_t chunkLength = std::min(offset + length, (index + 1) * chunkSize) - index * chunkSize - chunkOffset;
+        bool isLastChunk = index == chunkCount - 1;
+
+        std::string data;
+        auto appendFrame = [&data](size_t position, const std::string& frame) {
+            data.resize(position);  // Drop anything a failed replica delivered
+            data.append(frame);
+            return true;
+        };
+        grpc::Status status = ReadFromReplicas(fileName, chunkLoc, chunkOffset, chunkLength,
+                                               isLastChunk ? 0 : chunkLength, chunkLength, appendFrame);
+        if (isLastChunk && status.error_code() == grpc::StatusCode::OUT_OF_RANGE) {
+            break;  // Range starts past the end of the file
+        }
+        if (!status.ok()) {
+            return false;
+        }
+
+        out.insert(out.end(), data.begin(), data.end());
+    }
+
+    return true;
+}
+
+bool MiniDfsClient::ReadRange(const std::string& fileName, int64_t offset, int64_t length,
+                              std::vector<char>& out) {
+    if (offset < 0 || length < 0) {
+        std::cerr << "[ERROR] Invalid range for " << fileName << ": offset " << offset
+                  << ", length " << length << "\n";
+        return false;
+    }
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool fromCache = false;
+        auto locations = LookupFile(fileName, fromCache);
+        if (!locations) {
+            return false;
+        }
+
+        if (FetchRange(fileName, *locations, offset, length, out)) {
+            return true;
+        }
+
+        theLocationCache.Invalidate(fileName);
+        if (!fromCache) {
+            break;
+        }
+        std::cout << "[INFO] Cached locations for " << fileName << " are stale, retrying with fresh lookup\n";
     }
 
-    outFile.close();
-    std::cout << "[SUCCESS] Download completed for file: " << fileName << "\n";
+    std::cerr << "[ERROR] Range read failed for file: " << fileName << "\n";
+    return false;
 }
@@ -1,13 +1,90 @@
+#pragma once
+
 #include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <sys/types.h>
 #include "dfs.grpc.pb.h"
+#include "channel_pool.hpp"
+#include "location_cache.hpp"
+
+// Tuning knobs for chunk transfers
+struct TransferOptions {
+    size_t chunkSize = 1024 * 1024;                 // Chunk size for uploads that don't pick their own
+    int32_t replicationFactor = 0;                  // DataNodes each uploaded chunk is stored on (0 = MetaServer default)
+    size_t parallelism = 8;                         // Chunks stored concurrently
+    size_t maxInflightBytes = 64 * 1024 * 1024;     // Cap on chunk data buffered in memory
+    size_t allocationBatchSize = 256;               // Chunks allocated per MetaServer call
+    size_t channelsPerEndpoint = 4;                 // Connections kept open to each DataNode
+    std::chrono::seconds channelIdleTimeout{60};    // Close DataNode connections unused this long
+    size_t locationCacheCapacity = 1024;            // Files whose chunk locations are cached (0 disables)
+    std::chrono::seconds locationCacheTtl{30};      // How long cached locations are trusted
+};
 
 class MiniDfsClient {
 private:
     MetaService::Stub theStub;
-public: 
-    MiniDfsClient(std::shared_ptr<grpc::ChannelInterface> aChannel);
+    TransferOptions theOptions;
+    ChannelPool theChannelPool;
+    LocationCache theLocationCache;
+
+    // Allocate chunks [firstIndex, firstIndex + count) of a fileSize-byte file
+    // with one MetaServer call
+    bool AllocateChunks(const std::string& fileName, size_t firstIndex, size_t count,
+                        uintmax_t fileSize, size_t fileChunkSize,
+                        std::vector<ChunkLocation>& locations);
+
+    // Store an allocated chunk to every one of its assigned DataNodes. The
+    // bytes go out once, to the first, which relays them down a pipeline
+    // through the rest; fails unless the whole pipeline acknowledges.
+    bool StoreChunk(const ChunkLocation& chunkLocation, const std::vector<char>& data);
+
+    // Chunk locations for fileName, from the cache when fresh; nullptr on error
+    LocationCache::LocationsPtr LookupFile(const std::string& fileName, bool& fromCache);
+
+    // Fetch every chunk in response into the local file fileName
+    bool FetchChunks(const std::string& fileName, const FileLocationResponse& response);
+
+    // Receives each streamed frame with its position in the requested range;
+    // returning false aborts the read
+    using FrameSink = std::function<bool(size_t position, const std::string& frame)>;
+
+    // Stream [offset, offset + length) of a chunk from the first replica that has it.
+    // A non-zero expectedSize rejects replies of any other size. A replica
+    // that sends more than maxSize bytes is abandoned before the frame that
+    // would overrun reaches sink.
+    grpc::Status ReadFromReplicas(const std::string& fileName, const ChunkLocation& chunkLoc,
+                                  int64_t offset, int64_t length, size_t expectedSize,
+                                  size_t maxSize, const FrameSink& sink);
+
+    // Fetch one chunk from any of its replicas and write it to fd at offset.
+    // expectedSize is 0 for the last chunk, which may be short; no replica
+    // writes past chunkSize bytes from offset.
+    bool DownloadChunk(const std::string& fileName, const ChunkLocation& chunkLoc,
+                       int fd, off_t offset, size_t expectedSize, size_t chunkSize);
+
+    // Fetch the bytes of response's file in [offset, offset + length) into out
+    bool FetchRange(const std::string& fileName, const FileLocationResponse& response,
+                    int64_t offset, int64_t length, std::vector<char>& out);
+public:
+    MiniDfsClient(std::shared_ptr<grpc::ChannelInterface> aChannel,
+                  const TransferOptions& anOptions = TransferOptions());
+
+    // Upload fileName split into aChunkSize-byte chunks (0 uses TransferOptions::chunkSize)
+    void UploadFile(const std::string& fileName, size_t aChunkSize = 0);
+
+    void DownloadFile(const std::string& fileName);
+
+    // Remove fileName from the file system; the DataNodes reclaim its chunks later
+    bool DeleteFile(const std::string& fileName);
 
-    void UploadFile(const std::string& fileName);
+    // Read length bytes starting at offset without downloading the whole file.
+    // out is shorter than length if the range runs past the end of the file.
+    bool ReadRange(const std::string& fileName, int64_t offset, int64_t length,
+                   std::vector<char>& out);
 
-    void DownloadFile(const std::string& fileName); 
+    // Number of DataNode channels currently held open for reuse
+    size_t GetOpenChannelCount() const;
 };
@@ -0,0 +1,75 @@
+#include "transfer_pool.hpp"
+
+TransferPool::TransferPool(size_t aThreadCount, size_t aMaxInflightBytes)
+    : theMaxInflightBytes{aMaxInflightBytes} {
+    if (aThreadCount == 0) {
+        aThreadCount = 1;  // Minimum of one worker
+    }
+
+    theWorkers.reserve(aThreadCount);
+    for (size_t i = 0; i < aThreadCount; ++i) {
+        theWorkers.emplace_back(&TransferPool::WorkerLoop, this);
+    }
+}
+
+TransferPool::~TransferPool() {
+    Wait();
+    {
+        std::lock_guard<std::mutex> lock(theMutex);
+        theStopping = true;
+    }
+    theWorkReady.notify_all();
+
+    for (auto& worker : theWorkers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+void TransferPool::Submit(size_t aBytes, std::function<void()> aTask) {
+    std::unique_lock<std::mutex> lock(theMutex);
+
+    theTaskDone.wait(lock, [&] {
+        return theInflightTasks == 0 || theInflightBytes + aBytes <= theMaxInflightBytes;
+    });
+
+    theInflightBytes += aBytes;
+    theInflightTasks++;
+    theQueue.push({aBytes, std::move(aTask)});
+    lock.unlock();
+
+    theWorkReady.notify_one();
+}
+
+void TransferPool::Wait() {
+    std::unique_lock<std::mutex> lock(theMutex);
+    theTaskDone.wait(lock, [&] { return theInflightTasks == 0; });
+}
+
+void TransferPool::WorkerLoop() {
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(theMutex);
+            theWorkReady.wait(lock, [&] { return theStopping || !theQueue.empty(); });
+
+            if (theQueue.empty()) {
+                return;  // Stopping and fully drained
+            }
+
+            task = std::move(theQueue.front());
+            theQueue.pop();
+        }
+
+        task.run();
+        task.run = nullptr;  // Release captured chunk buffers before giving back the budget
+
+        {
+            std::lock_guard<std::mutex> lock(theMutex);
+            theInflightBytes -= task.bytes;
+            theInflightTasks--;
+        }
+        theTaskDone.notify_all();
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed-size worker pool for chunk transfers.
+// Every task is admitted against an in-flight byte budget, so a producer that
+// streams a large file blocks in Submit() instead of buffering it in memory.
+class TransferPool {
+private:
+    struct Task {
+        size_t bytes;
+        std::function<void()> run;
+    };
+
+    std::mutex theMutex;
+    std::condition_variable theWorkReady;   // Signalled when a task is queued or on shutdown
+    std::condition_variable theTaskDone;    // Signalled when a task releases its budget
+    std::queue<Task> theQueue;
+    std::vector<std::thread> theWorkers;
+
+    size_t theMaxInflightBytes;
+    size_t theInflightBytes = 0;   // Bytes held by queued + running tasks
+    size_t theInflightTasks = 0;   // Queued + running tasks
+    bool theStopping = false;
+
+    void WorkerLoop();
+
+public:
+    TransferPool(size_t aThreadCount, size_t aMaxInflightBytes);
+    ~TransferPool();
+
+    TransferPool(const TransferPool&) = delete;
+    TransferPool& operator=(const TransferPool&) = delete;
+
+    // Queue a task holding aBytes of buffered data. Blocks while the budget is
+    // exhausted; a single task larger than the whole budget is still admitted
+    // once the pool is otherwise idle.
+    void Submit(size_t aBytes, std::function<void()> aTask);
+
+    // Block until every submitted task has finished
+    void Wait();
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Chunks are identified by a 64-bit handle the MetaServer hands out from a
+// counter, so maps, caches and reports key on integers and never hash or
+// compare strings. Text only appears at the edges: DataNode file names and
+// the command line.
+using ChunkId = uint64_t;
+
+// Never assigned; marks "no chunk" (an empty slot of a file, an unset field)
+constexpr ChunkId NO_CHUNK = 0;
+
+inline std::string formatChunkId(ChunkId chunk_id) {
+    return std::to_string(chunk_id);
+}
+
+// False unless text is exactly a chunk id as formatChunkId writes it
+inline bool parseChunkId(std::string_view text, ChunkId& chunk_id) {
+    const char* end = text.data() + text.size();
+    auto [position, error] = std::from_chars(text.data(), end, chunk_id);
+    return error == std::errc() && position == end && chunk_id != NO_CHUNK &&
+           (text.size() == 1 || text.front() != '0');
+}
@@ -0,0 +1,52 @@
+#include "heartbeat.hpp"
+
+HeartbeatReporter::HeartbeatReporter(const std::string& address, DataNodeStorage* storage,
+                                     int full_report_interval)
+    : address(address), storage(storage), full_report_interval(full_report_interval) {}
+
+grpc::Status HeartbeatReporter::send(MetaService::Stub* stub, HeartbeatResponse* response,
+                                     std::chrono::milliseconds timeout) {
+    DataNodeHeartbeat heartbeat;
+    heartbeat.set_address(address);
+    heartbeat.set_available_space(storage->getAvailableSpace());
+    heartbeat.set_capacity(storage->getCapacity());
+    heartbeat.set_current_load(storage->getCurrentLoad());
+    heartbeat.set_sequence(acked_sequence + 1);
+    
+    bool full = need_full_report || reports_since_full >= full_report_interval;
+    ChunkReport changes;
+    if (full) {
+        heartbeat.set_full_report(true);
+        std::vector<ChunkId> chunk_ids = storage->takeFullChunkReport();
+        heartbeat.mutable_stored_chunk_ids()->Add(chunk_ids.begin(), chunk_ids.end());
+        last_size = heartbeat.stored_chunk_ids_size();
+    } else {
+        changes = storage->takeChunkChanges();
+        heartbeat.mutable_added_chunk_ids()->Add(changes.added.begin(), changes.added.end());
+        heartbeat.mutable_removed_chunk_ids()->Add(changes.removed.begin(), changes.removed.end());
+        last_size = changes.added.size() + changes.removed.size();
+    }
+    last_full = full;
+    
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + timeout);
+    grpc::Status status = stub->Heartbeat(&context, heartbeat, response);
+    
+    if (!status.ok() || !response->ok()) {
+        // It may or may not have been applied; the retry reuses the number,
+        // and applying the same changes twice is harmless
+        if (full) {
+            need_full_report = true;
+        } else {
+            storage->restoreChunkChanges(changes);
+        }
+        return status;
+    }
+    
+    acked_sequence++;
+    reports_since_full = full ? 0 : reports_since_full + 1;
+    
+    // A rejected delta is covered by the full report that follows
+    need_full_report = response->need_full_report();
+    return status;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <grpcpp/grpcpp.h>
+#include <chrono>
+#include <string>
+#include "dfs.grpc.pb.h"
+#include "storage.hpp"
+
+// Heartbeats between periodic full chunk reports
+constexpr int FULL_REPORT_INTERVAL = 360;  // One hour at the default 10 s heartbeat
+
+// Builds a DataNode's heartbeats. Normally a heartbeat only carries the
+// chunks added and removed since the last report the MetaServer
+// acknowledged; a full report of every chunk goes out first, every
+// full_report_interval heartbeats, and whenever the MetaServer asks for one
+// (it lost track, e.g. after a restart). Reports are numbered, and one that
+// may not have arrived is resent under the same number.
+class HeartbeatReporter {
+private:
+    std::string address;
+    DataNodeStorage* storage;
+    int full_report_interval;
+    
+    uint64_t acked_sequence = 0;
+    bool need_full_report = true;
+    int reports_since_full = 0;
+    
+    bool last_full = false;
+    size_t last_size = 0;
+
+public:
+    HeartbeatReporter(const std::string& address, DataNodeStorage* storage,
+                      int full_report_interval = FULL_REPORT_INTERVAL);
+    
+    // Send one heartbeat
+    grpc::Status send(MetaService::Stub* stub, HeartbeatResponse* response,
+                      std::chrono::milliseconds timeout = std::chrono::seconds(5));
+    
+    // What the last heartbeat carried, for logging
+    bool lastReportWasFull() const { return last_full; }
+    size_t lastReportSize() const { return last_size; }
+};
@@ -8,63 +8,21 @@
 #include <grpcpp/server_builder.h>
 #include "dfs.grpc.pb.h"
 #include "storage.hpp"
+#include "service.hpp"
+#include "heartbeat.hpp"
+#include "replicator.hpp"
 
 using grpc::Server;
 using grpc::ServerBuilder;
-using grpc::ServerContext;
-using grpc::Status;
 
 // Global flag for graceful shutdown
 std::atomic<bool> running{true};
 
-class DataNodeServiceImpl final : public DataNodeService::Service {
-private:
-    DataNodeStorage* storage;
-    
-public:
-    explicit DataNodeServiceImpl(DataNodeStorage* storage) : storage(storage) {}
-    
-    Status StoreChunk(ServerContext* context, const ::ChunkData* request, ::Ack* response) override {
-        storage->incrementLoad();
-        
-        // Convert protobuf bytes to vector
-        std::vector<char> data(request->data().begin(), request->data().end());
-        
-        bool success = storage->storeChunk(request->chunk_id(), data);
-        
-        response->set_ok(success);
-        if (success) {
-            response->set_message("Chunk stored successfully");
-        } else {
-            response->set_message("Failed to store chunk");
-        }
-        
-        storage->decrementLoad();
-        return Status::OK;
-    }
-    
-    Status ReadChunk(ServerContext* context, const ::ChunkRequest* request, ::ChunkData* response) override {
-        storage->incrementLoad();
-        
-        std::vector<char> data = storage->readChunk(request->chunk_id());
-        
-        if (!data.empty()) {
-            response->set_chunk_id(request->chunk_id());
-            response->set_data(data.data(), data.size());
-        } else {
-            storage->decrementLoad();
-            return grpc::Status(grpc::StatusCode::NOT_FOUND, "Chunk not found");
-        }
-        
-        storage->decrementLoad();
-        return Status::OK;
-    }
-};
-
 // Heartbeat thread function
 void heartbeatThread(const std::string& metaserver_addr, 
                     const std::string& datanode_addr,
-                    DataNodeStorage* storage) {
+                    DataNodeStorage* storage,
+                    ChunkReplicator* replicator) {
     
     // Create channel to MetaServer
     auto channel = grpc::CreateChannel(metaserver_addr, grpc::InsecureChannelCredentials());
@@ -89,44 +47,35 @@ void heartbeatThread(const std::string& metaserver_addr,
     }
     
     // Send periodic heartbeats
+    HeartbeatReporter reporter(datanode_addr, storage);
     while (running.load()) {
         std::this_thread::sleep_for(std::chrono::seconds(10));  // Heartbeat every 10 seconds
         
         if (!running.load()) break;
         
-        DataNodeHeartbeat heartbeat;
-        heartbeat.set_address(datanode_addr);
-        heartbeat.set_available_space(storage->getAvailableSpace());
-        heartbeat.set_current_load(storage->getCurrentLoad());
-        
-        // Add all stored chunk IDs
-        auto chunk_ids = storage->getStoredChunkIds();
-        for (const auto& chunk_id : chunk_ids) {
-            heartbeat.add_stored_chunk_ids(chunk_id);
-        }
-        
         HeartbeatResponse response;
-        grpc::ClientContext context;
-        
-        // Set deadline for heartbeat
-        auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(5);
-        context.set_deadline(deadline);
-        
-        grpc::Status status = stub->Heartbeat(&context, heartbeat, &response);
+        grpc::Status status = reporter.send(stub.get(), &response);
         
         if (status.ok() && response.ok()) {
-            std::cout << "[HEARTBEAT] Sent successfully - " 
-                      << "Chunks: " << chunk_ids.size() 
+            std::cout << "[HEARTBEAT] Sent successfully - "
+                      << (reporter.lastReportWasFull() ? "Full report: " : "Changed chunks: ")
+                      << reporter.lastReportSize()
                       << ", Available: " << storage->getAvailableSpace() / (1024*1024) << " MB"
                       << ", Load: " << storage->getCurrentLoad() << "\n";
             
             // Handle cleanup requests from MetaServer
             if (response.chunks_to_delete_size() > 0) {
-                for (const auto& chunk_id : response.chunks_to_delete()) {
-                    storage->deleteChunk(chunk_id);
-                    std::cout << "[INFO] Deleted chunk as requested by MetaServer: " 
-                              << chunk_id << "\n";
+                int deleted = 0;
+                for (ChunkId chunk_id : response.chunks_to_delete()) {
+                    deleted += storage->deleteChunk(chunk_id) ? 1 : 0;
                 }
+                std::cout << "[INFO] Deleted " << deleted << " of " << response.chunks_to_delete_size()
+                          << " chunks as requested by MetaServer\n";
+            }
+            
+            // Copies run in the background so the next heartbeat isn't held up
+            for (const auto& copy : response.chunks_to_copy()) {
+                replicator->submit(copy);
             }
         } else {
             std::cerr << "[WARNING] Heartbeat failed: " << status.error_message() << "\n";
@@ -168,8 +117,9 @@ void runDataNode(const std::string& datanode_addr,
     std::cout << "[INFO] Storage capacity: " << storage_capacity / (1024*1024*1024) << " GB\n";
     std::cout << "[INFO] MetaServer address: " << metaserver_addr << "\n";
     
-    // Start heartbeat thread
-    std::thread heartbeat(heartbeatThread, metaserver_addr, datanode_addr, &storage);
+    // Start heartbeat thread, which hands re-replication orders to the replicator
+    ChunkReplicator replicator(&storage);
+    std::thread heartbeat(heartbeatThread, metaserver_addr, datanode_addr, &storage, &replicator);
     
     // Handle shutdown signal
     signal(SIGINT, [](int) { 
@@ -0,0 +1,125 @@
+#include "replicator.hpp"
+#include <iostream>
+
+constexpr size_t COPY_FRAME_SIZE = 64 * 1024;  // Bytes per frame sent to the target
+
+grpc::Status sendChunk(DataNodeStorage* storage, DataNodeService::Stub* stub, ChunkId chunk_id) {
+    if (!storage->hasChunk(chunk_id)) {
+        return grpc::Status(grpc::StatusCode::NOT_FOUND, "Chunk not found");
+    }
+    std::string checksum = storage->getChunkChecksum(chunk_id);
+
+    grpc::ClientContext context;
+    ::Ack ack;
+    auto writer = stub->StoreChunkStream(&context, &ack);
+
+    storage->incrementLoad();
+    bool first = true;
+    bool receiver_gone = false;
+    bool success = storage->readChunkStream(chunk_id, 0, 0, COPY_FRAME_SIZE, [&](const char* data, size_t size) {
+        ::ChunkData frame;
+        if (first) {
+            frame.set_chunk_id(chunk_id);
+            frame.set_checksum(checksum);
+            first = false;
+        }
+        frame.set_data(data, size);
+        if (!writer->Write(frame)) {
+            receiver_gone = true;
+            return false;
+        }
+        return true;
+    });
+    storage->decrementLoad();
+
+    if (success && first) {
+        // Nothing read, so the chunk is empty; the receiver still needs its id
+        ::ChunkData frame;
+        frame.set_chunk_id(chunk_id);
+        frame.set_checksum(checksum);
+        writer->Write(frame);
+    } else if (!success && !receiver_gone) {
+        // A chunk that fails verification here must not land elsewhere
+        context.TryCancel();
+    }
+    writer->WritesDone();
+    grpc::Status status = writer->Finish();
+
+    if (!success && !receiver_gone) {
+        return grpc::Status(grpc::StatusCode::DATA_LOSS, "Local copy failed to read");
+    }
+    if (!status.ok()) {
+        return status;
+    }
+    if (!ack.ok()) {
+        return grpc::Status(grpc::StatusCode::ABORTED, ack.message());
+    }
+    return grpc::Status::OK;
+}
+
+ChunkReplicator::ChunkReplicator(DataNodeStorage* storage) : storage(storage) {
+    for (int i = 0; i < REPLICATION_WORKERS; ++i) {
+        workers.emplace_back(&ChunkReplicator::run, this);
+    }
+}
+
+ChunkReplicator::~ChunkReplicator() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_ready.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ChunkReplicator::submit(const ::ChunkCopy& copy) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(copy);
+    }
+    queue_ready.notify_one();
+}
+
+void ChunkReplicator::run() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true) {
+        queue_ready.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping) {
+            return;
+        }
+        ::ChunkCopy copy = std::move(queue.front());
+        queue.pop_front();
+
+        lock.unlock();
+        copyChunk(copy);
+        lock.lock();
+    }
+}
+
+bool ChunkReplicator::copyChunk(const ::ChunkCopy& copy) {
+    std::shared_ptr<DataNodeService::Stub> stub;
+    {
+        std::lock_guard<std::mutex> lock(stubs_mutex);
+        auto& cached = stubs[copy.target_address()];
+        if (!cached) {
+            cached = DataNodeService::NewStub(grpc::CreateChannel(copy.target_address(), grpc::InsecureChannelCredentials()));
+        }
+        stub = cached;
+    }
+
+    grpc::Status status = sendChunk(storage, stub.get(), copy.chunk_id());
+    if (status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+        std::lock_guard<std::mutex> lock(stubs_mutex);
+        stubs.erase(copy.target_address());
+    }
+    if (!status.ok()) {
+        std::cerr << "[ERROR] Failed to replicate chunk " << copy.chunk_id() << " to "
+                  << copy.target_address() << ": " << status.error_message() << "\n";
+        return false;
+    }
+
+    std::cout << "[INFO] Replicated chunk " << copy.chunk_id() << " to " << copy.target_address() << "\n";
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <grpcpp/grpcpp.h>
+#include "dfs.grpc.pb.h"
+#include "storage.hpp"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Copies this node runs at once. The MetaServer's MAX_REPLICATION_STREAMS
+// caps the copies it has in flight per source at the same number, so every
+// copy it counts as under way is actually being sent.
+constexpr int REPLICATION_WORKERS = 2;
+
+// Streams a stored chunk into another DataNode's StoreChunkStream. The first
+// frame carries the checksum recorded when the chunk was stored here, and the
+// receiver keeps its copy only if the bytes it got hash to it. OK once the
+// receiver has committed the copy.
+grpc::Status sendChunk(DataNodeStorage* storage, DataNodeService::Stub* stub, ChunkId chunk_id);
+
+// Carries out the MetaServer's re-replication orders. Copies run on
+// REPLICATION_WORKERS background threads, each streamed from disk into the
+// target's StoreChunkStream, so recovery takes at most that many streams of
+// this node's bandwidth and never holds up heartbeats.
+class ChunkReplicator {
+private:
+    DataNodeStorage* storage;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    std::deque<::ChunkCopy> queue;
+    bool stopping = false;
+
+    // Connections to copy targets, shared by the workers
+    std::mutex stubs_mutex;
+    std::unordered_map<std::string, std::shared_ptr<DataNodeService::Stub>> stubs;
+
+    std::vector<std::thread> workers;
+
+    void run();
+    bool copyChunk(const ::ChunkCopy& copy);
+
+public:
+    explicit ChunkReplicator(DataNodeStorage* storage);
+    ChunkReplicator(const ChunkReplicator&) = delete;
+    ChunkReplicator& operator=(const ChunkReplicator&) = delete;
+    ~ChunkReplicator();  // Drops copies not yet started
+
+    void submit(const ::ChunkCopy& copy);
+};
@@ -0,0 +1,268 @@
+#include "service.hpp"
+#include "replicator.hpp"
+
+using grpc::ServerContext;
+using grpc::Status;
+
+constexpr size_t STREAM_FRAME_SIZE = 64 * 1024;  // Bytes per ReadChunkStream frame
+
+DataNodeServiceImpl::DataNodeServiceImpl(DataNodeStorage* storage) : storage(storage) {}
+
+Status DataNodeServiceImpl::StoreChunk(ServerContext* context, const ::ChunkData* request, ::Ack* response) {
+    storage->incrementLoad();
+
+    // Convert protobuf bytes to vector
+    std::vector<char> data(request->data().begin(), request->data().end());
+
+    bool success = storage->storeChunk(request->chunk_id(), data);
+
+    response->set_ok(success);
+    if (success) {
+        response->set_message("Chunk stored successfully");
+    } else {
+        response->set_message("Failed to store chunk");
+    }
+
+    storage->decrementLoad();
+    return Status::OK;
+}
+
+Status DataNodeServiceImpl::ReadChunk(ServerContext* context, const ::ChunkRequest* request, ::ChunkData* response) {
+    if (request->offset() < 0 || request->length() < 0) {
+        return Status(grpc::StatusCode::INVALID_ARGUMENT, "Negative offset or length");
+    }
+
+    storage->incrementLoad();
+
+    std::vector<char> data;
+    bool success;
+    if (request->offset() == 0 && request->length() == 0) {
+        data = storage->readChunk(request->chunk_id());
+        success = !data.empty();
+    } else {
+        success = storage->readChunkRange(request->chunk_id(), request->offset(), request->length(), data);
+    }
+
+    storage->decrementLoad();
+
+    if (!success) {
+        if (storage->hasChunk(request->chunk_id()) && request->offset() > 0) {
+            return Status(grpc::StatusCode::OUT_OF_RANGE, "Offset past end of chunk");
+        }
+        return Status(grpc::StatusCode::NOT_FOUND, "Chunk not found");
+    }
+
+    response->set_chunk_id(request->chunk_id());
+    response->set_data(data.data(), data.size());
+    return Status::OK;
+}
+
+std::shared_ptr<DataNodeService::Stub> DataNodeServiceImpl::downstreamStub(const std::string& address) {
+    std::lock_guard<std::mutex> lock(downstream_mutex);
+    auto& stub = downstream_stubs[address];
+    if (!stub) {
+        stub = DataNodeService::NewStub(grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+    }
+    return stub;
+}
+
+void DataNodeServiceImpl::dropDownstreamStub(const std::string& address) {
+    std::lock_guard<std::mutex> lock(downstream_mutex);
+    downstream_stubs.erase(address);
+}
+
+// Longest a downstream write may take when the upstream call sets no deadline
+constexpr auto PIPELINE_TIMEOUT = std::chrono::minutes(5);
+
+// The next hop of a write pipeline: frames go out as they come in, and its
+// acknowledgement speaks for every node after it. The downstream call
+// inherits the upstream one's deadline and cancellation, so a node that
+// stops responding fails the write instead of pinning every handler above it.
+class PipelineForwarder {
+private:
+    std::shared_ptr<DataNodeService::Stub> stub;
+    std::unique_ptr<grpc::ClientContext> context;
+    ::Ack ack;
+    std::unique_ptr<grpc::ClientWriter<::ChunkData>> writer;
+    bool broken = false;
+
+public:
+    PipelineForwarder(std::shared_ptr<DataNodeService::Stub> aStub, const ServerContext& upstream)
+        : stub(std::move(aStub)), context(grpc::ClientContext::FromServerContext(upstream)) {
+        auto deadline = std::chrono::system_clock::now() + PIPELINE_TIMEOUT;
+        if (upstream.deadline() > deadline) {
+            context->set_deadline(deadline);
+        }
+        writer = stub->StoreChunkStream(context.get(), &ack);
+    }
+
+    void forward(const ::ChunkData& frame) {
+        if (!broken && !writer->Write(frame)) {
+            broken = true;  // Stream gone; finish() reports why
+        }
+    }
+
+    void cancel() {
+        context->TryCancel();
+    }
+
+    grpc::Status finish(std::string& error) {
+        writer->WritesDone();
+        grpc::Status status = writer->Finish();
+        if (!status.ok()) {
+            error = status.error_message();
+        } else if (!ack.ok()) {
+            error = ack.message();
+        }
+        return status;
+    }
+
+    bool ok() const {
+        return ack.ok();
+    }
+};
+
+Status DataNodeServiceImpl::StoreChunkStream(ServerContext* context, grpc::ServerReader<::ChunkData>* reader,
+                                             ::Ack* response) {
+    ::ChunkData frame;
+    if (!reader->Read(&frame) || frame.chunk_id() == NO_CHUNK) {
+        return Status(grpc::StatusCode::INVALID_ARGUMENT, "First frame must name the chunk");
+    }
+
+    storage->incrementLoad();
+
+    ChunkId chunk_id = frame.chunk_id();
+    std::string expected_checksum = frame.checksum();
+    auto chunk_writer = storage->openChunkWriter(chunk_id);
+
+    // Pass the chunk on to the next DataNode, telling it who follows
+    std::string next_address;
+    std::unique_ptr<PipelineForwarder> forwarder;
+    if (frame.downstream_addresses_size() > 0) {
+        next_address = frame.downstream_addresses(0);
+        forwarder = std::make_unique<PipelineForwarder>(downstreamStub(next_address), *context);
+
+        ::ChunkData first;
+        first.set_chunk_id(chunk_id);
+        first.set_data(frame.data());
+        first.set_checksum(frame.checksum());
+        for (int i = 1; i < frame.downstream_addresses_size(); ++i) {
+            first.add_downstream_addresses(frame.downstream_addresses(i));
+        }
+        forwarder->forward(first);
+    }
+
+    bool success = true;
+    bool first_frame = true;
+    do {
+        if (frame.chunk_id() != NO_CHUNK && frame.chunk_id() != chunk_id) {
+            success = false;
+            break;
+        }
+        // Relay before writing so the next node's disk works in parallel with ours
+        if (forwarder && !first_frame) {
+            forwarder->forward(frame);
+        }
+        first_frame = false;
+        if (!chunk_writer->append(frame.data().data(), frame.data().size())) {
+            success = false;
+            break;
+        }
+    } while (reader->Read(&frame));
+
+    // A cancelled upload must not leave a truncated chunk behind, here or downstream
+    success = success && !context->IsCancelled();
+    if (forwarder && !success) {
+        forwarder->cancel();
+    }
+    success = success && chunk_writer->commit(expected_checksum);
+
+    std::string downstream_error;
+    if (forwarder) {
+        grpc::Status downstream_status = forwarder->finish(downstream_error);
+        if (downstream_status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+            dropDownstreamStub(next_address);
+        }
+        if (success && (!downstream_status.ok() || !forwarder->ok())) {
+            success = false;
+            response->set_message("Pipeline failed at " + next_address + ": " + downstream_error);
+        }
+    }
+
+    response->set_ok(success);
+    if (success) {
+        response->set_message("Chunk stored successfully");
+    } else if (response->message().empty()) {
+        response->set_message("Failed to store chunk");
+    }
+
+    storage->decrementLoad();
+    return Status::OK;
+}
+
+Status DataNodeServiceImpl::ReadChunkStream(ServerContext* context, const ::ChunkRequest* request,
+                                            grpc::ServerWriter<::ChunkData>* writer) {
+    if (request->offset() < 0 || request->length() < 0) {
+        return Status(grpc::StatusCode::INVALID_ARGUMENT, "Negative offset or length");
+    }
+
+    if (!storage->hasChunk(request->chunk_id())) {
+        return Status(grpc::StatusCode::NOT_FOUND, "Chunk not found");
+    }
+
+    storage->incrementLoad();
+
+    bool first = true;
+    bool client_gone = false;
+    bool success = storage->readChunkStream(request->chunk_id(), request->offset(), request->length(),
+                                            STREAM_FRAME_SIZE, [&](const char* data, size_t size) {
+        ::ChunkData frame;
+        if (first) {
+            frame.set_chunk_id(request->chunk_id());
+            first = false;
+        }
+        frame.set_data(data, size);
+        if (!writer->Write(frame)) {
+            client_gone = true;
+            return false;
+        }
+        return true;
+    });
+
+    storage->decrementLoad();
+
+    if (client_gone) {
+        return Status(grpc::StatusCode::CANCELLED, "Client stopped reading");
+    }
+    if (!success) {
+        // Frames already sent are unusable once the chunk fails verification
+        if (first && request->offset() > 0) {
+            return Status(grpc::StatusCode::OUT_OF_RANGE, "Offset past end of chunk");
+        }
+        return Status(grpc::StatusCode::DATA_LOSS, "Failed to read chunk");
+    }
+    return Status::OK;
+}
+
+Status DataNodeServiceImpl::ReplicateChunk(ServerContext* context, const ::ChunkCopy* request, ::Ack* response) {
+    if (request->target_address().empty()) {
+        return Status(grpc::StatusCode::INVALID_ARGUMENT, "No target DataNode");
+    }
+    if (!storage->hasChunk(request->chunk_id())) {
+        return Status(grpc::StatusCode::NOT_FOUND, "Chunk not found");
+    }
+
+    Status status = sendChunk(storage, downstreamStub(request->target_address()).get(), request->chunk_id());
+    if (status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+        dropDownstreamStub(request->target_address());
+    }
+
+    response->set_ok(status.ok());
+    if (status.ok()) {
+        response->set_message("Chunk replicated to " + request->target_address());
+    } else {
+        response->set_message("Failed to replicate chunk to " + request->target_address() + ": " +
+                              status.error_message());
+    }
+    return Status::OK;
+}
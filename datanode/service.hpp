@@ -0,0 +1,43 @@
+#pragma once
+
+#include <grpcpp/grpcpp.h>
+#include "dfs.grpc.pb.h"
+#include "storage.hpp"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// gRPC front end for a DataNode's chunk storage
+class DataNodeServiceImpl final : public DataNodeService::Service {
+private:
+    DataNodeStorage* storage;
+
+    // Connections to the DataNodes this one relays pipelined writes to
+    std::mutex downstream_mutex;
+    std::unordered_map<std::string, std::shared_ptr<DataNodeService::Stub>> downstream_stubs;
+
+    std::shared_ptr<DataNodeService::Stub> downstreamStub(const std::string& address);
+    void dropDownstreamStub(const std::string& address);
+
+public:
+    explicit DataNodeServiceImpl(DataNodeStorage* storage);
+
+    grpc::Status StoreChunk(grpc::ServerContext* context, const ::ChunkData* request, ::Ack* response) override;
+
+    // Reads the whole chunk, or only [offset, offset + length) when a range is given
+    grpc::Status ReadChunk(grpc::ServerContext* context, const ::ChunkRequest* request, ::ChunkData* response) override;
+
+    // Writes frames to disk as they arrive, relaying them down the pipeline if
+    // the first frame names one; the chunk is committed once the client
+    // finishes, and only if it matches the checksum the first frame gives
+    grpc::Status StoreChunkStream(grpc::ServerContext* context, grpc::ServerReader<::ChunkData>* reader,
+                                  ::Ack* response) override;
+
+    // Sends the chunk (or requested range) in frames as it is read from disk
+    grpc::Status ReadChunkStream(grpc::ServerContext* context, const ::ChunkRequest* request,
+                                 grpc::ServerWriter<::ChunkData>* writer) override;
+
+    // Sends a stored chunk straight to another DataNode and waits for it to commit
+    grpc::Status ReplicateChunk(grpc::ServerContext* context, const ::ChunkCopy* request, ::Ack* response) override;
+};
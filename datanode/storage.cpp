@@ -1,14 +1,108 @@
 #include "storage.hpp"
 #include <fstream>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <chrono>
 #include <unordered_set>
 #include <openssl/sha.h>
+#include <openssl/evp.h>
 
 namespace fs = std::filesystem;
 
+static std::string toHex(const unsigned char* digest, size_t size) {
+    std::stringstream ss;
+    for (size_t i = 0; i < size; ++i) {
+        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(digest[i]);
+    }
+    return ss.str();
+}
+
+ChunkWriter::ChunkWriter(DataNodeStorage* storage, ChunkId chunk_id, const std::string& chunk_path)
+    : storage(storage), chunk_id(chunk_id), chunk_path(chunk_path), digest(EVP_MD_CTX_new()) {
+    // Unique per writer so concurrent stores of one chunk don't share a temp file
+    static std::atomic<uint64_t> next_writer{0};
+    temp_path = chunk_path + ".tmp" + std::to_string(next_writer++);
+    
+    file.open(temp_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open() || !digest || EVP_DigestInit_ex(digest, EVP_sha256(), nullptr) != 1) {
+        std::cerr << "[ERROR] Failed to open file for writing: " << temp_path << "\n";
+        failed = true;
+    }
+}
+
+ChunkWriter::~ChunkWriter() {
+    if (!committed) {
+        file.close();
+        std::error_code ec;
+        fs::remove(temp_path, ec);
+    }
+    EVP_MD_CTX_free(digest);
+}
+
+bool ChunkWriter::append(const char* data, size_t size) {
+    if (failed) {
+        return false;
+    }
+    
+    // Check capacity
+    if (storage->used_space.load() + static_cast<int64_t>(written + size) > storage->total_capacity.load()) {
+        std::cerr << "[ERROR] Insufficient storage space for chunk " << chunk_id << "\n";
+        failed = true;
+        return false;
+    }
+    
+    file.write(data, size);
+    if (!file.good() || EVP_DigestUpdate(digest, data, size) != 1) {
+        std::cerr << "[ERROR] Failed to write chunk " << chunk_id << "\n";
+        failed = true;
+        return false;
+    }
+    
+    written += size;
+    return true;
+}
+
+bool ChunkWriter::commit(const std::string& expected_checksum) {
+    if (failed || committed) {
+        return false;
+    }
+    
+    file.flush();
+    bool write_ok = file.good();
+    file.close();
+    
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hash_len = 0;
+    if (!write_ok || EVP_DigestFinal_ex(digest, hash, &hash_len) != 1) {
+        std::cerr << "[ERROR] Failed to write chunk " << chunk_id << "\n";
+        failed = true;
+        return false;
+    }
+    
+    std::string checksum = toHex(hash, hash_len);
+    if (!expected_checksum.empty() && checksum != expected_checksum) {
+        std::cerr << "[ERROR] Chunk " << chunk_id << " arrived with checksum " << checksum.substr(0, 8)
+                  << "..., expected " << expected_checksum.substr(0, 8) << "...\n";
+        failed = true;
+        return false;
+    }
+    
+    // Publish the finished chunk in one step
+    std::error_code ec;
+    fs::rename(temp_path, chunk_path, ec);
+    if (ec) {
+        std::cerr << "[ERROR] Failed to finalize chunk " << chunk_id << ": " << ec.message() << "\n";
+        failed = true;
+        return false;
+    }
+    committed = true;
+    
+    storage->recordChunk(chunk_id, written, checksum);
+    return true;
+}
+
 DataNodeStorage::DataNodeStorage(const std::string& storage_path, int64_t capacity_bytes) 
     : storage_path(storage_path), total_capacity(capacity_bytes), used_space(0), current_load(0) {
     
@@ -29,7 +123,7 @@ void DataNodeStorage::ensureStorageDirectory() {
     fs::create_directories(storage_path);
     
     // Create subdirectories for better file organization
-    // Using two-level hierarchy based on first 4 chars of chunk_id
+    // Using two-level hierarchy based on the low byte of chunk_id
     for (int i = 0; i < 256; ++i) {
         std::stringstream ss;
         ss << std::hex << std::setfill('0') << std::setw(2) << i;
@@ -41,8 +135,19 @@ void DataNodeStorage::loadExistingChunks() {
     std::lock_guard<std::mutex> lock(metadata_mutex);
     
     for (const auto& dir_entry : fs::recursive_directory_iterator(storage_path)) {
+        // Leftovers of writes interrupted by a crash never became chunks
+        if (dir_entry.is_regular_file() && dir_entry.path().extension().string().rfind(".tmp", 0) == 0) {
+            std::error_code ec;
+            fs::remove(dir_entry.path(), ec);
+            continue;
+        }
+        
         if (dir_entry.is_regular_file() && dir_entry.path().extension() == ".chunk") {
-            std::string chunk_id = dir_entry.path().stem().string();
+            ChunkId chunk_id;
+            if (!parseChunkId(dir_entry.path().stem().string(), chunk_id)) {
+                std::cerr << "[WARNING] Ignoring chunk file with a malformed id: " << dir_entry.path() << "\n";
+                continue;
+            }
             
             ChunkMetadata metadata;
             metadata.chunk_id = chunk_id;
@@ -66,29 +171,22 @@ void DataNodeStorage::loadExistingChunks() {
     }
 }
 
-std::string DataNodeStorage::getChunkPath(const std::string& chunk_id) const {
-    // Use first 2 hex chars for directory (distributes across 256 dirs)
-    std::string subdir = chunk_id.substr(0, std::min(size_t(2), chunk_id.length()));
-    if (subdir.length() < 2) {
-        subdir = "00";  // Default for short IDs
-    }
+std::string DataNodeStorage::getChunkPath(ChunkId chunk_id) const {
+    // Ids are handed out in sequence, so the low byte spreads them evenly across the 256 dirs
+    std::stringstream subdir;
+    subdir << std::hex << std::setfill('0') << std::setw(2) << (chunk_id & 0xff);
     
-    fs::path chunk_path = fs::path(storage_path) / subdir / (chunk_id + ".chunk");
+    fs::path chunk_path = fs::path(storage_path) / subdir.str() / (formatChunkId(chunk_id) + ".chunk");
     return chunk_path.string();
 }
 
 std::string DataNodeStorage::calculateChecksum(const std::vector<char>& data) const {
     unsigned char hash[SHA256_DIGEST_LENGTH];
     SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.size(), hash);
-    
-    std::stringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
-    }
-    return ss.str();
+    return toHex(hash, SHA256_DIGEST_LENGTH);
 }
 
-bool DataNodeStorage::verifyChecksum(const std::string& chunk_id, const std::vector<char>& data) const {
+bool DataNodeStorage::verifyChecksum(ChunkId chunk_id, const std::vector<char>& data) const {
     std::lock_guard<std::mutex> lock(metadata_mutex);
     
     auto it = chunk_metadata.find(chunk_id);
@@ -100,48 +198,28 @@ bool DataNodeStorage::verifyChecksum(const std::string& chunk_id, const std::vec
     return calculated == it->second.checksum;
 }
 
-bool DataNodeStorage::storeChunk(const std::string& chunk_id, const std::vector<char>& data) {
-    // Check capacity
-    if (used_space.load() + static_cast<int64_t>(data.size()) > total_capacity.load()) {
-        std::cerr << "[ERROR] Insufficient storage space for chunk " << chunk_id << "\n";
-        return false;
-    }
-    
+bool DataNodeStorage::storeChunk(ChunkId chunk_id, const std::vector<char>& data) {
+    auto writer = openChunkWriter(chunk_id);
+    return writer->append(data.data(), data.size()) && writer->commit();
+}
+
+std::unique_ptr<ChunkWriter> DataNodeStorage::openChunkWriter(ChunkId chunk_id) {
     std::string chunk_path = getChunkPath(chunk_id);
-    fs::path parent_dir = fs::path(chunk_path).parent_path();
     
     // Ensure parent directory exists
-    fs::create_directories(parent_dir);
-    
-    // Write chunk data
-    std::ofstream file(chunk_path, std::ios::binary | std::ios::trunc);
-    if (!file.is_open()) {
-        std::cerr << "[ERROR] Failed to open file for writing: " << chunk_path << "\n";
-        return false;
-    }
-    
-    file.write(data.data(), data.size());
-    file.flush();
-    
-    if (!file.good()) {
-        std::cerr << "[ERROR] Failed to write chunk " << chunk_id << "\n";
-        file.close();
-        fs::remove(chunk_path);
-        return false;
-    }
-    
-    file.close();
-    
-    // Calculate and store checksum
-    std::string checksum = calculateChecksum(data);
+    fs::create_directories(fs::path(chunk_path).parent_path());
     
+    return std::unique_ptr<ChunkWriter>(new ChunkWriter(this, chunk_id, chunk_path));
+}
+
+void DataNodeStorage::recordChunk(ChunkId chunk_id, size_t size, const std::string& checksum) {
     // Write metadata file
-    std::string meta_path = chunk_path;
+    std::string meta_path = getChunkPath(chunk_id);
     meta_path.replace(meta_path.find(".chunk"), 6, ".meta");
     std::ofstream meta_file(meta_path);
     if (meta_file.is_open()) {
         meta_file << checksum << "\n";
-        meta_file << data.size() << "\n";
+        meta_file << size << "\n";
         meta_file.close();
     }
     
@@ -150,7 +228,7 @@ bool DataNodeStorage::storeChunk(const std::string& chunk_id, const std::vector<
         std::lock_guard<std::mutex> lock(metadata_mutex);
         ChunkMetadata metadata;
         metadata.chunk_id = chunk_id;
-        metadata.size = data.size();
+        metadata.size = size;
         metadata.checksum = checksum;
         metadata.created_at = std::chrono::system_clock::now();
         metadata.last_accessed = metadata.created_at;
@@ -163,15 +241,14 @@ bool DataNodeStorage::storeChunk(const std::string& chunk_id, const std::vector<
         
         chunk_metadata[chunk_id] = metadata;
         used_space += metadata.size;
+        unreported_changes[chunk_id] = true;
     }
     
     std::cout << "[INFO] Stored chunk " << chunk_id 
-              << " (" << data.size() << " bytes, checksum: " << checksum.substr(0, 8) << "...)\n";
-    
-    return true;
+              << " (" << size << " bytes, checksum: " << checksum.substr(0, 8) << "...)\n";
 }
 
-std::vector<char> DataNodeStorage::readChunk(const std::string& chunk_id) {
+std::vector<char> DataNodeStorage::readChunk(ChunkId chunk_id) {
     std::string chunk_path = getChunkPath(chunk_id);
     
     if (!fs::exists(chunk_path)) {
@@ -212,7 +289,96 @@ std::vector<char> DataNodeStorage::readChunk(const std::string& chunk_id) {
     return data;
 }
 
-bool DataNodeStorage::deleteChunk(const std::string& chunk_id) {
+bool DataNodeStorage::readChunkRange(ChunkId chunk_id, int64_t offset, int64_t length, std::vector<char>& out) {
+    out.clear();
+    bool ok = readChunkStream(chunk_id, offset, length, 1024 * 1024, [&out](const char* data, size_t size) {
+        out.insert(out.end(), data, data + size);
+        return true;
+    });
+    if (!ok) {
+        out.clear();
+    }
+    return ok;
+}
+
+bool DataNodeStorage::readChunkStream(ChunkId chunk_id, int64_t offset, int64_t length, size_t frame_size,
+                                      const std::function<bool(const char* data, size_t size)>& sink) {
+    std::string chunk_path = getChunkPath(chunk_id);
+    
+    std::ifstream file(chunk_path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "[ERROR] Chunk not found: " << chunk_id << "\n";
+        return false;
+    }
+    
+    int64_t size = file.tellg();
+    // Offset 0 of an empty chunk is its (empty) whole
+    bool past_end = offset >= size && !(offset == 0 && size == 0);
+    if (offset < 0 || length < 0 || past_end || frame_size == 0) {
+        std::cerr << "[ERROR] Range offset " << offset << " out of bounds for chunk " << chunk_id
+                  << " (" << size << " bytes)\n";
+        return false;
+    }
+    
+    int64_t to_read = (length == 0 || length > size - offset) ? size - offset : length;
+    
+    // The stored checksum covers the whole chunk, so partial reads can't be verified
+    std::string expected_checksum;
+    if (to_read == size) {
+        std::lock_guard<std::mutex> lock(metadata_mutex);
+        auto it = chunk_metadata.find(chunk_id);
+        if (it != chunk_metadata.end()) {
+            expected_checksum = it->second.checksum;
+        }
+    }
+    
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> digest(EVP_MD_CTX_new(), &EVP_MD_CTX_free);
+    bool verify = !expected_checksum.empty() && digest &&
+                  EVP_DigestInit_ex(digest.get(), EVP_sha256(), nullptr) == 1;
+    
+    file.seekg(offset, std::ios::beg);
+    std::vector<char> frame(std::min<int64_t>(frame_size, to_read));
+    for (int64_t remaining = to_read; remaining > 0;) {
+        size_t n = std::min<int64_t>(frame.size(), remaining);
+        file.read(frame.data(), n);
+        if (static_cast<size_t>(file.gcount()) != n) {
+            std::cerr << "[ERROR] Short read of chunk " << chunk_id << "\n";
+            return false;
+        }
+        if (verify) {
+            EVP_DigestUpdate(digest.get(), frame.data(), n);
+        }
+        if (!sink(frame.data(), n)) {
+            return false;
+        }
+        remaining -= n;
+    }
+    
+    if (verify) {
+        unsigned char hash[EVP_MAX_MD_SIZE];
+        unsigned int hash_len = 0;
+        EVP_DigestFinal_ex(digest.get(), hash, &hash_len);
+        if (toHex(hash, hash_len) != expected_checksum) {
+            std::cerr << "[ERROR] Checksum verification failed for chunk " << chunk_id << "\n";
+            return false;
+        }
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(metadata_mutex);
+        auto it = chunk_metadata.find(chunk_id);
+        if (it != chunk_metadata.end()) {
+            it->second.last_accessed = std::chrono::system_clock::now();
+        }
+    }
+    
+    std::cout << "[INFO] Read " << to_read << " bytes at offset " << offset
+              << " of chunk " << chunk_id << "\n";
+    
+    return true;
+}
+
+bool DataNodeStorage::deleteChunk(ChunkId chunk_id) {
     std::string chunk_path = getChunkPath(chunk_id);
     std::string meta_path = chunk_path;
     meta_path.replace(meta_path.find(".chunk"), 6, ".meta");
@@ -226,6 +392,7 @@ bool DataNodeStorage::deleteChunk(const std::string& chunk_id) {
         if (it != chunk_metadata.end()) {
             used_space -= it->second.size;
             chunk_metadata.erase(it);
+            unreported_changes[chunk_id] = false;
         }
         
         std::cout << "[INFO] Deleted chunk " << chunk_id << "\n";
@@ -235,14 +402,20 @@ bool DataNodeStorage::deleteChunk(const std::string& chunk_id) {
     return false;
 }
 
-bool DataNodeStorage::hasChunk(const std::string& chunk_id) const {
+bool DataNodeStorage::hasChunk(ChunkId chunk_id) const {
     std::lock_guard<std::mutex> lock(metadata_mutex);
     return chunk_metadata.find(chunk_id) != chunk_metadata.end();
 }
 
-std::vector<std::string> DataNodeStorage::getStoredChunkIds() const {
+std::string DataNodeStorage::getChunkChecksum(ChunkId chunk_id) const {
     std::lock_guard<std::mutex> lock(metadata_mutex);
-    std::vector<std::string> chunk_ids;
+    auto it = chunk_metadata.find(chunk_id);
+    return it != chunk_metadata.end() ? it->second.checksum : std::string();
+}
+
+std::vector<ChunkId> DataNodeStorage::getStoredChunkIds() const {
+    std::lock_guard<std::mutex> lock(metadata_mutex);
+    std::vector<ChunkId> chunk_ids;
     chunk_ids.reserve(chunk_metadata.size());
     
     for (const auto& [chunk_id, _] : chunk_metadata) {
@@ -252,6 +425,41 @@ std::vector<std::string> DataNodeStorage::getStoredChunkIds() const {
     return chunk_ids;
 }
 
+ChunkReport DataNodeStorage::takeChunkChanges() {
+    std::lock_guard<std::mutex> lock(metadata_mutex);
+    ChunkReport report;
+    for (const auto& [chunk_id, stored] : unreported_changes) {
+        (stored ? report.added : report.removed).push_back(chunk_id);
+    }
+    unreported_changes.clear();
+    return report;
+}
+
+void DataNodeStorage::restoreChunkChanges(const ChunkReport& report) {
+    std::lock_guard<std::mutex> lock(metadata_mutex);
+    for (ChunkId chunk_id : report.added) {
+        unreported_changes.emplace(chunk_id, true);
+    }
+    for (ChunkId chunk_id : report.removed) {
+        unreported_changes.emplace(chunk_id, false);
+    }
+}
+
+std::vector<ChunkId> DataNodeStorage::takeFullChunkReport() {
+    std::lock_guard<std::mutex> lock(metadata_mutex);
+    std::vector<ChunkId> chunk_ids;
+    chunk_ids.reserve(chunk_metadata.size());
+    for (const auto& [chunk_id, _] : chunk_metadata) {
+        chunk_ids.push_back(chunk_id);
+    }
+    unreported_changes.clear();
+    return chunk_ids;
+}
+
+int64_t DataNodeStorage::getCapacity() const {
+    return total_capacity.load();
+}
+
 int64_t DataNodeStorage::getAvailableSpace() const {
     return total_capacity.load() - used_space.load();
 }
@@ -294,19 +502,21 @@ bool DataNodeStorage::performHealthCheck() {
     return true;
 }
 
-void DataNodeStorage::cleanupOrphanedChunks(const std::vector<std::string>& valid_chunks) {
-    std::lock_guard<std::mutex> lock(metadata_mutex);
-    
-    std::unordered_set<std::string> valid_set(valid_chunks.begin(), valid_chunks.end());
-    std::vector<std::string> to_delete;
+void DataNodeStorage::cleanupOrphanedChunks(const std::vector<ChunkId>& valid_chunks) {
+    std::unordered_set<ChunkId> valid_set(valid_chunks.begin(), valid_chunks.end());
+    std::vector<ChunkId> to_delete;
     
-    for (const auto& [chunk_id, _] : chunk_metadata) {
-        if (valid_set.find(chunk_id) == valid_set.end()) {
-            to_delete.push_back(chunk_id);
+    // deleteChunk takes the lock itself
+    {
+        std::lock_guard<std::mutex> lock(metadata_mutex);
+        for (const auto& [chunk_id, _] : chunk_metadata) {
+            if (valid_set.find(chunk_id) == valid_set.end()) {
+                to_delete.push_back(chunk_id);
+            }
         }
     }
     
-    for (const auto& chunk_id : to_delete) {
+    for (ChunkId chunk_id : to_delete) {
         deleteChunk(chunk_id);
         std::cout << "[INFO] Cleaned up orphaned chunk: " << chunk_id << "\n";
     }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "chunk_id.hpp"
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -7,17 +8,63 @@
 #include <filesystem>
 #include <atomic>
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <fstream>
+
+struct evp_md_ctx_st;
 
 struct ChunkMetadata {
-    std::string chunk_id;
+    ChunkId chunk_id;
     size_t size;
     std::string checksum;
     std::chrono::system_clock::time_point created_at;
     std::chrono::system_clock::time_point last_accessed;
 };
 
+// Chunks stored and deleted since the last report to the MetaServer
+struct ChunkReport {
+    std::vector<ChunkId> added;
+    std::vector<ChunkId> removed;
+};
+
+class DataNodeStorage;
+
+// Writes a chunk incrementally as its bytes arrive, hashing along the way.
+// The chunk only becomes visible on commit(); an uncommitted writer discards
+// its partial file when destroyed.
+class ChunkWriter {
+private:
+    friend class DataNodeStorage;
+    
+    DataNodeStorage* storage;
+    ChunkId chunk_id;
+    std::string chunk_path;
+    std::string temp_path;
+    std::ofstream file;
+    evp_md_ctx_st* digest;
+    size_t written = 0;
+    bool failed = false;
+    bool committed = false;
+    
+    ChunkWriter(DataNodeStorage* storage, ChunkId chunk_id, const std::string& chunk_path);
+    
+public:
+    ChunkWriter(const ChunkWriter&) = delete;
+    ChunkWriter& operator=(const ChunkWriter&) = delete;
+    ~ChunkWriter();
+    
+    bool append(const char* data, size_t size);
+    // Fails, keeping nothing, if expected_checksum is given and the bytes
+    // written don't hash to it
+    bool commit(const std::string& expected_checksum = "");
+    size_t size() const { return written; }
+};
+
 class DataNodeStorage {
 private:
+    friend class ChunkWriter;
+    
     std::string storage_path;
     std::atomic<int64_t> total_capacity;
     std::atomic<int64_t> used_space;
@@ -25,27 +72,52 @@ private:
     
     // Thread-safe chunk metadata tracking
     mutable std::mutex metadata_mutex;
-    std::unordered_map<std::string, ChunkMetadata> chunk_metadata;
+    std::unordered_map<ChunkId, ChunkMetadata> chunk_metadata;
+    std::unordered_map<ChunkId, bool> unreported_changes;  // chunk_id -> stored (true) or deleted since last report
     
     // Helper methods
-    std::string getChunkPath(const std::string& chunk_id) const;
+    std::string getChunkPath(ChunkId chunk_id) const;
     std::string calculateChecksum(const std::vector<char>& data) const;
-    bool verifyChecksum(const std::string& chunk_id, const std::vector<char>& data) const;
+    bool verifyChecksum(ChunkId chunk_id, const std::vector<char>& data) const;
     void ensureStorageDirectory();
     void loadExistingChunks();
+    void recordChunk(ChunkId chunk_id, size_t size, const std::string& checksum);
     
 public:
     explicit DataNodeStorage(const std::string& storage_path, int64_t capacity_bytes = 10L * 1024 * 1024 * 1024); // Default 10GB
     ~DataNodeStorage();
     
     // Chunk operations
-    bool storeChunk(const std::string& chunk_id, const std::vector<char>& data);
-    std::vector<char> readChunk(const std::string& chunk_id);
-    bool deleteChunk(const std::string& chunk_id);
-    bool hasChunk(const std::string& chunk_id) const;
+    bool storeChunk(ChunkId chunk_id, const std::vector<char>& data);
+    std::vector<char> readChunk(ChunkId chunk_id);
+    // Reads [offset, offset + length) of a chunk, clipped to its end; a length of 0
+    // means "to the end". Only a range covering the whole chunk is checksum-verified.
+    bool readChunkRange(ChunkId chunk_id, int64_t offset, int64_t length, std::vector<char>& out);
+    
+    // Streaming variants: the writer takes the chunk piece by piece, and
+    // readChunkStream hands the range to sink in pieces of at most frame_size
+    // bytes (sink returns false to stop). A whole-chunk stream is checksummed as
+    // it goes and fails after the last piece if the data doesn't match.
+    std::unique_ptr<ChunkWriter> openChunkWriter(ChunkId chunk_id);
+    bool readChunkStream(ChunkId chunk_id, int64_t offset, int64_t length, size_t frame_size,
+                         const std::function<bool(const char* data, size_t size)>& sink);
+    bool deleteChunk(ChunkId chunk_id);
+    bool hasChunk(ChunkId chunk_id) const;
+    // SHA-256 of the chunk as stored, in hex; empty if unknown
+    std::string getChunkChecksum(ChunkId chunk_id) const;
     
     // Status and metrics
-    std::vector<std::string> getStoredChunkIds() const;
+    std::vector<ChunkId> getStoredChunkIds() const;
+    
+    // Heartbeat reporting. takeChunkChanges drains what changed since the
+    // last report; restoreChunkChanges puts back a report that didn't get
+    // through (changes made since win). takeFullChunkReport lists every
+    // chunk and drops the pending changes, which it supersedes.
+    ChunkReport takeChunkChanges();
+    void restoreChunkChanges(const ChunkReport& report);
+    std::vector<ChunkId> takeFullChunkReport();
+    
+    int64_t getCapacity() const;
     int64_t getAvailableSpace() const;
     int64_t getUsedSpace() const;
     int32_t getCurrentLoad() const;
@@ -54,5 +126,5 @@ public:
     
     // Maintenance
     bool performHealthCheck();
-    void cleanupOrphanedChunks(const std::vector<std::string>& valid_chunks);
+    void cleanupOrphanedChunks(const std::vector<ChunkId>& valid_chunks);
 };
\ No newline at end of file
@@ -1,76 +1,232 @@
 #include "cache.hpp"
+#include <algorithm>
+#include <functional>
+#include <thread>
 
-Cache::Cache(size_t capacity) : capacity(capacity) {
+FrequencySketch::FrequencySketch(size_t capacity) {
+    // Four counters per row per cached entry keeps collisions from
+    // inflating the estimate of keys seen only once
+    size_t width = 16;
+    while (width < 4 * capacity) {
+        width <<= 1;
+    }
+    table.assign(width * DEPTH / 2, 0);
+    width_mask = width - 1;
+    sample_size = 10 * std::max<size_t>(capacity, 1);
+}
+
+size_t FrequencySketch::indexOf(uint64_t hash, int row) const {
+    return static_cast<size_t>(row) * (width_mask + 1) + (mixHash(hash + row * 0x9e3779b97f4a7c15ULL) & width_mask);
+}
+
+uint8_t FrequencySketch::counterAt(size_t index) const {
+    return (table[index / 2] >> ((index % 2) * 4)) & 0x0f;
+}
+
+void FrequencySketch::increment(uint64_t hash) {
+    bool added = false;
+    for (int row = 0; row < DEPTH; ++row) {
+        size_t index = indexOf(hash, row);
+        if (counterAt(index) < MAX_COUNT) {
+            table[index / 2] += static_cast<uint8_t>(1 << ((index % 2) * 4));
+            added = true;
+        }
+    }
+    
+    if (added && ++additions >= sample_size) {
+        age();
+    }
+}
+
+uint8_t FrequencySketch::estimate(uint64_t hash) const {
+    uint8_t count = MAX_COUNT;
+    for (int row = 0; row < DEPTH; ++row) {
+        count = std::min(count, counterAt(indexOf(hash, row)));
+    }
+    return count;
+}
+
+void FrequencySketch::age() {
+    // Halve both nibbles of every byte at once
+    for (auto& pair : table) {
+        pair = (pair >> 1) & 0x77;
+    }
+    additions /= 2;
+}
+
+Cache::Cache(size_t capacity, size_t shard_count, CachePolicy policy) : capacity(capacity), policy(policy) {
     if (capacity == 0) {
         this->capacity = 1; // Minimum capacity of 1
     }
+    
+    if (shard_count == 0) {
+        // A few shards per core keeps the odds of two readers colliding low
+        shard_count = std::max<size_t>(1, std::thread::hardware_concurrency()) * 4;
+    }
+    shard_count = std::clamp<size_t>(this->capacity / MIN_SHARD_CAPACITY, 1, shard_count);
+    
+    // Split the capacity so the shards never hold more than it in total
+    for (size_t i = 0; i < shard_count; ++i) {
+        auto shard = std::make_unique<Shard>();
+        size_t shard_capacity = this->capacity / shard_count + (i < this->capacity % shard_count ? 1 : 0);
+        
+        if (policy == CachePolicy::TinyLFU && shard_capacity > 1) {
+            shard->window_capacity = std::max<size_t>(1, shard_capacity / 100);
+            shard->main_capacity = shard_capacity - shard->window_capacity;
+            shard->sketch = std::make_unique<FrequencySketch>(shard_capacity);
+        } else {
+            shard->window_capacity = shard_capacity;
+        }
+        shards.push_back(std::move(shard));
+    }
+}
+
+uint64_t Cache::hashOf(ChunkId chunk_id) {
+    // Ids are sequential, so mix them before they pick a shard
+    return mixHash(chunk_id);
+}
+
+Cache::Shard& Cache::shardFor(uint64_t hash) const {
+    return *shards[hash % shards.size()];
 }
 
-void Cache::touch(CacheList::iterator it) {
-    // Move the accessed item to the front of the list
-    auto pair = *it;
-    cache_list.erase(it);
-    cache_list.push_front(pair);
-    cache_map[pair.first] = cache_list.begin();
+void Cache::touch(Shard& shard, const Slot& slot) {
+    // Move the accessed item to the front of its list
+    CacheList& list = shard.listOf(slot);
+    list.splice(list.begin(), list, slot.it);
 }
 
-void Cache::evict() {
-    // Remove the least recently used item (from the back)
-    if (!cache_list.empty()) {
-        auto last = cache_list.back();
-        cache_map.erase(last.first);
-        cache_list.pop_back();
+void Cache::evict(Shard& shard) {
+    if (shard.window_list.size() <= shard.window_capacity) {
+        return;
+    }
+    
+    // The window's least recently used item is the admission candidate
+    auto candidate = std::prev(shard.window_list.end());
+    
+    if (shard.main_capacity == 0) {
+        // Plain LRU: the window is the whole cache
+        shard.cache_map.erase(candidate->first);
+        shard.window_list.erase(candidate);
+        return;
+    }
+    
+    if (shard.main_list.size() < shard.main_capacity) {
+        shard.main_list.splice(shard.main_list.begin(), shard.window_list, candidate);
+        shard.cache_map[shard.main_list.front().first].in_window = false;
+        return;
+    }
+    
+    // Main is full: keep whichever of the candidate and the main victim has
+    // been accessed more often recently. Ties go to the incumbent, which is
+    // what stops a scan of never-repeated chunks from displacing anything.
+    auto victim = std::prev(shard.main_list.end());
+    if (shard.sketch->estimate(hashOf(candidate->first)) > shard.sketch->estimate(hashOf(victim->first))) {
+        shard.cache_map.erase(victim->first);
+        shard.main_list.erase(victim);
+        shard.main_list.splice(shard.main_list.begin(), shard.window_list, candidate);
+        shard.cache_map[shard.main_list.front().first].in_window = false;
+    } else {
+        shard.cache_map.erase(candidate->first);
+        shard.window_list.erase(candidate);
     }
 }
 
-void Cache::put(const std::string& chunk_id, const ChunkLocationInfo& location) {
-    std::lock_guard<std::mutex> lock(cache_mutex);
+void Cache::put(ChunkId chunk_id, const ChunkLocationInfo& location) {
+    // Build the entry before taking the lock
+    auto entry = std::make_shared<const ChunkLocationInfo>(location);
+    
+    Shard& shard = shardFor(hashOf(chunk_id));
+    std::lock_guard<std::mutex> lock(shard.cache_mutex);
     
     // Check if the chunk already exists in cache
-    auto it = cache_map.find(chunk_id);
-    if (it != cache_map.end()) {
+    auto it = shard.cache_map.find(chunk_id);
+    if (it != shard.cache_map.end()) {
         // Update existing entry and move to front
-        it->second->second = location;
-        touch(it->second);
+        it->second.it->second = std::move(entry);
+        touch(shard, it->second);
     } else {
         // Add new entry
-        if (cache_list.size() >= capacity) {
-            evict();
-        }
-        cache_list.push_front({chunk_id, location});
-        cache_map[chunk_id] = cache_list.begin();
+        shard.window_list.emplace_front(chunk_id, std::move(entry));
+        shard.cache_map.emplace(chunk_id, Slot{shard.window_list.begin(), true});
+        evict(shard);
     }
 }
 
-std::optional<ChunkLocationInfo> Cache::get(const std::string& chunk_id) {
-    std::lock_guard<std::mutex> lock(cache_mutex);
+std::shared_ptr<const ChunkLocationInfo> Cache::getShared(ChunkId chunk_id) {
+    uint64_t hash = hashOf(chunk_id);
+    Shard& shard = shardFor(hash);
+    std::lock_guard<std::mutex> lock(shard.cache_mutex);
     
-    auto it = cache_map.find(chunk_id);
-    if (it != cache_map.end()) {
+    // Misses count too: a chunk asked for often deserves admission once it's put
+    if (shard.sketch) {
+        shard.sketch->increment(hash);
+    }
+    
+    auto it = shard.cache_map.find(chunk_id);
+    if (it != shard.cache_map.end()) {
         // Found - move to front and return
-        touch(it->second);
-        return it->second->second;
+        touch(shard, it->second);
+        shard.stats.hits++;
+        return it->second.it->second;
+    }
+    shard.stats.misses++;
+    return nullptr;
+}
+
+std::optional<ChunkLocationInfo> Cache::get(ChunkId chunk_id) {
+    // Copy outside the shard lock
+    auto entry = getShared(chunk_id);
+    if (entry) {
+        return *entry;
     }
     return std::nullopt;
 }
 
-void Cache::remove(const std::string& chunk_id) {
-    std::lock_guard<std::mutex> lock(cache_mutex);
+void Cache::remove(ChunkId chunk_id) {
+    Shard& shard = shardFor(hashOf(chunk_id));
+    std::lock_guard<std::mutex> lock(shard.cache_mutex);
     
-    auto it = cache_map.find(chunk_id);
-    if (it != cache_map.end()) {
-        cache_list.erase(it->second);
-        cache_map.erase(it);
+    auto it = shard.cache_map.find(chunk_id);
+    if (it != shard.cache_map.end()) {
+        shard.listOf(it->second).erase(it->second.it);
+        shard.cache_map.erase(it);
     }
 }
 
 void Cache::clear() {
-    std::lock_guard<std::mutex> lock(cache_mutex);
-    cache_list.clear();
-    cache_map.clear();
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->cache_mutex);
+        shard->window_list.clear();
+        shard->main_list.clear();
+        shard->cache_map.clear();
+    }
 }
 
 size_t Cache::size() const {
-    std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(cache_mutex));
-    return cache_list.size();
-}
\ No newline at end of file
+    size_t total = 0;
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->cache_mutex);
+        total += shard->window_list.size() + shard->main_list.size();
+    }
+    return total;
+}
+
+size_t Cache::shardCount() const {
+    return shards.size();
+}
+
+CachePolicy Cache::getPolicy() const {
+    return policy;
+}
+
+CacheStats Cache::stats() const {
+    CacheStats total;
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->cache_mutex);
+        total.hits += shard->stats.hits;
+        total.misses += shard->stats.misses;
+    }
+    return total;
+}
+
@@ -1,51 +1,289 @@
 #pragma once 
 
+#include "chunk_id.hpp"
+#include "datanode_registry.hpp"
 #include <unordered_map>
 #include <list>
 #include <string>
 #include <vector>
 #include <mutex>
+#include <memory>
 #include <optional>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <cstdint>
 
 struct ChunkLocationInfo {
-    std::string chunk_id;
-    std::vector<std::string> datanode_addresses;
+    ChunkId chunk_id = NO_CHUNK;
+    std::vector<DataNodeId> datanode_ids;  // Live replicas; the Manager's registry has their addresses
+    int32_t chunk_index = 0;  // Position of the chunk within its file
 };
 
-class Cache {
+enum class CachePolicy {
+    LRU,      // Plain least-recently-used
+    TinyLFU   // W-TinyLFU: small LRU window, frequency-filtered admission to the main LRU
+};
+
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+// Count-min sketch of recent access frequencies (TinyLFU). Counters are
+// 4 bits, packed two per byte, and saturate at 15. All of them are halved
+// once the sketch has seen sample_size accesses, so old popularity fades and
+// the estimate tracks the recent workload.
+class FrequencySketch {
 private:
-    size_t capacity;
-    std::mutex cache_mutex;
+    static constexpr int DEPTH = 4;
+    static constexpr uint8_t MAX_COUNT = 15;
+    
+    std::vector<uint8_t> table;  // DEPTH rows of `width` 4-bit counters
+    size_t width_mask;
+    size_t sample_size;
+    size_t additions = 0;
+    
+    size_t indexOf(uint64_t hash, int row) const;
+    uint8_t counterAt(size_t index) const;
+    void age();
+
+public:
+    explicit FrequencySketch(size_t capacity);
     
+    void increment(uint64_t hash);
+    uint8_t estimate(uint64_t hash) const;
+};
+
+class Cache {
+private:
     // LRU cache implementation using list + unordered_map
     // List maintains the order (front = most recently used, back = least recently used)
-    using CacheList = std::list<std::pair<std::string, ChunkLocationInfo>>;
-    CacheList cache_list;
+    // Entries are immutable and shared, so hits can hand them out without copying
+    using LocationPtr = std::shared_ptr<const ChunkLocationInfo>;
+    using CacheList = std::list<std::pair<ChunkId, LocationPtr>>;
+    
+    struct Slot {
+        CacheList::iterator it;
+        bool in_window;
+    };
     
-    // Map for O(1) lookup: chunk_id -> iterator to list node
-    std::unordered_map<std::string, CacheList::iterator> cache_map;
+    // Chunk ids are hash-partitioned over independent shards, each with its
+    // own lock and LRU, so concurrent lookups of different chunks rarely
+    // contend. Recency is per shard: the entry evicted is the least recently
+    // used one of its shard, not necessarily of the whole cache.
+    //
+    // Every entry starts in the window. Under LRU the window is the whole
+    // shard. Under TinyLFU it is ~1% of it, and an entry pushed out of the
+    // window only enters the main LRU if the sketch says it's been used more
+    // often than the main LRU's victim, so one-off scans can't flush hot entries.
+    struct alignas(64) Shard {
+        std::mutex cache_mutex;
+        size_t window_capacity = 0;
+        size_t main_capacity = 0;
+        CacheList window_list;
+        CacheList main_list;
+        
+        // Map for O(1) lookup: chunk_id -> list node and which list holds it
+        std::unordered_map<ChunkId, Slot> cache_map;
+        
+        std::unique_ptr<FrequencySketch> sketch;  // TinyLFU only
+        CacheStats stats;
+        
+        CacheList& listOf(const Slot& slot) { return slot.in_window ? window_list : main_list; }
+    };
     
-    // Move an element to the front (mark as most recently used)
-    void touch(CacheList::iterator it);
+    size_t capacity;
+    CachePolicy policy;
+    std::vector<std::unique_ptr<Shard>> shards;
+    
+    static uint64_t hashOf(ChunkId chunk_id);
+    Shard& shardFor(uint64_t hash) const;
+    
+    // Move an element to the front (mark as most recently used) by relinking
+    // its node; no copies, no allocations, and map iterators stay valid
+    static void touch(Shard& shard, const Slot& slot);
     
-    // Evict the least recently used item
-    void evict();
+    // Bring the shard back within capacity after an insert
+    static void evict(Shard& shard);
 
 public:
-    explicit Cache(size_t capacity = 1000);
+    // Shards smaller than this give up too much LRU accuracy
+    static constexpr size_t MIN_SHARD_CAPACITY = 64;
+    
+    // shard_count 0 picks one from the hardware concurrency; either way small
+    // caches get fewer shards so each holds at least MIN_SHARD_CAPACITY entries
+    explicit Cache(size_t capacity = 1000, size_t shard_count = 0, CachePolicy policy = CachePolicy::LRU);
     
     // Insert or update a chunk location in the cache
-    void put(const std::string& chunk_id, const ChunkLocationInfo& location);
+    void put(ChunkId chunk_id, const ChunkLocationInfo& location);
     
     // Get chunk location from cache (returns nullopt if not found)
-    std::optional<ChunkLocationInfo> get(const std::string& chunk_id);
+    std::optional<ChunkLocationInfo> get(ChunkId chunk_id);
+    
+    // Like get(), but shares the cached entry instead of copying it (nullptr if not found)
+    std::shared_ptr<const ChunkLocationInfo> getShared(ChunkId chunk_id);
     
     // Remove a chunk from cache (e.g., when chunk is deleted)
-    void remove(const std::string& chunk_id);
+    void remove(ChunkId chunk_id);
     
     // Clear all entries
     void clear();
     
     // Get current size
     size_t size() const;
+    
+    size_t shardCount() const;
+    
+    CachePolicy getPolicy() const;
+    
+    // Lookups since construction, summed over shards
+    CacheStats stats() const;
+};
+
+// splitmix64 finalizer: spreads std::hash output over all 64 bits
+inline uint64_t mixHash(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Second tier in front of the chunk cache: whole answers, keyed by filename
+// and kept as the message the RPC layer sends, so a hot file is served with
+// one hash probe and a copy, without per-chunk work or parsing. The Manager
+// invalidates a file whenever its chunk list or one of its chunks' replica
+// sets changes. Plain LRU per shard. Entries are only moved around here, so
+// Answer may be an incomplete type wherever the answers aren't built.
+template <typename Answer>
+class FileAnswerCache {
+private:
+    using EntryPtr = std::shared_ptr<const Answer>;
+    using EntryList = std::list<std::pair<std::string, EntryPtr>>;
+    
+    struct alignas(64) Shard {
+        std::mutex cache_mutex;
+        size_t capacity = 0;
+        EntryList lru_list;
+        std::unordered_map<std::string, typename EntryList::iterator> cache_map;
+        uint64_t generation = 0;  // Bumped by every invalidation in this shard
+        CacheStats stats;
+    };
+    
+    std::vector<std::unique_ptr<Shard>> shards;
+    
+    Shard& shardFor(const std::string& filename) const {
+        return *shards[mixHash(std::hash<std::string>{}(filename)) % shards.size()];
+    }
+
+public:
+    explicit FileAnswerCache(size_t capacity = 10000, size_t shard_count = 0) {
+        capacity = std::max<size_t>(capacity, 1);
+        if (shard_count == 0) {
+            shard_count = std::max<size_t>(1, std::thread::hardware_concurrency()) * 4;
+        }
+        shard_count = std::clamp<size_t>(capacity / Cache::MIN_SHARD_CAPACITY, 1, shard_count);
+        
+        for (size_t i = 0; i < shard_count; ++i) {
+            auto shard = std::make_unique<Shard>();
+            shard->capacity = capacity / shard_count + (i < capacity % shard_count ? 1 : 0);
+            shards.push_back(std::move(shard));
+        }
+    }
+    
+    // Answer for the file (nullptr if not cached)
+    EntryPtr get(const std::string& filename) {
+        Shard& shard = shardFor(filename);
+        std::lock_guard<std::mutex> lock(shard.cache_mutex);
+        
+        auto it = shard.cache_map.find(filename);
+        if (it == shard.cache_map.end()) {
+            shard.stats.misses++;
+            return nullptr;
+        }
+        
+        shard.stats.hits++;
+        shard.lru_list.splice(shard.lru_list.begin(), shard.lru_list, it->second);
+        return it->second->second;
+    }
+    
+    // Read before assembling an answer and hand to put(), so an answer built
+    // from metadata that changed in the meantime is never cached
+    uint64_t generation(const std::string& filename) const {
+        Shard& shard = shardFor(filename);
+        std::lock_guard<std::mutex> lock(shard.cache_mutex);
+        return shard.generation;
+    }
+    
+    // Cache an answer; dropped if the file was invalidated since generation()
+    void put(const std::string& filename, EntryPtr answer, uint64_t generation) {
+        Shard& shard = shardFor(filename);
+        std::lock_guard<std::mutex> lock(shard.cache_mutex);
+        
+        if (shard.generation != generation) {
+            return;  // Something in this shard changed while the answer was built
+        }
+        
+        auto it = shard.cache_map.find(filename);
+        if (it != shard.cache_map.end()) {
+            it->second->second = std::move(answer);
+            shard.lru_list.splice(shard.lru_list.begin(), shard.lru_list, it->second);
+            return;
+        }
+        
+        shard.lru_list.emplace_front(filename, std::move(answer));
+        shard.cache_map[filename] = shard.lru_list.begin();
+        
+        if (shard.lru_list.size() > shard.capacity) {
+            shard.cache_map.erase(shard.lru_list.back().first);
+            shard.lru_list.pop_back();
+        }
+    }
+    
+    void invalidate(const std::string& filename) {
+        Shard& shard = shardFor(filename);
+        std::lock_guard<std::mutex> lock(shard.cache_mutex);
+        
+        shard.generation++;
+        auto it = shard.cache_map.find(filename);
+        if (it != shard.cache_map.end()) {
+            shard.lru_list.erase(it->second);
+            shard.cache_map.erase(it);
+        }
+    }
+    
+    // Invalidate every file (e.g., when a DataNode goes away)
+    void clear() {
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->cache_mutex);
+            shard->generation++;
+            shard->lru_list.clear();
+            shard->cache_map.clear();
+        }
+    }
+    
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->cache_mutex);
+            total += shard->lru_list.size();
+        }
+        return total;
+    }
+    
+    CacheStats stats() const {
+        CacheStats total;
+        for (const auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->cache_mutex);
+            total.hits += shard->stats.hits;
+            total.misses += shard->stats.misses;
+        }
+        return total;
+    }
 };
+
+// The MetaServer's GetFileLocation answers (defined in the generated dfs.pb.h)
+class FileLocationResponse;
+using FileLocationCache = FileAnswerCache<FileLocationResponse>;
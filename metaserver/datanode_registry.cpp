@@ -0,0 +1,53 @@
+#include "datanode_registry.hpp"
+
+std::pair<size_t, size_t> DataNodeRegistry::locate(DataNodeId id) {
+    // Blocks before b hold FIRST_BLOCK * (2^b - 1) addresses in all
+    uint64_t scaled = static_cast<uint64_t>(id) / FIRST_BLOCK + 1;
+    size_t block = 0;
+    while (scaled >>= 1) {
+        block++;
+    }
+    return {block, id - FIRST_BLOCK * ((uint64_t(1) << block) - 1)};
+}
+
+DataNodeId DataNodeRegistry::intern(const std::string& address) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto it = ids.find(address);
+    if (it != ids.end()) {
+        return it->second;
+    }
+
+    DataNodeId id = static_cast<DataNodeId>(count.load(std::memory_order_relaxed));
+    auto [block, position] = locate(id);
+    if (!blocks[block]) {
+        blocks[block] = std::make_unique<std::string[]>(FIRST_BLOCK << block);
+    }
+    blocks[block][position] = address;
+    ids.emplace(address, id);
+
+    // Publishes the address to lock-free readers
+    count.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+std::optional<DataNodeId> DataNodeRegistry::find(const std::string& address) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto it = ids.find(address);
+    if (it == ids.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+const std::string& DataNodeRegistry::address(DataNodeId id) const {
+    static const std::string unknown;
+    if (id >= count.load(std::memory_order_acquire)) {
+        return unknown;
+    }
+    auto [block, position] = locate(id);
+    return blocks[block][position];
+}
+
+size_t DataNodeRegistry::size() const {
+    return count.load(std::memory_order_acquire);
+}
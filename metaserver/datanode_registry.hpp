@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// Inside the MetaServer a DataNode is a small integer, assigned the first
+// time its address is seen. Replica lists hold these ids rather than address
+// strings, so they cost four bytes per replica and compare as integers, and
+// liveness is a bitmap indexed by id. Addresses are looked up only to build
+// responses. Ids are never reused and never persisted: a node that goes away
+// and comes back keeps its id for the life of the process, while the metadata
+// log and image keep addresses.
+using DataNodeId = uint32_t;
+
+// Never assigned; stands for a replica that can't be resolved
+constexpr DataNodeId NO_DATANODE = UINT32_MAX;
+
+class DataNodeRegistry {
+private:
+    // Addresses live in blocks that double in size and never move once
+    // allocated, so address() reads them without a lock; only assigning a
+    // new id takes one. Block b holds FIRST_BLOCK << b addresses.
+    static constexpr size_t FIRST_BLOCK = 64;
+    static constexpr size_t BLOCK_COUNT = 27;  // Enough for every DataNodeId
+
+    std::mutex registry_mutex;  // Serializes assigning ids
+    std::unordered_map<std::string, DataNodeId> ids;  // address -> id
+    std::array<std::unique_ptr<std::string[]>, BLOCK_COUNT> blocks;
+    std::atomic<size_t> count{0};  // Ids below this are assigned and readable
+
+    // Block and position within it that hold id's address
+    static std::pair<size_t, size_t> locate(DataNodeId id);
+
+public:
+    DataNodeRegistry() = default;
+    DataNodeRegistry(const DataNodeRegistry&) = delete;
+    DataNodeRegistry& operator=(const DataNodeRegistry&) = delete;
+
+    // The address's id, assigned on first sight
+    DataNodeId intern(const std::string& address);
+
+    // The address's id, if it has one
+    std::optional<DataNodeId> find(const std::string& address);
+
+    // Empty for an id that was never assigned. The reference stays valid for
+    // the registry's lifetime.
+    const std::string& address(DataNodeId id) const;
+
+    // Every id assigned so far is below this
+    size_t size() const;
+};
@@ -1,5 +1,11 @@
 #include <string>
 #include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <algorithm>
 #include "cache.hpp"
 #include "manager.hpp"
 #include "server.hpp"
@@ -7,95 +13,102 @@
 #include <grpcpp/server_builder.h>
 #include <grpcpp/server.h>
 
-using ::grpc::Status;
-using ::grpc::ServerContext;
 using ::grpc::ServerBuilder;
 using ::grpc::Server;
 
-class RPCServiceImpl final : public MetaService::Service {
-private:
-    Manager* theManager; 
-public:  
-    RPCServiceImpl(Manager* aManager) : theManager(aManager) {
+// Log one cache tier's lookups and hit rate since the previous report
+template <typename CacheType>
+void logCacheStats(const char* tier, const CacheType& cache, CacheStats& last) {
+    CacheStats now = cache.stats();
+    uint64_t hits = now.hits - last.hits;
+    uint64_t lookups = hits + (now.misses - last.misses);
+    if (lookups > 0) {
+        std::cout << "[CACHE] " << tier << ": " << lookups << " lookups, hit rate "
+                  << (100.0 * hits / lookups) << "%, " << cache.size() << " entries\n";
     }
+    last = now;
+}
 
-    Status RegisterDataNode(ServerContext* context, const ::DataNodeInfo* request, ::Ack* response) {
-        bool success = theManager->registerDataNode(
-            request->address(),
-            request->available_space()
-        );
-        
-        response->set_ok(success);
-        response->set_message(success ? "DataNode registered successfully" : "Failed to register DataNode");
-        
-        return Status::OK; 
+// Periodically log the location caches' hit rates
+void cacheStatsThread(const Cache* cache, const FileLocationCache* file_cache,
+                      std::mutex* mutex, std::condition_variable* stop, bool* stopping) {
+    CacheStats last_chunks;
+    CacheStats last_files;
+    std::unique_lock<std::mutex> lock(*mutex);
+    while (!stop->wait_for(lock, std::chrono::seconds(60), [stopping] { return *stopping; })) {
+        logCacheStats("files", *file_cache, last_files);
+        logCacheStats("chunks", *cache, last_chunks);
     }
+}
 
-    Status Heartbeat(ServerContext* context, const ::DataNodeHeartbeat* request, ::HeartbeatResponse* response) {
-        // Convert repeated field to vector
-        std::vector<std::string> chunks;
-        for (const auto& chunk : request->stored_chunk_ids()) {
-            chunks.push_back(chunk);
-        }
-        
-        bool success = theManager->updateDataNodeHeartbeat(
-            request->address(),
-            chunks,
-            request->available_space(),
-            request->current_load()
-        );
-        
-        response->set_ok(success);
-        // In the future, we could add chunks_to_delete for garbage collection
-        
-        return Status::OK; 
+// Periodically fold the metadata log into a fresh checkpoint so restarts
+// replay only what was logged since
+void checkpointThread(Manager* manager, int interval_seconds,
+                      std::mutex* mutex, std::condition_variable* stop, bool* stopping) {
+    std::unique_lock<std::mutex> lock(*mutex);
+    while (!stop->wait_for(lock, std::chrono::seconds(interval_seconds), [stopping] { return *stopping; })) {
+        lock.unlock();
+        manager->checkpoint();
+        lock.lock();
     }
+}
 
-    Status GetFileLocation(ServerContext* context, const ::FileLocationRequest* request, ::FileLocationResponse* response) {
-        auto [found, locations] = theManager->getFileLocation(request->filename());
-        
-        if (!found) {
-            response->set_found(false);
-            return Status::OK;
-        }
-        
-        response->set_found(true);
-        for (const auto& loc : locations) {
-            auto* chunk_loc = response->add_chunks();
-            chunk_loc->set_chunk_id(loc.chunk_id);
-            for (const auto& addr : loc.datanode_addresses) {
-                chunk_loc->add_datanode_addresses(addr);
-            }
-        }
-        
-        return Status::OK;
+// Seconds between sweeps for DataNodes that stopped heartbeating
+constexpr int STALE_SWEEP_INTERVAL = 10;
+
+// Drop dead DataNodes in the background so allocations never pay for it
+void staleNodeThread(Manager* manager, std::mutex* mutex, std::condition_variable* stop, bool* stopping) {
+    std::unique_lock<std::mutex> lock(*mutex);
+    while (!stop->wait_for(lock, std::chrono::seconds(STALE_SWEEP_INTERVAL), [stopping] { return *stopping; })) {
+        lock.unlock();
+        manager->removeStaleDataNodes();
+        lock.lock();
     }
+}
 
-    Status AllocateChunkLocation(ServerContext* context, const ::ChunkAllocationRequest* request, ::ChunkLocation* response) {
-        auto [chunk_id, datanode_addresses] = theManager->allocateChunkLocation(
-            request->filename(),
-            request->chunk_index(),
-            request->chunk_size()
-        );
-        
-        if (chunk_id.empty()) {
-            return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, 
-                               "No available DataNode for chunk allocation");
-        }
-        
-        response->set_chunk_id(chunk_id);
-        for (const auto& addr : datanode_addresses) {
-            response->add_datanode_addresses(addr);
-        }
-        
-        return Status::OK;
+// Seconds between re-replication rounds
+constexpr int REPLICATION_INTERVAL = 3;
+
+// Copy under-replicated chunks back up to their file's replication factor,
+// starting at most bandwidth bytes of copies per second so recovery traffic
+// leaves room for clients
+void replicationThread(Manager* manager, int64_t bandwidth,
+                       std::mutex* mutex, std::condition_variable* stop, bool* stopping) {
+    std::unique_lock<std::mutex> lock(*mutex);
+    while (!stop->wait_for(lock, std::chrono::seconds(REPLICATION_INTERVAL), [stopping] { return *stopping; })) {
+        lock.unlock();
+        manager->scheduleReplication(bandwidth * REPLICATION_INTERVAL);
+        lock.lock();
+    }
+}
+
+// Seconds between rebalancing rounds
+constexpr int REBALANCE_INTERVAL = 10;
+
+// Move chunks from fuller to emptier DataNodes until every node's utilization
+// is within band of the cluster's, at most bandwidth bytes of moves per second
+void rebalanceThread(Manager* manager, double band, int64_t bandwidth,
+                     std::mutex* mutex, std::condition_variable* stop, bool* stopping) {
+    std::unique_lock<std::mutex> lock(*mutex);
+    while (!stop->wait_for(lock, std::chrono::seconds(REBALANCE_INTERVAL), [stopping] { return *stopping; })) {
+        lock.unlock();
+        manager->scheduleRebalance(band, bandwidth * REBALANCE_INTERVAL);
+        lock.lock();
     }
-};
+}
 
-void RunServer(const std::string& address) {
-    Cache cache(1000);  // LRU cache with capacity of 1000 chunks
-    Manager manager(&cache); 
-    RPCServiceImpl service(&manager); 
+bool RunServer(const std::string& address, size_t cache_capacity, CachePolicy cache_policy,
+               size_t file_cache_capacity, const std::string& metadata_dir, int checkpoint_interval,
+               int64_t replication_bandwidth, double balance_band, int64_t rebalance_bandwidth) {
+    Cache cache(cache_capacity, 0, cache_policy);
+    FileLocationCache file_cache(file_cache_capacity);
+    Manager manager(&cache, &file_cache); 
+    RPCServiceImpl service(&manager, &file_cache); 
+    
+    if (!manager.openMetadata(metadata_dir)) {
+        std::cerr << "[ERROR] Failed to load metadata from " << metadata_dir << "\n";
+        return false;
+    }
 
     ServerBuilder server_builder;
     server_builder.AddListeningPort(address, grpc::InsecureServerCredentials());
@@ -104,10 +117,116 @@ void RunServer(const std::string& address) {
     std::unique_ptr<Server> server{server_builder.BuildAndStart()}; 
     
     std::cout << "Server listening on " << address << "\n"; 
+    std::cout << "[INFO] Chunk location cache: " << cache_capacity << " entries, "
+              << (cache_policy == CachePolicy::TinyLFU ? "tinylfu" : "lru") << " policy, "
+              << cache.shardCount() << " shards\n";
+    std::cout << "[INFO] File location cache: " << file_cache_capacity << " entries\n";
+    if (replication_bandwidth > 0) {
+        std::cout << "[INFO] Re-replication: up to " << replication_bandwidth / (1024 * 1024) << " MB/s\n";
+    } else {
+        std::cout << "[INFO] Re-replication disabled\n";
+    }
+    if (rebalance_bandwidth > 0) {
+        std::cout << "[INFO] Rebalancing: within " << balance_band * 100 << "% of mean utilization, up to "
+                  << rebalance_bandwidth / (1024 * 1024) << " MB/s\n";
+    } else {
+        std::cout << "[INFO] Rebalancing disabled\n";
+    }
+    
+    std::mutex stats_mutex;
+    std::condition_variable stats_stop;
+    bool stopping = false;
+    std::thread stats(cacheStatsThread, &cache, &file_cache, &stats_mutex, &stats_stop, &stopping);
+    std::thread checkpoints(checkpointThread, &manager, checkpoint_interval, &stats_mutex, &stats_stop, &stopping);
+    std::thread stale_nodes(staleNodeThread, &manager, &stats_mutex, &stats_stop, &stopping);
+    std::thread replication;
+    if (replication_bandwidth > 0) {
+        replication = std::thread(replicationThread, &manager, replication_bandwidth,
+                                  &stats_mutex, &stats_stop, &stopping);
+    }
+    std::thread rebalance;
+    if (rebalance_bandwidth > 0) {
+        rebalance = std::thread(rebalanceThread, &manager, balance_band, rebalance_bandwidth,
+                                &stats_mutex, &stats_stop, &stopping);
+    }
+    
     server->Wait(); 
+    
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stopping = true;
+    }
+    stats_stop.notify_all();
+    stats.join();
+    checkpoints.join();
+    stale_nodes.join();
+    if (replication.joinable()) {
+        replication.join();
+    }
+    if (rebalance.joinable()) {
+        rebalance.join();
+    }
+    manager.checkpoint();
+    return true;
 }
 
 int main(int argc, char* argv[]) {
-    RunServer("0.0.0.0:50051");
-    return 0; 
+    std::string address = "0.0.0.0:50051";
+    size_t cache_capacity = 1000;  // Chunk locations kept in memory
+    CachePolicy cache_policy = CachePolicy::LRU;
+    size_t file_cache_capacity = 10000;  // Whole-file answers kept in memory
+    std::string metadata_dir = "./metaserver_metadata";  // Metadata log and checkpoints
+    int checkpoint_interval = 300;  // Seconds between checkpoints
+    int64_t replication_bandwidth = 64;  // MB/s of re-replication copies; 0 disables
+    double balance_band = 10;  // Percentage points of utilization a node may stray from the mean
+    int64_t rebalance_bandwidth = 16;  // MB/s of rebalancing moves; 0 disables
+    
+    // Simple argument parsing
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--address" && i + 1 < argc) {
+            address = argv[++i];
+        } else if (arg == "--cache-capacity" && i + 1 < argc) {
+            cache_capacity = std::stoul(argv[++i]);
+        } else if (arg == "--cache-policy" && i + 1 < argc) {
+            std::string policy = argv[++i];
+            if (policy == "lru") {
+                cache_policy = CachePolicy::LRU;
+            } else if (policy == "tinylfu") {
+                cache_policy = CachePolicy::TinyLFU;
+            } else {
+                std::cerr << "[ERROR] Unknown cache policy: " << policy << " (expected lru or tinylfu)\n";
+                return 1;
+            }
+        } else if (arg == "--file-cache-capacity" && i + 1 < argc) {
+            file_cache_capacity = std::stoul(argv[++i]);
+        } else if (arg == "--metadata-dir" && i + 1 < argc) {
+            metadata_dir = argv[++i];
+        } else if (arg == "--checkpoint-interval" && i + 1 < argc) {
+            checkpoint_interval = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--replication-bandwidth" && i + 1 < argc) {
+            replication_bandwidth = std::max(0LL, std::stoll(argv[++i]));
+        } else if (arg == "--balance-band" && i + 1 < argc) {
+            balance_band = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--rebalance-bandwidth" && i + 1 < argc) {
+            rebalance_bandwidth = std::max(0LL, std::stoll(argv[++i]));
+        } else if (arg == "--help") {
+            std::cout << "Usage: " << argv[0] << " [options]\n"
+                      << "Options:\n"
+                      << "  --address <addr>           Listen address (default: 0.0.0.0:50051)\n"
+                      << "  --cache-capacity <n>       Chunk locations cached in memory (default: 1000)\n"
+                      << "  --cache-policy <lru|tinylfu> Cache eviction/admission policy (default: lru)\n"
+                      << "  --file-cache-capacity <n>  Whole-file location answers cached (default: 10000)\n"
+                      << "  --metadata-dir <path>      Metadata log and checkpoint directory (default: ./metaserver_metadata)\n"
+                      << "  --checkpoint-interval <s>  Seconds between metadata checkpoints (default: 300)\n"
+                      << "  --replication-bandwidth <MB/s> Re-replication copies started per second, 0 to disable (default: 64)\n"
+                      << "  --balance-band <percent>   How far a DataNode's utilization may stray from the mean (default: 10)\n"
+                      << "  --rebalance-bandwidth <MB/s> Rebalancing moves started per second, 0 to disable (default: 16)\n"
+                      << "  --help                     Show this help message\n";
+            return 0;
+        }
+    }
+    
+    return RunServer(address, cache_capacity, cache_policy, file_cache_capacity, metadata_dir, checkpoint_interval,
+                     replication_bandwidth * 1024 * 1024, balance_band / 100, rebalance_bandwidth * 1024 * 1024) ? 0 : 1;
 }
@@ -1,279 +1,1672 @@
 #include "manager.hpp"
 #include <iostream>
-#include <sstream>
-#include <iomanip>
 #include <algorithm>
+#include <cmath>
 #include <random>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <tuple>
 
-Manager::Manager(Cache* aCache) : theCache(aCache) {
+// Metadata log record types
+constexpr uint32_t RECORD_ALLOCATE = 3;
+constexpr uint32_t RECORD_DELETE = 4;
+
+// Metadata image written by each checkpoint
+static const char* IMAGE_FILE = "image";
+
+Manager::Manager(Cache* aCache, FileLocationCache* aFileCache, std::chrono::milliseconds aWriteGrace)
+    : theCache(aCache), theFileCache(aFileCache), write_grace(aWriteGrace) {
 }
 
-std::string Manager::generateChunkId(const std::string& filename, int chunk_index) {
-    // Generate unique chunk ID using filename, index, and counter
-    std::stringstream ss;
-    ss << std::hash<std::string>{}(filename) << "_" 
-       << chunk_index << "_" 
-       << chunk_counter.fetch_add(1);
-    return ss.str();
+bool Manager::openMetadata(const std::string& directory) {
+    std::lock_guard<std::mutex> lock(metadata_mutex);
+    if (metadata_log) {
+        return false;  // Already persisting
+    }
+    
+    uint64_t first_segment = 0;
+    std::string image_path = directory + "/" + IMAGE_FILE;
+    std::error_code ec;
+    if (std::filesystem::exists(image_path, ec)) {
+        auto started = std::chrono::steady_clock::now();
+        image = MetadataImage::open(image_path);
+        if (!image) {
+            // Starting empty would silently drop the namespace
+            std::cerr << "[ERROR] Unreadable metadata image " << image_path << "\n";
+            return false;
+        }
+        first_segment = image->nextSegment();
+        chunk_counter.store(image->chunkCounter());
+        
+        image_nodes.reserve(image->addressCount());
+        for (size_t i = 0; i < image->addressCount(); ++i) {
+            image_nodes.push_back(registry.intern(std::string(image->address(i))));
+        }
+        {
+            std::lock_guard<std::shared_mutex> chunks_lock(chunks_mutex);
+            for (size_t chunk = 0; chunk < image->chunkCount(); ++chunk) {
+                for (size_t i = 0; i < image->chunkReplicaCount(chunk); ++i) {
+                    DataNodeId node = imageReplica(chunk, i);
+                    if (node != NO_DATANODE) {
+                        node_chunks[node].insert(image->chunkId(chunk));
+                    }
+                }
+            }
+        }
+        
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started).count();
+        std::cout << "[INFO] Mapped metadata image with " << image->fileCount() << " files, "
+                  << image->chunkCount() << " chunks in " << elapsed << " ms\n";
+    }
+    
+    auto log = std::make_unique<MetadataLog>(directory);
+    if (!log->open(first_segment, [this](const std::string& payload) { replayRecord(payload); })) {
+        return false;
+    }
+    
+    metadata_directory = directory;
+    metadata_log = std::move(log);
+    {
+        std::lock_guard<std::mutex> nodes_lock(datanodes_mutex);
+        replica_recheck_at = std::chrono::steady_clock::now() + DATANODE_TIMEOUT;
+    }
+    
+    std::cout << "[INFO] Metadata in " << directory << ": " << getFileCount() << " files\n";
+    return true;
 }
 
-std::string Manager::selectDataNodeForChunk(int64_t chunk_size) {
-    std::lock_guard<std::mutex> lock(datanodes_mutex);
+void Manager::replayRecord(const std::string& payload) {
+    BinaryReader record(payload.data(), payload.size());
+    uint32_t type = record.getU32();
+    if (type == RECORD_DELETE) {
+        std::string filename = record.getString();
+        if (!record.ok()) {
+            std::cerr << "[WARNING] Skipping malformed metadata log record\n";
+            return;
+        }
+        // Replayed records are durable already
+        std::vector<std::pair<DataNodeId, ChunkId>> released;
+        applyDeletion(filename, released);
+        queueDeletions(released);
+        return;
+    }
+    if (type != RECORD_ALLOCATE) {
+        std::cerr << "[WARNING] Skipping unknown metadata log record type " << type << "\n";
+        return;
+    }
     
-    // Clean up stale nodes first
-    cleanupStaleDataNodes();
+    std::string filename = record.getString();
+    int64_t file_chunk_size = record.getI64();
+    int32_t replication_factor = static_cast<int32_t>(record.getU32());
+    std::chrono::system_clock::time_point created_at{std::chrono::milliseconds(record.getI64())};
+    uint64_t counter = record.getU64();
     
-    std::string best_node;
-    int64_t max_space = 0;
-    int32_t min_load = INT32_MAX;
+    std::vector<ChunkAllocation> allocations(record.getU32());
+    for (auto& allocation : allocations) {
+        allocation.chunk_id = record.getU64();
+        allocation.chunk_index = static_cast<int32_t>(record.getU32());
+        allocation.chunk_size = record.getI64();
+        allocation.datanode_addresses.resize(record.getU32());
+        for (auto& address : allocation.datanode_addresses) {
+            address = record.getString();
+        }
+        if (!record.ok()) {
+            break;
+        }
+    }
+    
+    if (!record.ok()) {
+        std::cerr << "[WARNING] Skipping malformed metadata log record\n";
+        return;
+    }
     
-    for (const auto& [address, state] : datanodes) {
-        // Skip nodes without enough space
-        if (state.available_space < chunk_size) {
+    std::vector<std::pair<DataNodeId, ChunkId>> released;
+    applyAllocations(filename, allocations, file_chunk_size, replication_factor, created_at, released);
+    queueDeletions(released);
+    
+    // Never hand out an id that was issued before the restart
+    if (chunk_counter.load() < counter) {
+        chunk_counter.store(counter);
+    }
+}
+
+FileMetadata& Manager::fileForUpdate(const std::string& filename) {
+    auto it = files.find(filename);
+    if (it != files.end()) {
+        return it->second;
+    }
+    
+    FileMetadata& meta = files[filename];
+    std::optional<size_t> file = imageFile(filename);
+    if (file) {
+        // Copy on first write; the overlay entry shadows the image's from now on
+        meta.filename = filename;
+        meta.total_size = image->fileTotalSize(*file);
+        meta.chunk_size = image->fileChunkSize(*file);
+        meta.replication_factor = image->fileReplicationFactor(*file);
+        meta.created_at = std::chrono::system_clock::time_point{std::chrono::milliseconds(image->fileCreatedAtMs(*file))};
+        meta.chunk_ids.reserve(image->fileChunkCount(*file));
+        for (size_t i = 0; i < image->fileChunkCount(*file); ++i) {
+            meta.chunk_ids.push_back(image->fileChunkId(*file, i));
+        }
+        shadowed_image_files++;
+    }
+    return meta;
+}
+
+bool Manager::findFile(const std::string& filename, std::vector<ChunkId>& chunk_ids, int64_t& chunk_size) {
+    auto it = files.find(filename);
+    if (it != files.end()) {
+        chunk_ids = it->second.chunk_ids;
+        chunk_size = it->second.chunk_size;
+        return true;
+    }
+    
+    std::optional<size_t> file = imageFile(filename);
+    if (!file) {
+        return false;
+    }
+    chunk_ids.clear();
+    chunk_ids.reserve(image->fileChunkCount(*file));
+    for (size_t i = 0; i < image->fileChunkCount(*file); ++i) {
+        chunk_ids.push_back(image->fileChunkId(*file, i));
+    }
+    chunk_size = image->fileChunkSize(*file);
+    return true;
+}
+
+std::vector<DataNodeId>& Manager::replicasForUpdate(ChunkId chunk_id) {
+    auto it = chunk_to_datanodes.find(chunk_id);
+    if (it != chunk_to_datanodes.end()) {
+        return it->second;
+    }
+    
+    auto& replicas = chunk_to_datanodes[chunk_id];
+    std::optional<size_t> chunk = imageChunk(chunk_id);
+    if (chunk) {
+        for (size_t i = 0; i < image->chunkReplicaCount(*chunk); ++i) {
+            DataNodeId node = imageReplica(*chunk, i);
+            if (node != NO_DATANODE) {
+                replicas.push_back(node);
+            }
+        }
+        std::string_view owner = image->chunkOwner(*chunk);
+        if (!owner.empty()) {
+            chunk_to_file.emplace(chunk_id, std::string(owner));
+        }
+    }
+    return replicas;
+}
+
+DataNodeId Manager::imageReplica(size_t chunk, size_t position) const {
+    size_t address = image->chunkReplicaAddress(chunk, position);
+    return address < image_nodes.size() ? image_nodes[address] : NO_DATANODE;
+}
+
+std::optional<size_t> Manager::imageFile(const std::string& filename) const {
+    if (!image || deleted_image_files.count(filename)) {
+        return std::nullopt;
+    }
+    return image->findFile(filename);
+}
+
+std::optional<size_t> Manager::imageChunk(ChunkId chunk_id) const {
+    if (!image || deleted_image_chunks.count(chunk_id)) {
+        return std::nullopt;
+    }
+    return image->findChunk(chunk_id);
+}
+
+bool Manager::hasReplica(ChunkId chunk_id, DataNodeId node) const {
+    auto it = chunk_to_datanodes.find(chunk_id);
+    if (it != chunk_to_datanodes.end()) {
+        return std::find(it->second.begin(), it->second.end(), node) != it->second.end();
+    }
+    
+    std::optional<size_t> chunk = imageChunk(chunk_id);
+    if (!chunk) {
+        return false;
+    }
+    for (size_t i = 0; i < image->chunkReplicaCount(*chunk); ++i) {
+        if (imageReplica(*chunk, i) == node) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Manager::findReplicas(ChunkId chunk_id, std::vector<DataNodeId>& replicas) const {
+    auto it = chunk_to_datanodes.find(chunk_id);
+    if (it != chunk_to_datanodes.end()) {
+        replicas = it->second;
+        return true;
+    }
+    
+    std::optional<size_t> chunk = imageChunk(chunk_id);
+    if (!chunk) {
+        return false;
+    }
+    replicas.clear();
+    for (size_t i = 0; i < image->chunkReplicaCount(*chunk); ++i) {
+        DataNodeId node = imageReplica(*chunk, i);
+        if (node != NO_DATANODE) {
+            replicas.push_back(node);
+        }
+    }
+    return true;
+}
+
+std::string Manager::findOwner(ChunkId chunk_id) const {
+    auto it = chunk_to_file.find(chunk_id);
+    if (it != chunk_to_file.end()) {
+        return it->second;
+    }
+    
+    std::optional<size_t> chunk = imageChunk(chunk_id);
+    return chunk ? std::string(image->chunkOwner(*chunk)) : std::string();
+}
+
+bool Manager::isKnownChunk(ChunkId chunk_id) const {
+    return chunk_to_datanodes.count(chunk_id) > 0 || imageChunk(chunk_id).has_value();
+}
+
+void Manager::forEachChunk(const std::function<void(ChunkId, const std::vector<DataNodeId>&)>& visit) const {
+    for (const auto& [chunk_id, replicas] : chunk_to_datanodes) {
+        visit(chunk_id, replicas);
+    }
+    if (!image) {
+        return;
+    }
+    std::vector<DataNodeId> replicas;
+    for (size_t chunk = 0; chunk < image->chunkCount(); ++chunk) {
+        ChunkId chunk_id = image->chunkId(chunk);
+        if (chunk_to_datanodes.count(chunk_id) || deleted_image_chunks.count(chunk_id)) {
+            continue;  // Shadowed, so visited above or gone
+        }
+        replicas.clear();
+        for (size_t i = 0; i < image->chunkReplicaCount(chunk); ++i) {
+            DataNodeId node = imageReplica(chunk, i);
+            if (node != NO_DATANODE) {
+                replicas.push_back(node);
+            }
+        }
+        visit(chunk_id, replicas);
+    }
+}
+
+std::vector<std::pair<DataNodeId, ChunkId>> Manager::forgetChunks(const std::vector<ChunkId>& chunk_ids) {
+    std::vector<std::pair<DataNodeId, ChunkId>> replicas;
+    std::vector<DataNodeId> nodes;
+    for (ChunkId chunk_id : chunk_ids) {
+        if (chunk_id == NO_CHUNK || !findReplicas(chunk_id, nodes)) {
             continue;
         }
+        for (DataNodeId node : nodes) {
+            replicas.emplace_back(node, chunk_id);
+            node_chunks[node].erase(chunk_id);
+        }
+        chunk_to_datanodes.erase(chunk_id);
+        chunk_to_file.erase(chunk_id);
+        if (image && image->findChunk(chunk_id)) {
+            deleted_image_chunks.insert(chunk_id);
+        }
+    }
+    return replicas;
+}
+
+void Manager::releaseChunks(const std::vector<ChunkId>& chunk_ids) {
+    std::lock_guard<std::mutex> lock(replication_mutex);
+    for (ChunkId chunk_id : chunk_ids) {
+        theCache->remove(chunk_id);
+        replication_queue.remove(chunk_id);
+        auto pending = pending_replications.find(chunk_id);
+        if (pending != pending_replications.end()) {
+            finishReplication(pending);
+        }
+    }
+}
+
+void Manager::queueDeletions(const std::vector<std::pair<DataNodeId, ChunkId>>& replicas) {
+    if (replicas.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(replication_mutex);
+    for (const auto& [node, chunk_id] : replicas) {
+        deletion_tasks[node].insert(chunk_id);
+    }
+}
+
+bool Manager::checkpoint() {
+    // Copy only the changes since the image under the locks; merging them
+    // with the immutable image and writing the result happen outside
+    std::unordered_map<std::string, FileMetadata> changed_files;
+    std::unordered_map<ChunkId, std::vector<DataNodeId>> changed_chunks;
+    std::unordered_map<ChunkId, std::string> changed_owners;
+    std::unordered_set<std::string> deleted_files;
+    std::unordered_set<ChunkId> deleted_chunks;
+    uint64_t next_segment = 0;
+    uint64_t counter = 0;
+    {
+        std::lock_guard<std::mutex> lock(metadata_mutex);
+        if (!metadata_log) {
+            return false;
+        }
+        
+        // Everything logged before this point is in the image; replay starts at next_segment
+        next_segment = metadata_log->rollSegment();
+        counter = chunk_counter.load();
+        
+        {
+            std::lock_guard<std::mutex> files_lock(files_mutex);
+            changed_files = files;
+            deleted_files = deleted_image_files;
+        }
+        {
+            std::shared_lock<std::shared_mutex> chunks_lock(chunks_mutex);
+            changed_chunks = chunk_to_datanodes;
+            changed_owners = chunk_to_file;
+            deleted_chunks = deleted_image_chunks;
+        }
+    }
+    
+    MetadataImageBuilder builder;
+    for (const auto& [filename, meta] : changed_files) {
+        builder.addFile(filename, meta.total_size, meta.chunk_size,
+                        std::chrono::duration_cast<std::chrono::milliseconds>(meta.created_at.time_since_epoch()).count(),
+                        meta.replication_factor, meta.chunk_ids);
+    }
+    for (const auto& [chunk_id, replicas] : changed_chunks) {
+        auto owner = changed_owners.find(chunk_id);
+        std::vector<std::string_view> addresses;
+        addresses.reserve(replicas.size());
+        for (DataNodeId node : replicas) {
+            addresses.push_back(registry.address(node));
+        }
+        builder.addChunk(chunk_id, owner != changed_owners.end() ? std::string_view(owner->second) : std::string_view(),
+                         std::move(addresses));
+    }
+    
+    if (image) {
+        for (size_t file = 0; file < image->fileCount(); ++file) {
+            std::string_view filename = image->fileName(file);
+            std::string name(filename);
+            if (changed_files.count(name) || deleted_files.count(name)) {
+                continue;
+            }
+            std::vector<ChunkId> chunk_ids;
+            chunk_ids.reserve(image->fileChunkCount(file));
+            for (size_t i = 0; i < image->fileChunkCount(file); ++i) {
+                chunk_ids.push_back(image->fileChunkId(file, i));
+            }
+            builder.addFile(filename, image->fileTotalSize(file), image->fileChunkSize(file),
+                            image->fileCreatedAtMs(file), image->fileReplicationFactor(file), std::move(chunk_ids));
+        }
         
-        // Select node with lowest load and most available space
-        if (state.current_load < min_load || 
-            (state.current_load == min_load && state.available_space > max_space)) {
-            best_node = address;
-            max_space = state.available_space;
-            min_load = state.current_load;
+        for (size_t chunk = 0; chunk < image->chunkCount(); ++chunk) {
+            ChunkId chunk_id = image->chunkId(chunk);
+            if (changed_chunks.count(chunk_id) || deleted_chunks.count(chunk_id)) {
+                continue;
+            }
+            std::vector<std::string_view> replicas;
+            replicas.reserve(image->chunkReplicaCount(chunk));
+            for (size_t i = 0; i < image->chunkReplicaCount(chunk); ++i) {
+                replicas.push_back(image->chunkReplica(chunk, i));
+            }
+            builder.addChunk(chunk_id, image->chunkOwner(chunk), std::move(replicas));
         }
     }
     
-    return best_node;
+    size_t file_count = builder.fileCount();
+    size_t chunk_count = builder.chunkCount();
+    std::string bytes = builder.build(next_segment, counter);
+    
+    // The mapped image stays valid: the rename leaves its inode alone, and it
+    // keeps serving together with the in-memory changes until the next restart
+    if (!writeFileDurably(metadata_directory + "/" + IMAGE_FILE, bytes)) {
+        std::cerr << "[ERROR] Failed to write metadata image\n";
+        return false;
+    }
+    metadata_log->removeSegmentsBefore(next_segment);
+    
+    std::cout << "[INFO] Checkpointed " << file_count << " files, " << chunk_count << " chunks ("
+              << bytes.size() << " bytes)\n";
+    return true;
+}
+
+ChunkId Manager::generateChunkId() {
+    // Ids are never reused, so a counter is unique on its own
+    return chunk_counter.fetch_add(1) + 1;
+}
+
+std::vector<DataNodeState*> Manager::selectDataNodesForChunk(int64_t chunk_size, int32_t count,
+                                                             const std::vector<DataNodeId>& exclude) {
+    // Should be called with datanodes_mutex locked. Within a load level nodes
+    // are ordered by free space, so once one can't take the chunk the rest of
+    // its level is skipped; the walk costs one seek per distinct load plus a
+    // step per node picked. Each key is a different node, so picks are distinct.
+    std::vector<DataNodeState*> selected;
+    auto it = placement_index.begin();
+    while (it != placement_index.end() && selected.size() < static_cast<size_t>(count)) {
+        if (it->space >= chunk_size) {
+            if (std::find(exclude.begin(), exclude.end(), it->id) == exclude.end()) {
+                selected.push_back(&datanodes.find(it->id)->second);
+            }
+            ++it;
+        } else if (it->load == INT32_MAX) {
+            break;
+        } else {
+            it = placement_index.lower_bound(PlacementKey{it->load + 1, INT64_MAX, 0});
+        }
+    }
+    return selected;
 }
 
-std::vector<std::string> Manager::getActiveDataNodes() {
+std::vector<bool> Manager::getActiveDataNodes() {
     std::lock_guard<std::mutex> lock(datanodes_mutex);
-    std::vector<std::string> active_nodes;
+    std::vector<bool> active_nodes(registry.size());
     
     auto now = std::chrono::steady_clock::now();
-    for (const auto& [address, state] : datanodes) {
-        // Consider node active if heartbeat received within last 30 seconds
-        auto time_since_heartbeat = std::chrono::duration_cast<std::chrono::seconds>(
-            now - state.last_heartbeat).count();
-        if (time_since_heartbeat < 30) {
-            active_nodes.push_back(address);
+    for (const auto& [id, state] : datanodes) {
+        // Active until it counts as stale, the same timeout removeStaleDataNodes() uses
+        if (now - state.last_heartbeat <= DATANODE_TIMEOUT) {
+            active_nodes[id] = true;
         }
     }
     
     return active_nodes;
 }
 
-void Manager::cleanupStaleDataNodes() {
-    // Should be called with datanodes_mutex locked
-    auto now = std::chrono::steady_clock::now();
-    std::vector<std::string> stale_nodes;
+void Manager::removeStaleDataNodes() {
+    std::vector<ChunkId> lost_chunks;  // Held by the removed nodes
+    bool recheck = false;
+    {
+        std::lock_guard<std::mutex> lock(datanodes_mutex);
+        auto now = std::chrono::steady_clock::now();
+        std::vector<DataNodeId> stale_nodes;
+        
+        for (const auto& [id, state] : datanodes) {
+            if (now - state.last_heartbeat > DATANODE_TIMEOUT) {
+                stale_nodes.push_back(id);
+            }
+        }
+        
+        // Nodes restored from metadata have had their chance to register
+        if (replica_recheck_at && now >= *replica_recheck_at) {
+            replica_recheck_at.reset();
+            recheck = true;
+        }
+        
+        for (DataNodeId id : stale_nodes) {
+            std::cout << "[INFO] Removing stale DataNode: " << registry.address(id) << "\n";
+            const auto& stored = datanodes[id].stored_chunks;
+            lost_chunks.insert(lost_chunks.end(), stored.begin(), stored.end());
+            eraseDataNode(id);
+        }
+        
+        // Cached file answers may still list the removed nodes
+        if (!stale_nodes.empty() && theFileCache) {
+            theFileCache->clear();
+        }
+    }
     
-    for (const auto& [address, state] : datanodes) {
-        auto time_since_heartbeat = std::chrono::duration_cast<std::chrono::seconds>(
-            now - state.last_heartbeat).count();
-        if (time_since_heartbeat > 60) {  // Remove nodes after 60 seconds of no heartbeat
-            stale_nodes.push_back(address);
+    checkReplication(lost_chunks);
+    if (recheck) {
+        recheckReplicas();
+    }
+}
+
+void Manager::recheckReplicas() {
+    std::vector<bool> up;
+    {
+        std::lock_guard<std::mutex> lock(datanodes_mutex);
+        up.resize(registry.size());
+        for (const auto& [id, state] : datanodes) {
+            up[id] = true;
         }
     }
     
-    for (const auto& address : stale_nodes) {
-        std::cout << "[INFO] Removing stale DataNode: " << address << "\n";
-        datanodes.erase(address);
+    std::vector<ChunkId> short_chunks;
+    {
+        std::shared_lock<std::shared_mutex> lock(chunks_mutex);
+        forEachChunk([&](ChunkId chunk_id, const std::vector<DataNodeId>& replicas) {
+            for (DataNodeId node : replicas) {
+                if (node >= up.size() || !up[node]) {
+                    short_chunks.push_back(chunk_id);
+                    return;
+                }
+            }
+        });
+    }
+    
+    if (!short_chunks.empty()) {
+        std::cout << "[INFO] " << short_chunks.size() << " chunks have replicas on DataNodes that are not up\n";
+    }
+    checkReplication(short_chunks);
+}
+
+DataNodeState& Manager::dataNodeForUpdate(const std::string& address) {
+    DataNodeId id = registry.intern(address);
+    auto it = datanodes.find(id);
+    if (it == datanodes.end()) {
+        // Auto-register unknown DataNode
+        DataNodeState state;
+        state.id = id;
+        state.address = address;
+        it = datanodes.emplace(id, std::move(state)).first;
+        placement_index.insert(PlacementKey{it->second.current_load, it->second.available_space, id});
+        std::cout << "[INFO] Auto-registered DataNode from heartbeat: " << address << "\n";
+    }
+    return it->second;
+}
+
+void Manager::setPlacement(DataNodeState& state, int64_t available_space, int32_t current_load) {
+    if (state.available_space == available_space && state.current_load == current_load) {
+        return;
+    }
+    placement_index.erase(PlacementKey{state.current_load, state.available_space, state.id});
+    state.available_space = available_space;
+    state.current_load = current_load;
+    placement_index.insert(PlacementKey{current_load, available_space, state.id});
+}
+
+void Manager::unchargeAllocations(const std::vector<ChunkAllocation>& allocations) {
+    std::lock_guard<std::mutex> lock(datanodes_mutex);
+    for (const auto& allocation : allocations) {
+        for (const auto& address : allocation.datanode_addresses) {
+            std::optional<DataNodeId> id = registry.find(address);
+            auto it = id ? datanodes.find(*id) : datanodes.end();
+            if (it != datanodes.end()) {
+                it->second.assigned_chunks.erase(allocation.chunk_id);
+                setPlacement(it->second, it->second.available_space + allocation.chunk_size,
+                             it->second.current_load - 1);
+            }
+        }
+    }
+}
+
+void Manager::eraseDataNode(DataNodeId id) {
+    auto it = datanodes.find(id);
+    if (it == datanodes.end()) {
+        return;
     }
+    placement_index.erase(PlacementKey{it->second.current_load, it->second.available_space, id});
+    datanodes.erase(it);
 }
 
 bool Manager::registerDataNode(const std::string& address, int64_t available_space) {
     std::lock_guard<std::mutex> lock(datanodes_mutex);
     
-    DataNodeState state;
-    state.address = address;
-    state.available_space = available_space;
-    state.current_load = 0;
+    // A restarted node starts over with a full report, which is checked
+    // against what it reported before, so its stored chunks are kept
+    DataNodeId id = registry.intern(address);
+    auto [it, inserted] = datanodes.try_emplace(id);
+    DataNodeState& state = it->second;
+    if (inserted) {
+        state.id = id;
+        state.address = address;
+        placement_index.insert(PlacementKey{state.current_load, state.available_space, id});
+    }
     state.last_heartbeat = std::chrono::steady_clock::now();
+    state.report_sequence = 0;
+    setPlacement(state, available_space, 0);
     
-    datanodes[address] = state;
     std::cout << "[INFO] Registered DataNode: " << address 
               << " with " << available_space << " bytes available\n";
     return true;
 }
 
 bool Manager::updateDataNodeHeartbeat(const std::string& address,
-                                      const std::vector<std::string>& stored_chunks,
+                                      const std::vector<ChunkId>& stored_chunks,
                                       int64_t available_space,
-                                      int32_t current_load) {
+                                      int32_t current_load,
+                                      uint64_t sequence,
+                                      int64_t capacity) {
+    std::unordered_set<ChunkId> reported(stored_chunks.begin(), stored_chunks.end());
+    std::unordered_set<ChunkId> writing;  // Assigned too recently to be missed
+    DataNodeId node;
     {
         std::lock_guard<std::mutex> lock(datanodes_mutex);
+        DataNodeState& state = dataNodeForUpdate(address);
+        node = state.id;
         
-        auto it = datanodes.find(address);
-        if (it == datanodes.end()) {
-            // Auto-register unknown DataNode
-            DataNodeState state;
-            state.address = address;
-            state.available_space = available_space;
-            state.current_load = current_load;
-            state.stored_chunks = std::unordered_set<std::string>(
-                stored_chunks.begin(), stored_chunks.end());
-            state.last_heartbeat = std::chrono::steady_clock::now();
-            datanodes[address] = state;
-            std::cout << "[INFO] Auto-registered DataNode from heartbeat: " << address << "\n";
-        } else {
-            // Update existing DataNode
-            it->second.available_space = available_space;
-            it->second.current_load = current_load;
-            it->second.stored_chunks = std::unordered_set<std::string>(
-                stored_chunks.begin(), stored_chunks.end());
-            it->second.last_heartbeat = std::chrono::steady_clock::now();
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = state.assigned_chunks.begin(); it != state.assigned_chunks.end();) {
+            if (reported.count(it->first) || now - it->second > write_grace) {
+                it = state.assigned_chunks.erase(it);
+            } else {
+                writing.insert(it->first);
+                ++it;
+            }
         }
+        
+        setPlacement(state, available_space, current_load);
+        if (capacity > 0) {
+            state.capacity = capacity;
+        }
+        state.stored_chunks = reported;
+        state.last_heartbeat = now;
+        state.report_sequence = sequence;
     }
     
-    // Update chunk to DataNode mapping
+    // The report is authoritative: a replica recorded for the node but not
+    // listed is gone, whether the node lost it, never received it from its
+    // pipeline, or it was recorded before a restart
+    std::vector<ChunkId> removed;
     {
-        std::lock_guard<std::mutex> lock(chunks_mutex);
-        for (const auto& chunk_id : stored_chunks) {
-            auto& nodes = chunk_to_datanodes[chunk_id];
-            if (std::find(nodes.begin(), nodes.end(), address) == nodes.end()) {
-                nodes.push_back(address);
+        std::shared_lock<std::shared_mutex> lock(chunks_mutex);
+        auto recorded = node_chunks.find(node);
+        if (recorded != node_chunks.end()) {
+            for (ChunkId chunk_id : recorded->second) {
+                if (!reported.count(chunk_id) && !writing.count(chunk_id)) {
+                    removed.push_back(chunk_id);
+                }
             }
         }
     }
+    if (!removed.empty()) {
+        std::cout << "[INFO] Full report from " << address << " drops " << removed.size()
+                  << " replicas it doesn't hold\n";
+    }
     
+    updateReplicas(node, stored_chunks, removed);
     return true;
 }
 
-std::pair<std::string, std::vector<std::string>> Manager::allocateChunkLocation(
+bool Manager::applyChunkReport(const std::string& address,
+                               uint64_t sequence,
+                               const std::vector<ChunkId>& added,
+                               const std::vector<ChunkId>& removed,
+                               int64_t available_space,
+                               int32_t current_load,
+                               int64_t capacity) {
+    DataNodeId node;
+    {
+        std::lock_guard<std::mutex> lock(datanodes_mutex);
+        
+        // A node seen for the first time here is alive, but what it holds is
+        // unknown until its full report
+        DataNodeState& state = dataNodeForUpdate(address);
+        node = state.id;
+        setPlacement(state, available_space, current_load);
+        if (capacity > 0) {
+            state.capacity = capacity;
+        }
+        state.last_heartbeat = std::chrono::steady_clock::now();
+        
+        // A repeat is a retry of a report whose reply was lost; applying it again is harmless
+        if (state.report_sequence == 0 ||
+            (sequence != state.report_sequence + 1 && sequence != state.report_sequence)) {
+            return false;
+        }
+        
+        for (ChunkId chunk_id : added) {
+            state.stored_chunks.insert(chunk_id);
+            state.assigned_chunks.erase(chunk_id);
+        }
+        for (ChunkId chunk_id : removed) {
+            state.stored_chunks.erase(chunk_id);
+        }
+        state.report_sequence = sequence;
+    }
+    
+    updateReplicas(node, added, removed);
+    return true;
+}
+
+void Manager::updateReplicas(DataNodeId node,
+                             const std::vector<ChunkId>& added,
+                             const std::vector<ChunkId>& removed) {
+    if (added.empty() && removed.empty()) {
+        return;
+    }
+    
+    // A replica the node was told to drop stays dropped, even while it is
+    // still reported
+    std::unordered_set<ChunkId> deleting;
+    {
+        std::lock_guard<std::mutex> lock(replication_mutex);
+        auto tasks = deletion_tasks.find(node);
+        if (tasks != deletion_tasks.end()) {
+            deleting = tasks->second;
+        }
+    }
+    
+    std::unordered_set<std::string> changed_files;
+    std::vector<ChunkId> gained;  // Chunks that got a new replica
+    std::vector<ChunkId> recheck;  // Chunks whose replica count re-replication must see
+    std::vector<ChunkId> orphans;  // Chunks of deleted or rewritten files
+    auto replicaChanged = [&](ChunkId chunk_id) {
+        theCache->remove(chunk_id);  // Cached replica list is now stale
+        auto owner = chunk_to_file.find(chunk_id);
+        if (owner != chunk_to_file.end()) {
+            changed_files.insert(owner->second);
+        }
+    };
+    
+    {
+        std::lock_guard<std::shared_mutex> lock(chunks_mutex);
+        for (ChunkId chunk_id : added) {
+            // Most full reports only confirm what is already known; checking
+            // first keeps those from copying image entries into memory
+            if (hasReplica(chunk_id, node) || deleting.count(chunk_id)) {
+                continue;
+            }
+            // Every id up to the counter was issued here, so one that isn't
+            // known any more belonged to a file since deleted or rewritten.
+            // Later ids come from metadata this MetaServer doesn't have; they
+            // are tracked rather than destroyed.
+            if (!isKnownChunk(chunk_id) && chunk_id <= chunk_counter.load()) {
+                orphans.push_back(chunk_id);
+                continue;
+            }
+            replicasForUpdate(chunk_id).push_back(node);
+            node_chunks[node].insert(chunk_id);
+            replicaChanged(chunk_id);
+            gained.push_back(chunk_id);
+        }
+        
+        for (ChunkId chunk_id : removed) {
+            if (!hasReplica(chunk_id, node)) {
+                continue;
+            }
+            auto& nodes = replicasForUpdate(chunk_id);
+            nodes.erase(std::remove(nodes.begin(), nodes.end(), node), nodes.end());
+            node_chunks[node].erase(chunk_id);
+            replicaChanged(chunk_id);
+            recheck.push_back(chunk_id);
+        }
+    }
+    
+    if (theFileCache) {
+        for (const auto& filename : changed_files) {
+            theFileCache->invalidate(filename);
+        }
+    }
+    
+    // A new replica only matters to re-replication if the chunk was waiting
+    // for one; most are fresh writes
+    {
+        std::lock_guard<std::mutex> lock(replication_mutex);
+        if (!orphans.empty()) {
+            deletion_tasks[node].insert(orphans.begin(), orphans.end());
+            std::cout << "[INFO] " << orphans.size() << " orphaned chunks on " << registry.address(node)
+                      << " scheduled for deletion\n";
+        }
+        for (ChunkId chunk_id : gained) {
+            if (pending_replications.count(chunk_id) || replication_queue.contains(chunk_id)) {
+                recheck.push_back(chunk_id);
+            }
+        }
+    }
+    checkReplication(recheck);
+}
+
+std::pair<ChunkId, std::vector<std::string>> Manager::allocateChunkLocation(
     const std::string& filename,
     int32_t chunk_index,
-    int64_t chunk_size) {
+    int64_t chunk_size,
+    int64_t file_chunk_size,
+    int32_t replication_factor) {
+    
+    auto allocations = allocateChunks(filename, {{chunk_index, chunk_size}}, file_chunk_size, replication_factor);
+    if (allocations.empty()) {
+        return {NO_CHUNK, {}};
+    }
+    return {allocations[0].chunk_id, allocations[0].datanode_addresses};
+}
+
+std::vector<ChunkAllocation> Manager::allocateChunks(
+    const std::string& filename,
+    const std::vector<std::pair<int32_t, int64_t>>& chunks,
+    int64_t file_chunk_size,
+    int32_t replication_factor) {
     
-    // Generate unique chunk ID
-    std::string chunk_id = generateChunkId(filename, chunk_index);
+    std::vector<ChunkAllocation> allocations;
+    allocations.reserve(chunks.size());
     
-    // Handle empty files (chunk_size == 0)
-    std::string selected_node;
-    if (chunk_size > 0) {
-        // Select DataNode for this chunk
-        selected_node = selectDataNodeForChunk(chunk_size);
+    // Place every chunk under one hold of the DataNode lock. Each pick charges
+    // the node's load and space right away, so later chunks of the batch spread
+    // out instead of piling onto the node that looked best at the start.
+    {
+        std::lock_guard<std::mutex> lock(datanodes_mutex);
+        
+        // What the batch has charged so far, to hand back if it fails
+        std::vector<std::tuple<DataNodeState*, ChunkId, int64_t>> reserved;
         
-        if (selected_node.empty()) {
-            std::cerr << "[ERROR] No available DataNode for chunk allocation\n";
-            return {"", {}};
+        for (const auto& [chunk_index, chunk_size] : chunks) {
+            ChunkAllocation allocation;
+            allocation.chunk_id = generateChunkId();
+            allocation.chunk_index = chunk_index;
+            allocation.chunk_size = chunk_size;
+            
+            // Empty files still get metadata but don't need a DataNode
+            if (chunk_size > 0) {
+                std::vector<DataNodeState*> selected_nodes = selectDataNodesForChunk(chunk_size, replication_factor);
+                if (selected_nodes.empty()) {
+                    std::cerr << "[ERROR] No available DataNode for chunk allocation\n";
+                    
+                    // All or nothing: hand back what the batch already reserved
+                    for (auto& [node, chunk_id, size] : reserved) {
+                        node->assigned_chunks.erase(chunk_id);
+                        setPlacement(*node, node->available_space + size, node->current_load - 1);
+                    }
+                    return {};
+                }
+                
+                if (selected_nodes.size() < static_cast<size_t>(replication_factor)) {
+                    std::cerr << "[WARNING] Chunk " << allocation.chunk_id << " placed on "
+                              << selected_nodes.size() << " of " << replication_factor << " DataNodes\n";
+                }
+                
+                auto now = std::chrono::steady_clock::now();
+                for (DataNodeState* node : selected_nodes) {
+                    node->assigned_chunks[allocation.chunk_id] = now;
+                    setPlacement(*node, node->available_space - chunk_size, node->current_load + 1);
+                    reserved.emplace_back(node, allocation.chunk_id, chunk_size);
+                    allocation.datanode_addresses.push_back(node->address);
+                }
+            }
+            
+            allocations.push_back(std::move(allocation));
+        }
+    }
+    
+    uint64_t lsn = 0;
+    std::vector<std::pair<DataNodeId, ChunkId>> released;  // Replicas of replaced chunks
+    {
+        std::lock_guard<std::mutex> lock(metadata_mutex);
+        if (metadata_failed) {
+            std::cerr << "[ERROR] Metadata log failed; refusing allocation for file " << filename << "\n";
+            unchargeAllocations(allocations);
+            return {};
+        }
+        
+        auto now = std::chrono::system_clock::now();
+        applyAllocations(filename, allocations, file_chunk_size, replication_factor, now, released);
+        
+        if (metadata_log) {
+            BinaryWriter record;
+            record.putU32(RECORD_ALLOCATE);
+            record.putString(filename);
+            record.putI64(file_chunk_size);
+            record.putU32(static_cast<uint32_t>(replication_factor));
+            record.putI64(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count());
+            record.putU64(chunk_counter.load());
+            record.putU32(static_cast<uint32_t>(allocations.size()));
+            for (const auto& allocation : allocations) {
+                record.putU64(allocation.chunk_id);
+                record.putU32(static_cast<uint32_t>(allocation.chunk_index));
+                record.putI64(allocation.chunk_size);
+                record.putU32(static_cast<uint32_t>(allocation.datanode_addresses.size()));
+                for (const auto& address : allocation.datanode_addresses) {
+                    record.putString(address);
+                }
+            }
+            lsn = metadata_log->append(record.data());
+        }
+    }
+    
+    // Only now that the new layout is visible, so a lookup racing this
+    // allocation can't re-cache the old one
+    if (theFileCache) {
+        theFileCache->invalidate(filename);
+    }
+    
+    // Wait for the record outside metadata_mutex, so allocations arriving
+    // meanwhile join the next group commit instead of queueing behind this one
+    if (metadata_log && !metadata_log->sync(lsn)) {
+        std::cerr << "[ERROR] Failed to log allocation for file " << filename
+                  << "; refusing further metadata changes\n";
+        {
+            std::lock_guard<std::mutex> lock(metadata_mutex);
+            metadata_failed = true;
+        }
+        unchargeAllocations(allocations);
+        return {};
+    }
+    queueDeletions(released);
+    
+    std::vector<ChunkId> under_replicated;
+    for (const auto& allocation : allocations) {
+        if (!allocation.datanode_addresses.empty() &&
+            allocation.datanode_addresses.size() < static_cast<size_t>(replication_factor)) {
+            under_replicated.push_back(allocation.chunk_id);
+        }
+        std::cout << "[INFO] Allocated chunk " << allocation.chunk_id 
+                  << " for file " << filename 
+                  << " (index " << allocation.chunk_index << ") to DataNodes";
+        for (const auto& address : allocation.datanode_addresses) {
+            std::cout << " " << address;
         }
-    } else {
-        // For empty files, we still need to store metadata but don't need a DataNode
-        selected_node = "";  // No DataNode needed for empty chunks
+        std::cout << "\n";
     }
     
+    // Copied up to the full count once nodes with room join
+    checkReplication(under_replicated);
+    return allocations;
+}
+
+void Manager::applyAllocations(const std::string& filename,
+                               const std::vector<ChunkAllocation>& allocations,
+                               int64_t file_chunk_size,
+                               int32_t replication_factor,
+                               std::chrono::system_clock::time_point now,
+                               std::vector<std::pair<DataNodeId, ChunkId>>& released) {
+    std::vector<ChunkId> replaced;  // Chunks of an earlier write the file no longer uses
+    
     // Update file metadata
     {
         std::lock_guard<std::mutex> lock(files_mutex);
-        auto& file_meta = files[filename];
+        auto& file_meta = fileForUpdate(filename);
+        bool is_new_file = file_meta.filename.empty();
         
-        if (chunk_size > 0) {
-            // Only resize and assign chunk_id for non-empty chunks
-            if (file_meta.chunk_ids.size() <= static_cast<size_t>(chunk_index)) {
-                file_meta.chunk_ids.resize(chunk_index + 1);
+        for (const auto& allocation : allocations) {
+            // Chunk 0 starts a (re)write of the file, which replaces its
+            // contents and may pick a new chunk size and replication factor
+            if (allocation.chunk_index == 0) {
+                for (ChunkId chunk_id : file_meta.chunk_ids) {
+                    if (chunk_id != NO_CHUNK) {
+                        replaced.push_back(chunk_id);
+                    }
+                }
+                file_meta.chunk_ids.clear();
+                file_meta.total_size = 0;
+                file_meta.created_at = now;
             }
-            file_meta.chunk_ids[chunk_index] = chunk_id;
-        } else {
-            // For empty files, ensure chunk_ids is empty but file metadata exists
-            file_meta.chunk_ids.clear();
+            if (allocation.chunk_index == 0 || is_new_file) {
+                file_meta.chunk_size = file_chunk_size;
+                file_meta.replication_factor = replication_factor;
+            }
+            
+            // Empty files have no chunks, only the file metadata
+            if (allocation.chunk_size > 0) {
+                if (file_meta.chunk_ids.size() <= static_cast<size_t>(allocation.chunk_index)) {
+                    file_meta.chunk_ids.resize(allocation.chunk_index + 1);
+                }
+                ChunkId& chunk_id = file_meta.chunk_ids[allocation.chunk_index];
+                if (chunk_id != NO_CHUNK && chunk_id != allocation.chunk_id) {
+                    replaced.push_back(chunk_id);
+                }
+                chunk_id = allocation.chunk_id;
+            }
+            
+            file_meta.total_size += allocation.chunk_size;
         }
         
         file_meta.filename = filename;
-        file_meta.total_size += chunk_size;
-        
-        if (chunk_index == 0) {
-            file_meta.created_at = std::chrono::system_clock::now();
+    }
+    
+    // Reserve the chunks for their selected DataNodes
+    {
+        std::lock_guard<std::shared_mutex> lock(chunks_mutex);
+        auto replicas = forgetChunks(replaced);
+        released.insert(released.end(), replicas.begin(), replicas.end());
+        for (const auto& allocation : allocations) {
+            if (!allocation.datanode_addresses.empty()) {
+                auto& replicas = chunk_to_datanodes[allocation.chunk_id];
+                for (DataNodeId node : replicas) {
+                    node_chunks[node].erase(allocation.chunk_id);
+                }
+                replicas.clear();
+                for (const auto& address : allocation.datanode_addresses) {
+                    replicas.push_back(registry.intern(address));
+                    node_chunks[replicas.back()].insert(allocation.chunk_id);
+                }
+                chunk_to_file[allocation.chunk_id] = filename;
+            }
         }
     }
     
-    // Reserve this chunk for the selected DataNode (only for non-empty chunks)
-    if (chunk_size > 0 && !selected_node.empty()) {
-        {
-            std::lock_guard<std::mutex> lock(chunks_mutex);
-            chunk_to_datanodes[chunk_id] = {selected_node};
+    if (!replaced.empty()) {
+        releaseChunks(replaced);
+    }
+}
+
+bool Manager::applyDeletion(const std::string& filename,
+                            std::vector<std::pair<DataNodeId, ChunkId>>& released,
+                            size_t* chunk_count) {
+    std::vector<ChunkId> chunk_ids;
+    {
+        std::lock_guard<std::mutex> lock(files_mutex);
+        int64_t chunk_size = 0;
+        if (!findFile(filename, chunk_ids, chunk_size)) {
+            return false;
         }
         
-        // Update DataNode's expected load
-        {
-            std::lock_guard<std::mutex> lock(datanodes_mutex);
-            if (datanodes.find(selected_node) != datanodes.end()) {
-                datanodes[selected_node].current_load++;
-                datanodes[selected_node].available_space -= chunk_size;
+        // The image entry stays shadowed, now by the deletion instead of a copy
+        bool in_overlay = files.erase(filename) > 0;
+        if (image && !deleted_image_files.count(filename) && image->findFile(filename)) {
+            deleted_image_files.insert(filename);
+            if (!in_overlay) {
+                shadowed_image_files++;
             }
         }
     }
     
-    std::cout << "[INFO] Allocated chunk " << chunk_id 
-              << " for file " << filename 
-              << " (index " << chunk_index << ") to DataNode " << selected_node << "\n";
+    {
+        std::lock_guard<std::shared_mutex> lock(chunks_mutex);
+        auto replicas = forgetChunks(chunk_ids);
+        released.insert(released.end(), replicas.begin(), replicas.end());
+    }
+    releaseChunks(chunk_ids);
     
-    // Return appropriate values for empty vs non-empty files
-    if (chunk_size > 0) {
-        return {chunk_id, {selected_node}};
-    } else {
-        return {chunk_id, {}};  // Empty DataNode list for empty files
+    if (chunk_count) {
+        *chunk_count = static_cast<size_t>(std::count_if(chunk_ids.begin(), chunk_ids.end(),
+                                                         [](ChunkId chunk_id) { return chunk_id != NO_CHUNK; }));
     }
+    return true;
 }
 
-std::pair<bool, std::vector<ChunkLocationInfo>> Manager::getFileLocation(const std::string& filename) {
+bool Manager::deleteFile(const std::string& filename) {
+    size_t chunk_count = 0;
+    uint64_t lsn = 0;
+    std::vector<std::pair<DataNodeId, ChunkId>> released;
+    {
+        std::lock_guard<std::mutex> lock(metadata_mutex);
+        if (metadata_failed) {
+            std::cerr << "[ERROR] Metadata log failed; refusing to delete file " << filename << "\n";
+            return false;
+        }
+        if (!applyDeletion(filename, released, &chunk_count)) {
+            return false;
+        }
+        
+        if (metadata_log) {
+            BinaryWriter record;
+            record.putU32(RECORD_DELETE);
+            record.putString(filename);
+            lsn = metadata_log->append(record.data());
+        }
+    }
+    
+    if (theFileCache) {
+        theFileCache->invalidate(filename);
+    }
+    
+    if (metadata_log && !metadata_log->sync(lsn)) {
+        std::cerr << "[ERROR] Failed to log deletion of file " << filename
+                  << "; refusing further metadata changes\n";
+        std::lock_guard<std::mutex> lock(metadata_mutex);
+        metadata_failed = true;
+        return false;
+    }
+    queueDeletions(released);
+    
+    std::cout << "[INFO] Deleted file " << filename << " (" << chunk_count << " chunks)\n";
+    return true;
+}
+
+std::pair<bool, std::vector<ChunkLocationInfo>> Manager::getFileLocation(const std::string& filename,
+                                                                         int64_t* chunk_size,
+                                                                         bool* complete) {
     std::vector<ChunkLocationInfo> locations;
     
     // Check if file exists
-    std::vector<std::string> chunk_ids;
+    std::vector<ChunkId> chunk_ids;
     {
         std::lock_guard<std::mutex> lock(files_mutex);
-        auto it = files.find(filename);
-        if (it == files.end()) {
+        int64_t file_chunk_size = 0;
+        if (!findFile(filename, chunk_ids, file_chunk_size)) {
             return {false, locations};  // File not found
         }
-        chunk_ids = it->second.chunk_ids;
+        if (chunk_size) {
+            *chunk_size = file_chunk_size;
+        }
     }
     
-    // Get location for each chunk
-    for (const auto& chunk_id : chunk_ids) {
-        if (chunk_id.empty()) {
+    // Serve what we can from the cache and note the rest; hits share the
+    // cached entry, so each is copied once, into the answer
+    std::vector<std::shared_ptr<const ChunkLocationInfo>> resolved(chunk_ids.size());
+    std::vector<size_t> misses;
+    for (size_t chunk_index = 0; chunk_index < chunk_ids.size(); ++chunk_index) {
+        ChunkId chunk_id = chunk_ids[chunk_index];
+        if (chunk_id == NO_CHUNK) {
             continue;  // Skip empty chunks (sparse file)
         }
         
-        // First check cache
-        auto cached = theCache->get(chunk_id);
-        if (cached.has_value()) {
-            locations.push_back(cached.value());
-            continue;
+        resolved[chunk_index] = theCache->getShared(chunk_id);
+        if (!resolved[chunk_index]) {
+            misses.push_back(chunk_index);
         }
+    }
+    
+    if (!misses.empty()) {
+        // One liveness snapshot serves every chunk of the request
+        std::vector<bool> active_nodes = getActiveDataNodes();
         
-        // Not in cache, look up from chunk mapping
-        ChunkLocationInfo info;
-        info.chunk_id = chunk_id;
-        
+        // Copy the replica lists out under a shared lock so writers only
+        // wait for the copy, not for filtering and caching
+        std::vector<std::vector<DataNodeId>> replicas(misses.size());
         {
-            std::lock_guard<std::mutex> lock(chunks_mutex);
-            auto it = chunk_to_datanodes.find(chunk_id);
-            if (it != chunk_to_datanodes.end()) {
-                // Filter out stale DataNodes
-                std::vector<std::string> active_nodes = getActiveDataNodes();
-                for (const auto& node : it->second) {
-                    if (std::find(active_nodes.begin(), active_nodes.end(), node) != active_nodes.end()) {
-                        info.datanode_addresses.push_back(node);
-                    }
-                }
+            std::shared_lock<std::shared_mutex> lock(chunks_mutex);
+            for (size_t i = 0; i < misses.size(); ++i) {
+                findReplicas(chunk_ids[misses[i]], replicas[i]);
             }
         }
         
-        if (!info.datanode_addresses.empty()) {
-            // Add to cache for future requests
-            theCache->put(chunk_id, info);
-            locations.push_back(info);
+        for (size_t i = 0; i < misses.size(); ++i) {
+            ChunkLocationInfo info;
+            info.chunk_id = chunk_ids[misses[i]];
+            info.chunk_index = static_cast<int32_t>(misses[i]);
+            
+            // Filter out stale DataNodes
+            for (DataNodeId node : replicas[i]) {
+                if (node < active_nodes.size() && active_nodes[node]) {
+                    info.datanode_ids.push_back(node);
+                }
+            }
+            
+            if (!info.datanode_ids.empty()) {
+                // Add to cache for future requests
+                theCache->put(info.chunk_id, info);
+                resolved[misses[i]] = std::make_shared<const ChunkLocationInfo>(std::move(info));
+            }
         }
     }
     
+    locations.reserve(chunk_ids.size());
+    bool all_resolved = true;
+    for (size_t chunk_index = 0; chunk_index < resolved.size(); ++chunk_index) {
+        if (resolved[chunk_index]) {
+            locations.push_back(*resolved[chunk_index]);
+        } else if (chunk_ids[chunk_index] != NO_CHUNK) {
+            all_resolved = false;
+        }
+    }
+    if (complete) {
+        *complete = all_resolved;
+    }
+    
     return {true, locations};
 }
 
+const std::string& Manager::dataNodeAddress(DataNodeId id) const {
+    return registry.address(id);
+}
+
 void Manager::removeDataNode(const std::string& address) {
-    std::lock_guard<std::mutex> lock(datanodes_mutex);
-    datanodes.erase(address);
-    std::cout << "[INFO] Removed DataNode: " << address << "\n";
+    std::vector<ChunkId> lost_chunks;
+    {
+        std::lock_guard<std::mutex> lock(datanodes_mutex);
+        std::optional<DataNodeId> id = registry.find(address);
+        auto it = id ? datanodes.find(*id) : datanodes.end();
+        if (it != datanodes.end()) {
+            lost_chunks.assign(it->second.stored_chunks.begin(), it->second.stored_chunks.end());
+            eraseDataNode(*id);
+        }
+        if (theFileCache) {
+            theFileCache->clear();
+        }
+        std::cout << "[INFO] Removed DataNode: " << address << "\n";
+    }
+    
+    checkReplication(lost_chunks);
+}
+
+void Manager::checkReplication(const std::vector<ChunkId>& chunk_ids) {
+    if (chunk_ids.empty()) {
+        return;
+    }
+    
+    std::vector<std::vector<DataNodeId>> replicas(chunk_ids.size());
+    std::vector<std::string> owners(chunk_ids.size());
+    {
+        std::shared_lock<std::shared_mutex> lock(chunks_mutex);
+        for (size_t i = 0; i < chunk_ids.size(); ++i) {
+            findReplicas(chunk_ids[i], replicas[i]);
+            owners[i] = findOwner(chunk_ids[i]);
+        }
+    }
+    
+    // The owning file says how many copies are wanted and bounds the chunk's
+    // size; a chunk no file owns wants none
+    std::vector<int32_t> wanted(chunk_ids.size(), 0);
+    std::vector<int64_t> bytes(chunk_ids.size(), 0);
+    {
+        std::lock_guard<std::mutex> lock(files_mutex);
+        for (size_t i = 0; i < chunk_ids.size(); ++i) {
+            if (owners[i].empty()) {
+                continue;
+            }
+            auto it = files.find(owners[i]);
+            if (it != files.end()) {
+                wanted[i] = it->second.replication_factor;
+                bytes[i] = it->second.chunk_size;
+                continue;
+            }
+            std::optional<size_t> file = imageFile(owners[i]);
+            if (file) {
+                wanted[i] = image->fileReplicationFactor(*file);
+                bytes[i] = image->fileChunkSize(*file);
+            }
+        }
+    }
+    
+    // Replicas count as live while their node hasn't been removed
+    std::vector<bool> up;
+    {
+        std::lock_guard<std::mutex> lock(datanodes_mutex);
+        up.resize(registry.size());
+        for (const auto& [id, state] : datanodes) {
+            up[id] = true;
+        }
+    }
+    auto isUp = [&up](DataNodeId node) {
+        return node < up.size() && up[node];
+    };
+    
+    size_t lost = 0;
+    std::vector<std::pair<ChunkId, DataNodeId>> retired;  // Replicas moved away
+    {
+        std::lock_guard<std::mutex> lock(replication_mutex);
+        for (size_t i = 0; i < chunk_ids.size(); ++i) {
+            int32_t live = static_cast<int32_t>(std::count_if(replicas[i].begin(), replicas[i].end(), isUp));
+            
+            // A chunk with a copy under way stays out of the queue until the copy lands or fails
+            auto pending = pending_replications.find(chunk_ids[i]);
+            if (pending != pending_replications.end()) {
+                const PendingReplication& copy = pending->second;
+                bool arrived = std::find(replicas[i].begin(), replicas[i].end(), copy.target) != replicas[i].end();
+                bool needed = copy.move || live < wanted[i];
+                if (!arrived && needed && isUp(copy.source) && isUp(copy.target)) {
+                    continue;
+                }
+                if (arrived && copy.move) {
+                    // The source only lets go if that leaves the chunk fully replicated
+                    std::cout << "[INFO] Chunk " << chunk_ids[i] << " moved from " << registry.address(copy.source)
+                              << " to " << registry.address(copy.target) << "\n";
+                    if (isUp(copy.source) && live > wanted[i]) {
+                        retired.emplace_back(chunk_ids[i], copy.source);
+                        live--;
+                    }
+                } else if (arrived) {
+                    std::cout << "[INFO] Chunk " << chunk_ids[i] << " re-replicated to " << registry.address(copy.target)
+                              << " (" << live << " of " << wanted[i] << " replicas)\n";
+                }
+                finishReplication(pending);
+            }
+            
+            if (live == 0 && wanted[i] > 0) {
+                lost++;
+            }
+            replication_queue.update(chunk_ids[i], live, wanted[i], bytes[i]);
+        }
+        
+        for (const auto& [chunk_id, node] : retired) {
+            deletion_tasks[node].insert(chunk_id);
+        }
+    }
+    
+    // Readers stop being sent to a retired replica before the node deletes it
+    if (!retired.empty()) {
+        std::unordered_set<std::string> changed_files;
+        {
+            std::lock_guard<std::shared_mutex> lock(chunks_mutex);
+            for (const auto& [chunk_id, node] : retired) {
+                if (!isKnownChunk(chunk_id)) {
+                    continue;  // Its file was deleted meanwhile
+                }
+                auto& nodes = replicasForUpdate(chunk_id);
+                nodes.erase(std::remove(nodes.begin(), nodes.end(), node), nodes.end());
+                node_chunks[node].erase(chunk_id);
+                theCache->remove(chunk_id);
+                changed_files.insert(findOwner(chunk_id));
+            }
+        }
+        if (theFileCache) {
+            for (const auto& filename : changed_files) {
+                theFileCache->invalidate(filename);
+            }
+        }
+    }
+    
+    if (lost > 0) {
+        std::cerr << "[ERROR] " << lost << " chunks have no live replica left to copy from\n";
+    }
+}
+
+void Manager::finishReplication(std::unordered_map<ChunkId, PendingReplication>::iterator pending) {
+    auto streams = replication_streams.find(pending->second.source);
+    if (streams != replication_streams.end() && --streams->second <= 0) {
+        replication_streams.erase(streams);
+    }
+    pending_replications.erase(pending);
+}
+
+size_t Manager::scheduleReplication(int64_t byte_budget) {
+    // Queued chunks one round looks at; the rest wait for later rounds
+    constexpr size_t SCAN_LIMIT = 1000;
+    
+    // Copies that never completed go back in line, and the head of the line
+    // is recounted first, since nodes may have come back since it was queued
+    std::vector<ChunkId> recheck;
+    {
+        std::lock_guard<std::mutex> lock(replication_mutex);
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = pending_replications.begin(); it != pending_replications.end();) {
+            auto current = it++;
+            if (current->second.deadline <= now) {
+                std::cerr << "[WARNING] Copy of chunk " << current->first << " to "
+                          << registry.address(current->second.target) << " timed out\n";
+                recheck.push_back(current->first);
+                finishReplication(current);
+            }
+        }
+        for (const auto& chunk : replication_queue.front(SCAN_LIMIT)) {
+            recheck.push_back(chunk.chunk_id);
+        }
+    }
+    checkReplication(recheck);
+    
+    std::vector<UnderReplicatedChunk> candidates;
+    std::unordered_map<DataNodeId, int32_t> streams;
+    {
+        std::lock_guard<std::mutex> lock(replication_mutex);
+        candidates = replication_queue.front(SCAN_LIMIT);
+        streams = replication_streams;
+    }
+    if (candidates.empty()) {
+        return 0;
+    }
+    
+    std::vector<std::vector<DataNodeId>> replicas(candidates.size());
+    {
+        std::shared_lock<std::shared_mutex> lock(chunks_mutex);
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            findReplicas(candidates[i].chunk_id, replicas[i]);
+        }
+    }
+    
+    // Copy from the least loaded node that has reported the chunk to the best
+    // placed node without it. Targets are charged like allocations, so one
+    // round spreads its copies out.
+    struct Copy {
+        ChunkId chunk_id;
+        DataNodeId source;
+        DataNodeId target;
+    };
+    std::vector<Copy> copies;
+    {
+        std::lock_guard<std::mutex> lock(datanodes_mutex);
+        int64_t scheduled_bytes = 0;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            const UnderReplicatedChunk& chunk = candidates[i];
+            if (!copies.empty() && scheduled_bytes + chunk.bytes > byte_budget) {
+                break;
+            }
+            
+            DataNodeState* source = nullptr;
+            for (DataNodeId node : replicas[i]) {
+                auto it = datanodes.find(node);
+                if (it == datanodes.end() || !it->second.stored_chunks.count(chunk.chunk_id) ||
+                    streams[node] >= MAX_REPLICATION_STREAMS) {
+                    continue;
+                }
+                if (!source || it->second.current_load < source->current_load) {
+                    source = &it->second;
+                }
+            }
+            if (!source) {
+                continue;  // Every holder is busy, or none has reported the chunk yet
+            }
+            
+            std::vector<DataNodeState*> targets = selectDataNodesForChunk(chunk.bytes, 1, replicas[i]);
+            if (targets.empty()) {
+                continue;  // No node with room lacks the chunk
+            }
+            DataNodeState* target = targets[0];
+            setPlacement(*target, target->available_space - chunk.bytes, target->current_load + 1);
+            
+            streams[source->id]++;
+            scheduled_bytes += chunk.bytes;
+            copies.push_back(Copy{chunk.chunk_id, source->id, target->id});
+        }
+    }
+    
+    // The tasks go out with the sources' next heartbeats
+    size_t scheduled = 0;
+    auto deadline = std::chrono::steady_clock::now() + REPLICATION_TIMEOUT;
+    std::lock_guard<std::mutex> lock(replication_mutex);
+    for (const Copy& copy : copies) {
+        if (!replication_queue.contains(copy.chunk_id) || pending_replications.count(copy.chunk_id)) {
+            continue;  // Recounted meanwhile
+        }
+        replication_queue.remove(copy.chunk_id);
+        pending_replications.emplace(copy.chunk_id, PendingReplication{copy.source, copy.target, deadline});
+        replication_streams[copy.source]++;
+        replication_tasks[copy.source].push_back(ReplicationTask{copy.chunk_id, registry.address(copy.target)});
+        std::cout << "[INFO] Re-replicating chunk " << copy.chunk_id << " from "
+                  << registry.address(copy.source) << " to " << registry.address(copy.target) << "\n";
+        scheduled++;
+    }
+    return scheduled;
+}
+
+size_t Manager::scheduleRebalance(double band, int64_t byte_budget) {
+    // Chunks of each source one round considers moving
+    constexpr size_t SCAN_LIMIT = 256;
+    
+    std::unordered_map<DataNodeId, int32_t> streams;
+    {
+        std::lock_guard<std::mutex> lock(replication_mutex);
+        if (replication_queue.size() > 0) {
+            return 0;
+        }
+        streams = replication_streams;
+    }
+    
+    // Nodes that reported a capacity, with the chunks of those above the mean
+    struct Usage {
+        DataNodeId id;
+        int64_t used;
+        int64_t capacity;
+        std::vector<ChunkId> chunks;
+        
+        double utilization(int64_t change = 0) const {
+            return static_cast<double>(used + change) / capacity;
+        }
+    };
+    std::vector<Usage> nodes;
+    int64_t total_used = 0;
+    int64_t total_capacity = 0;
+    {
+        std::lock_guard<std::mutex> lock(datanodes_mutex);
+        for (const auto& [id, state] : datanodes) {
+            if (state.capacity > 0) {
+                nodes.push_back(Usage{id, state.capacity - state.available_space, state.capacity, {}});
+                total_used += nodes.back().used;
+                total_capacity += state.capacity;
+            }
+        }
+        if (total_capacity == 0) {
+            return 0;
+        }
+        
+        double mean = static_cast<double>(total_used) / total_capacity;
+        for (Usage& node : nodes) {
+            if (node.utilization() > mean) {
+                const auto& stored = datanodes[node.id].stored_chunks;
+                for (auto it = stored.begin(); it != stored.end() && node.chunks.size() < SCAN_LIMIT; ++it) {
+                    node.chunks.push_back(*it);
+                }
+            }
+        }
+    }
+    double mean = static_cast<double>(total_used) / total_capacity;
+    
+    bool balanced = std::all_of(nodes.begin(), nodes.end(), [&](const Usage& node) {
+        return std::abs(node.utilization() - mean) <= band;
+    });
+    if (balanced) {
+        return 0;
+    }
+    
+    // Fullest sources first, emptiest targets first
+    std::sort(nodes.begin(), nodes.end(), [](const Usage& a, const Usage& b) {
+        return a.utilization() > b.utilization();
+    });
+    
+    // Chunks already being copied or waiting for a copy stay put
+    {
+        std::lock_guard<std::mutex> lock(replication_mutex);
+        for (Usage& node : nodes) {
+            node.chunks.erase(std::remove_if(node.chunks.begin(), node.chunks.end(), [this](ChunkId chunk_id) {
+                return pending_replications.count(chunk_id) || replication_queue.contains(chunk_id);
+            }), node.chunks.end());
+        }
+    }
+    
+    // Who holds each candidate and which file it belongs to; the file's
+    // chunk size stands in for the chunk's
+    std::unordered_map<ChunkId, std::vector<DataNodeId>> replicas;
+    std::unordered_map<ChunkId, std::string> owners;
+    {
+        std::shared_lock<std::shared_mutex> lock(chunks_mutex);
+        for (const Usage& node : nodes) {
+            for (ChunkId chunk_id : node.chunks) {
+                findReplicas(chunk_id, replicas[chunk_id]);
+                owners[chunk_id] = findOwner(chunk_id);
+            }
+        }
+    }
+    std::unordered_map<std::string, int64_t> chunk_sizes;
+    {
+        std::lock_guard<std::mutex> lock(files_mutex);
+        for (const auto& [chunk_id, owner] : owners) {
+            if (owner.empty() || chunk_sizes.count(owner)) {
+                continue;
+            }
+            std::vector<ChunkId> chunk_ids;
+            int64_t chunk_size = 0;
+            if (findFile(owner, chunk_ids, chunk_size)) {
+                chunk_sizes[owner] = chunk_size;
+            }
+        }
+    }
+    
+    // Greedy plan: each move must start from a node above the mean or end at
+    // one below it by more than the band, and neither end may cross the mean
+    struct Move {
+        ChunkId chunk_id;
+        DataNodeId source;
+        DataNodeId target;
+        int64_t bytes;
+    };
+    std::vector<Move> moves;
+    int64_t planned_bytes = 0;
+    for (Usage& source : nodes) {
+        for (ChunkId chunk_id : source.chunks) {
+            auto size = chunk_sizes.find(owners[chunk_id]);
+            const std::vector<DataNodeId>& holders = replicas[chunk_id];
+            if (size == chunk_sizes.end() ||
+                std::find(holders.begin(), holders.end(), source.id) == holders.end()) {
+                continue;  // Orphaned, or no longer a replica here
+            }
+            int64_t bytes = size->second;
+            if (source.utilization(-bytes) < mean || streams[source.id] >= MAX_REPLICATION_STREAMS) {
+                break;
+            }
+            if (!moves.empty() && planned_bytes + bytes > byte_budget) {
+                break;
+            }
+            
+            Usage* target = nullptr;
+            for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+                bool needed = source.utilization() - mean > band || mean - it->utilization() > band;
+                if (needed && it->utilization(bytes) <= mean &&
+                    std::find(holders.begin(), holders.end(), it->id) == holders.end()) {
+                    target = &*it;
+                    break;
+                }
+            }
+            if (!target) {
+                continue;
+            }
+            
+            source.used -= bytes;
+            target->used += bytes;
+            streams[source.id]++;
+            planned_bytes += bytes;
+            moves.push_back(Move{chunk_id, source.id, target->id, bytes});
+        }
+    }
+    if (moves.empty()) {
+        return 0;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(datanodes_mutex);
+        for (const Move& move : moves) {
+            auto target = datanodes.find(move.target);
+            if (target != datanodes.end()) {
+                setPlacement(target->second, target->second.available_space - move.bytes,
+                             target->second.current_load + 1);
+            }
+        }
+    }
+    
+    // Like re-replication copies, moves go out with the sources' next heartbeats
+    size_t scheduled = 0;
+    auto deadline = std::chrono::steady_clock::now() + REPLICATION_TIMEOUT;
+    std::lock_guard<std::mutex> lock(replication_mutex);
+    for (const Move& move : moves) {
+        if (pending_replications.count(move.chunk_id) || replication_queue.contains(move.chunk_id)) {
+            continue;
+        }
+        pending_replications.emplace(move.chunk_id, PendingReplication{move.source, move.target, deadline, true});
+        replication_streams[move.source]++;
+        replication_tasks[move.source].push_back(ReplicationTask{move.chunk_id, registry.address(move.target)});
+        std::cout << "[INFO] Moving chunk " << move.chunk_id << " from " << registry.address(move.source)
+                  << " to " << registry.address(move.target) << " to rebalance\n";
+        scheduled++;
+    }
+    return scheduled;
+}
+
+std::vector<ReplicationTask> Manager::takeReplicationTasks(const std::string& address) {
+    std::optional<DataNodeId> id = registry.find(address);
+    if (!id) {
+        return {};
+    }
+    
+    std::lock_guard<std::mutex> lock(replication_mutex);
+    auto it = replication_tasks.find(*id);
+    if (it == replication_tasks.end()) {
+        return {};
+    }
+    std::vector<ReplicationTask> tasks = std::move(it->second);
+    replication_tasks.erase(it);
+    return tasks;
+}
+
+std::vector<ChunkId> Manager::takeDeletionTasks(const std::string& address) {
+    std::optional<DataNodeId> id = registry.find(address);
+    if (!id) {
+        return {};
+    }
+    
+    std::lock_guard<std::mutex> lock(replication_mutex);
+    auto it = deletion_tasks.find(*id);
+    if (it == deletion_tasks.end()) {
+        return {};
+    }
+    std::vector<ChunkId> chunk_ids;
+    auto& pending = it->second;
+    while (!pending.empty() && chunk_ids.size() < MAX_DELETIONS_PER_HEARTBEAT) {
+        chunk_ids.push_back(*pending.begin());
+        pending.erase(pending.begin());
+    }
+    if (pending.empty()) {
+        deletion_tasks.erase(it);
+    }
+    return chunk_ids;
+}
+
+size_t Manager::getUnderReplicatedCount() const {
+    std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(replication_mutex));
+    return replication_queue.size() + pending_replications.size();
 }
 
 size_t Manager::getDataNodeCount() const {
@@ -283,5 +1676,5 @@ size_t Manager::getDataNodeCount() const {
 
 size_t Manager::getFileCount() const {
     std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(files_mutex));
-    return files.size();
+    return files.size() + (image ? image->fileCount() - shadowed_image_files : 0);
 }
\ No newline at end of file
@@ -1,74 +1,349 @@
 #pragma once
 
 #include "cache.hpp"
+#include "chunk_id.hpp"
+#include "datanode_registry.hpp"
+#include "metadata_image.hpp"
+#include "metadata_log.hpp"
+#include "replication_queue.hpp"
 #include <unordered_map>
 #include <unordered_set>
+#include <set>
 #include <vector>
 #include <string>
 #include <mutex>
+#include <shared_mutex>
 #include <chrono>
 #include <atomic>
+#include <functional>
+#include <memory>
+
+// Chunk size for files whose creator didn't pick one
+constexpr int64_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+
+// DataNodes per chunk for files whose creator didn't pick a number, and the
+// most a file may ask for
+constexpr int32_t DEFAULT_REPLICATION_FACTOR = 3;
+constexpr int32_t MAX_REPLICATION_FACTOR = 16;
+
+// Re-replication: copies one DataNode may be asked to send at a time (each
+// DataNode runs as many copy workers, REPLICATION_WORKERS), and how long a
+// copy may take, from being scheduled to the target reporting the chunk,
+// before it is given up and scheduled again
+constexpr int32_t MAX_REPLICATION_STREAMS = 2;
+constexpr auto REPLICATION_TIMEOUT = std::chrono::seconds(60);
+
+// A DataNode silent this long is presumed dead, and one restored from
+// metadata that hasn't registered this long after a restart
+constexpr auto DATANODE_TIMEOUT = std::chrono::seconds(60);
+
+// How long a replica assigned at allocation may go unreported before a full
+// report without it drops it; until then its write may still be under way
+constexpr auto WRITE_REPORT_GRACE = std::chrono::seconds(60);
+
+// Most chunks one heartbeat response asks a DataNode to delete; the rest
+// wait for its next heartbeat
+constexpr size_t MAX_DELETIONS_PER_HEARTBEAT = 500;
 
 struct DataNodeState {
+    DataNodeId id = NO_DATANODE;
     std::string address;
-    int64_t available_space;
-    int32_t current_load;
-    std::unordered_set<std::string> stored_chunks;
+    int64_t available_space = 0;
+    int64_t capacity = 0;  // Total bytes; 0 until the node reports it
+    int32_t current_load = 0;
+    std::unordered_set<ChunkId> stored_chunks;
+    // Chunks allocated here since its last report, and when
+    std::unordered_map<ChunkId, std::chrono::steady_clock::time_point> assigned_chunks;
     std::chrono::steady_clock::time_point last_heartbeat;
+    uint64_t report_sequence = 0;  // Last chunk report applied; deltas must follow it
+};
+
+// A DataNode's position in placement order: least loaded first, then most
+// free space
+struct PlacementKey {
+    int32_t load;
+    int64_t space;
+    DataNodeId id;
+    
+    bool operator<(const PlacementKey& other) const {
+        if (load != other.load) {
+            return load < other.load;
+        }
+        if (space != other.space) {
+            return space > other.space;
+        }
+        return id < other.id;
+    }
 };
 
 struct FileMetadata {
     std::string filename;
-    std::vector<std::string> chunk_ids;  // Ordered list of chunks for this file
+    std::vector<ChunkId> chunk_ids;  // Ordered list of chunks for this file; NO_CHUNK where sparse
     int64_t total_size;
+    int64_t chunk_size = DEFAULT_CHUNK_SIZE;  // Bytes per chunk, chosen when the file is written
+    int32_t replication_factor = DEFAULT_REPLICATION_FACTOR;  // Replicas wanted per chunk, likewise
     std::chrono::system_clock::time_point created_at;
 };
 
+// An order for a DataNode to send one of its chunks to another
+struct ReplicationTask {
+    ChunkId chunk_id;
+    std::string target_address;
+};
+
+struct ChunkAllocation {
+    ChunkId chunk_id = NO_CHUNK;
+    int32_t chunk_index;
+    int64_t chunk_size;
+    std::vector<std::string> datanode_addresses;  // Distinct; empty for 0-byte chunks
+};
+
 class Manager {
 private:
     Cache* theCache;
+    FileLocationCache* theFileCache;  // Optional; invalidated here, filled by the RPC layer
+    std::chrono::milliseconds write_grace;
     
-    // DataNode management
+    // DataNode management. Every address ever seen has an id in the
+    // registry; datanodes only holds the nodes currently known to be up.
+    DataNodeRegistry registry;
     std::mutex datanodes_mutex;
-    std::unordered_map<std::string, DataNodeState> datanodes;  // address -> state
+    std::unordered_map<DataNodeId, DataNodeState> datanodes;  // id -> state
+    std::set<PlacementKey> placement_index;  // Every node in datanodes, best placement first
+    // When to look for replicas on nodes that never came back after a restart
+    std::optional<std::chrono::steady_clock::time_point> replica_recheck_at;
     
     // File metadata management
     std::mutex files_mutex;
     std::unordered_map<std::string, FileMetadata> files;  // filename -> metadata
     
     // Chunk to DataNode mapping
-    std::mutex chunks_mutex;
-    std::unordered_map<std::string, std::vector<std::string>> chunk_to_datanodes;  // chunk_id -> datanode addresses
+    std::shared_mutex chunks_mutex;  // Shared for lookups, exclusive for updates
+    std::unordered_map<ChunkId, std::vector<DataNodeId>> chunk_to_datanodes;  // chunk_id -> replicas
+    std::unordered_map<ChunkId, std::string> chunk_to_file;  // chunk_id -> owning filename
+    // node -> chunks with a replica recorded on it, image included, so a
+    // full report is checked against the node's own replicas only
+    std::unordered_map<DataNodeId, std::unordered_set<ChunkId>> node_chunks;
     
-    // Chunk ID generation
+    // Chunk ID generation: the last id handed out
     std::atomic<uint64_t> chunk_counter{0};
     
+    // Persistence (optional): allocations are logged and periodically
+    // checkpointed to metadata_directory. metadata_mutex orders applying an
+    // allocation with appending its log record, so a checkpoint taken under
+    // it splits the log exactly between what it contains and what it doesn't.
+    std::string metadata_directory;
+    std::unique_ptr<MetadataLog> metadata_log;
+    std::mutex metadata_mutex;
+    // Set once a record fails to reach disk. What the log lost may already
+    // be applied in memory, so no further change is accepted; a restart
+    // recovers what was made durable.
+    bool metadata_failed = false;
+    
+    // The image mapped at startup. The maps above only hold what changed
+    // since; a file or chunk is copied out of the image the first time it
+    // changes and shadows it from then on. Lookups check the maps first.
+    std::unique_ptr<MetadataImage> image;
+    size_t shadowed_image_files = 0;  // Image files in `files` or deleted
+    // Image entries deleted since; guarded by files_mutex and chunks_mutex
+    std::unordered_set<std::string> deleted_image_files;
+    std::unordered_set<ChunkId> deleted_image_chunks;
+    std::vector<DataNodeId> image_nodes;  // Image address index -> registry id
+    
+    // Re-replication. Chunks short of live replicas wait in replication_queue
+    // until scheduleReplication() picks a node to copy from and one to copy
+    // to; the task then waits for the source's next heartbeat, and the chunk
+    // stays pending until the target reports it or the copy times out.
+    // A rebalancing move is a copy whose source gives up its replica once
+    // the target has the chunk.
+    struct PendingReplication {
+        DataNodeId source;
+        DataNodeId target;
+        std::chrono::steady_clock::time_point deadline;
+        bool move = false;
+    };
+    std::mutex replication_mutex;
+    ReplicationQueue replication_queue;
+    std::unordered_map<ChunkId, PendingReplication> pending_replications;
+    std::unordered_map<DataNodeId, int32_t> replication_streams;  // Pending copies per source
+    std::unordered_map<DataNodeId, std::vector<ReplicationTask>> replication_tasks;  // Not yet sent, per source
+    std::unordered_map<DataNodeId, std::unordered_set<ChunkId>> deletion_tasks;  // Replicas to drop, not yet sent
+    
     // Helper methods
-    std::string generateChunkId(const std::string& filename, int chunk_index);
-    std::string selectDataNodeForChunk(int64_t chunk_size);
-    std::vector<std::string> getActiveDataNodes();
-    void cleanupStaleDataNodes();
+    ChunkId generateChunkId();
+    // Up to count distinct nodes with room, best first, other than those in
+    // exclude; datanodes_mutex must be held
+    std::vector<DataNodeState*> selectDataNodesForChunk(int64_t chunk_size, int32_t count,
+                                                        const std::vector<DataNodeId>& exclude = {});
+    std::vector<bool> getActiveDataNodes();  // Indexed by DataNodeId
+    
+    // Keep placement_index in step with datanodes; datanodes_mutex must be held
+    DataNodeState& dataNodeForUpdate(const std::string& address);
+    void setPlacement(DataNodeState& state, int64_t available_space, int32_t current_load);
+    void eraseDataNode(DataNodeId id);
+    // Hand back the space, load and write assignments allocations charged to their nodes
+    void unchargeAllocations(const std::vector<ChunkAllocation>& allocations);
+    
+    // Record allocated chunks in the file and chunk tables; shared by live
+    // allocations and log replay. Chunks the allocations replace are
+    // released, and their replicas added to released for queueDeletions()
+    // once the change is durable.
+    void applyAllocations(const std::string& filename,
+                          const std::vector<ChunkAllocation>& allocations,
+                          int64_t file_chunk_size,
+                          int32_t replication_factor,
+                          std::chrono::system_clock::time_point now,
+                          std::vector<std::pair<DataNodeId, ChunkId>>& released);
+    // Remove a file and release its chunks, likewise; false if there is no
+    // such file. Shared by live deletions and log replay.
+    bool applyDeletion(const std::string& filename,
+                       std::vector<std::pair<DataNodeId, ChunkId>>& released,
+                       size_t* chunk_count = nullptr);
+    void replayRecord(const std::string& payload);
+    
+    // Overlay-then-image access; files_mutex or chunks_mutex must be held,
+    // exclusively for the ForUpdate variants
+    FileMetadata& fileForUpdate(const std::string& filename);
+    bool findFile(const std::string& filename, std::vector<ChunkId>& chunk_ids, int64_t& chunk_size);
+    std::vector<DataNodeId>& replicasForUpdate(ChunkId chunk_id);
+    DataNodeId imageReplica(size_t chunk, size_t position) const;  // NO_DATANODE if damaged
+    // Index of the entry in the image, unless there is none or it was deleted
+    std::optional<size_t> imageFile(const std::string& filename) const;
+    std::optional<size_t> imageChunk(ChunkId chunk_id) const;
+    
+    // Add or drop node as a replica of the given chunks
+    void updateReplicas(DataNodeId node,
+                        const std::vector<ChunkId>& added,
+                        const std::vector<ChunkId>& removed);
+    bool hasReplica(ChunkId chunk_id, DataNodeId node) const;
+    bool findReplicas(ChunkId chunk_id, std::vector<DataNodeId>& replicas) const;
+    std::string findOwner(ChunkId chunk_id) const;  // Empty if unknown
+    bool isKnownChunk(ChunkId chunk_id) const;
+    // Every chunk with its replicas, overlay and image alike; chunks_mutex
+    // must be held. Walks the whole table, so keep it off frequent paths.
+    void forEachChunk(const std::function<void(ChunkId, const std::vector<DataNodeId>&)>& visit) const;
+    
+    // Drop the chunks from the chunk tables and return their replicas as
+    // (node, chunk) pairs; chunks_mutex must be held exclusively
+    std::vector<std::pair<DataNodeId, ChunkId>> forgetChunks(const std::vector<ChunkId>& chunk_ids);
+    // Stop caching and copying forgotten chunks; call with no lock but
+    // metadata_mutex held
+    void releaseChunks(const std::vector<ChunkId>& chunk_ids);
+    // Have the (node, chunk) replicas deleted. Only once the change that
+    // released them is durable: a crash before that brings the chunks back.
+    void queueDeletions(const std::vector<std::pair<DataNodeId, ChunkId>>& replicas);
+    
+    // Recount the live replicas of the given chunks and queue or drop them
+    // for re-replication; call with no other lock held
+    void checkReplication(const std::vector<ChunkId>& chunk_ids);
+    // Forget a pending copy; replication_mutex must be held
+    void finishReplication(std::unordered_map<ChunkId, PendingReplication>::iterator pending);
     
 public: 
-    Manager(Cache* aCache);
+    Manager(Cache* aCache, FileLocationCache* aFileCache = nullptr,
+            std::chrono::milliseconds aWriteGrace = WRITE_REPORT_GRACE);
+    
+    // Load the last checkpoint and replay the log from directory, then log
+    // every further allocation there. Without this, metadata is memory-only.
+    bool openMetadata(const std::string& directory);
+    
+    // Write the namespace to a new image and drop the log segments it covers.
+    // Allocations only wait for the log roll and a copy of what changed since
+    // the last image, not for the merge or the write.
+    bool checkpoint();
     
-    // DataNode management
+    // DataNode management. A capacity of 0 in a report leaves the one known alone.
     bool registerDataNode(const std::string& address, int64_t available_space);
+    // Full report: stored_chunks is every chunk the node holds. Any other
+    // replica recorded for it is dropped, unless it was assigned within the
+    // write grace period and may not have been written yet.
     bool updateDataNodeHeartbeat(const std::string& address, 
-                                  const std::vector<std::string>& stored_chunks,
+                                  const std::vector<ChunkId>& stored_chunks,
                                   int64_t available_space,
-                                  int32_t current_load);
+                                  int32_t current_load,
+                                  uint64_t sequence = 0,
+                                  int64_t capacity = 0);
     
-    // File operations
-    std::pair<std::string, std::vector<std::string>> allocateChunkLocation(
+    // Delta report: the chunks added and removed since the node's previous
+    // report. Returns false, without touching the chunk map, unless it
+    // directly follows (or repeats) the last report applied for the node;
+    // the node must then send a full report.
+    bool applyChunkReport(const std::string& address,
+                          uint64_t sequence,
+                          const std::vector<ChunkId>& added,
+                          const std::vector<ChunkId>& removed,
+                          int64_t available_space,
+                          int32_t current_load,
+                          int64_t capacity = 0);
+    
+    // File operations. Each chunk goes to replication_factor distinct
+    // DataNodes, or to as many as have room if that's fewer; the chunk is then
+    // under-replicated but still written.
+    // NO_CHUNK if the chunk can't be placed
+    std::pair<ChunkId, std::vector<std::string>> allocateChunkLocation(
         const std::string& filename, 
         int32_t chunk_index, 
-        int64_t chunk_size);
+        int64_t chunk_size,
+        int64_t file_chunk_size = DEFAULT_CHUNK_SIZE,
+        int32_t replication_factor = DEFAULT_REPLICATION_FACTOR);
+    
+    // Allocate many (chunk_index, chunk_size) pairs of one file at once.
+    // All or nothing: returns an empty vector if any chunk can't be placed,
+    // or if the allocation can't be logged.
+    std::vector<ChunkAllocation> allocateChunks(
+        const std::string& filename,
+        const std::vector<std::pair<int32_t, int64_t>>& chunks,
+        int64_t file_chunk_size = DEFAULT_CHUNK_SIZE,
+        int32_t replication_factor = DEFAULT_REPLICATION_FACTOR);
+    
+    // Remove the file from the namespace. Its chunks are forgotten at once
+    // and deleted from their DataNodes through later heartbeat responses.
+    // False if there is no such file or the deletion couldn't be logged.
+    bool deleteFile(const std::string& filename);
+    
+    // chunk_size, if given, receives the file's chunk size; complete, if
+    // given, whether every chunk had a live replica to report
+    std::pair<bool, std::vector<ChunkLocationInfo>> getFileLocation(const std::string& filename,
+                                                                    int64_t* chunk_size = nullptr,
+                                                                    bool* complete = nullptr);
     
-    std::pair<bool, std::vector<ChunkLocationInfo>> getFileLocation(const std::string& filename);
+    // Address of a DataNode id handed out in a ChunkLocationInfo
+    const std::string& dataNodeAddress(DataNodeId id) const;
     
     // Utility
     void removeDataNode(const std::string& address);
+    // Forget nodes that stopped heartbeating; run periodically, off the allocation path.
+    // The first sweep DATANODE_TIMEOUT after openMetadata also runs recheckReplicas().
+    void removeStaleDataNodes();
+    // Queue every chunk with a replica on a node that isn't up. Removing a
+    // node queues the chunks it reported; this catches the replicas of nodes
+    // that were only known from metadata and never registered.
+    void recheckReplicas();
+    
+    // Re-replication. Schedule copies of the chunks with the fewest live
+    // replicas, up to byte_budget bytes of them (but always at least one
+    // chunk), and return how many were scheduled. Run periodically; copies
+    // that don't complete are scheduled again.
+    size_t scheduleReplication(int64_t byte_budget);
+    // Copies the node should start, each handed out once, with its heartbeat response
+    std::vector<ReplicationTask> takeReplicationTasks(const std::string& address);
+    // Chunks the node should delete, likewise, at most
+    // MAX_DELETIONS_PER_HEARTBEAT at a time. Besides the replicas of deleted
+    // files and moved chunks, these include orphans: chunks a node reports
+    // that were issued here but that no file owns any more.
+    std::vector<ChunkId> takeDeletionTasks(const std::string& address);
+    
+    // Rebalancing. Utilization is a node's used share of its capacity, and
+    // the cluster's is total used over total capacity. While some node is
+    // more than band (a fraction, e.g. 0.1) away from the cluster's, schedule
+    // moves from nodes above it to nodes below it, without taking either
+    // across it, up to byte_budget bytes (but always at least one chunk).
+    // Re-replication goes first: nothing moves while chunks are short of
+    // replicas. Returns how many moves were scheduled.
+    size_t scheduleRebalance(double band, int64_t byte_budget);
+    // Chunks waiting for a copy or with one in progress
+    size_t getUnderReplicatedCount() const;
+    
     size_t getDataNodeCount() const;
     size_t getFileCount() const;
 };
@@ -0,0 +1,317 @@
+#include "metadata_image.hpp"
+#include "metadata_log.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace metadata_image;
+
+// Records are read in place, so their layout is the file format
+static_assert(sizeof(StringRef) == 16, "StringRef layout changed");
+static_assert(sizeof(ImageHeader) == 136, "ImageHeader layout changed");
+static_assert(sizeof(FileRecord) == 56, "FileRecord layout changed");
+static_assert(sizeof(ChunkRecord) == 32, "ChunkRecord layout changed");
+
+static uint64_t alignUp(uint64_t value) {
+    return (value + 7) & ~uint64_t{7};
+}
+
+static uint32_t headerCrc(const ImageHeader& header) {
+    return crc32(reinterpret_cast<const char*>(&header), offsetof(ImageHeader, header_crc));
+}
+
+// True if count records of record_size starting at offset fit in the image
+static bool sectionFits(uint64_t offset, uint64_t count, uint64_t record_size, uint64_t image_size) {
+    return offset % 8 == 0 && offset <= image_size &&
+           count <= (image_size - offset) / record_size;
+}
+
+MetadataImage::~MetadataImage() {
+    if (base) {
+        ::munmap(const_cast<char*>(base), mapped_size);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+std::unique_ptr<MetadataImage> MetadataImage::open(const std::string& path) {
+    std::unique_ptr<MetadataImage> image(new MetadataImage());
+
+    image->fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (image->fd < 0 || ::fstat(image->fd, &info) != 0 ||
+        static_cast<size_t>(info.st_size) < sizeof(ImageHeader)) {
+        return nullptr;
+    }
+
+    image->mapped_size = info.st_size;
+    void* mapping = ::mmap(nullptr, image->mapped_size, PROT_READ, MAP_SHARED, image->fd, 0);
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+    image->base = static_cast<const char*>(mapping);
+    image->header = reinterpret_cast<const ImageHeader*>(image->base);
+
+    const ImageHeader& header = *image->header;
+    if (header.magic != MAGIC || header.version != VERSION || header.header_crc != headerCrc(header) ||
+        header.image_size != image->mapped_size) {
+        return nullptr;
+    }
+
+    // Bounds-check every table once so lookups can index them directly
+    uint64_t size = header.image_size;
+    if (!sectionFits(header.files_offset, header.file_count, sizeof(FileRecord), size) ||
+        !sectionFits(header.file_chunks_offset, header.file_chunk_count, sizeof(ChunkId), size) ||
+        !sectionFits(header.chunks_offset, header.chunk_count, sizeof(ChunkRecord), size) ||
+        !sectionFits(header.replicas_offset, header.replica_count, sizeof(uint32_t), size) ||
+        !sectionFits(header.addresses_offset, header.address_count, sizeof(StringRef), size) ||
+        !sectionFits(header.strings_offset, header.strings_size, 1, size)) {
+        return nullptr;
+    }
+
+    return image;
+}
+
+std::string_view MetadataImage::str(const StringRef& ref) const {
+    if (ref.offset > header->strings_size || ref.size > header->strings_size - ref.offset) {
+        return {};
+    }
+    return std::string_view(base + header->strings_offset + ref.offset, ref.size);
+}
+
+const FileRecord& MetadataImage::fileRecord(size_t index) const {
+    return reinterpret_cast<const FileRecord*>(base + header->files_offset)[index];
+}
+
+const ChunkRecord& MetadataImage::chunkRecord(size_t index) const {
+    return reinterpret_cast<const ChunkRecord*>(base + header->chunks_offset)[index];
+}
+
+std::optional<size_t> MetadataImage::findFile(std::string_view filename) const {
+    size_t low = 0;
+    size_t high = header->file_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = str(fileRecord(middle).filename).compare(filename);
+        if (order == 0) {
+            return middle;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string_view MetadataImage::fileName(size_t file) const {
+    return str(fileRecord(file).filename);
+}
+
+int64_t MetadataImage::fileTotalSize(size_t file) const {
+    return fileRecord(file).total_size;
+}
+
+int64_t MetadataImage::fileChunkSize(size_t file) const {
+    return fileRecord(file).chunk_size;
+}
+
+int64_t MetadataImage::fileCreatedAtMs(size_t file) const {
+    return fileRecord(file).created_at_ms;
+}
+
+int32_t MetadataImage::fileReplicationFactor(size_t file) const {
+    // Files were stored once before the factor was recorded
+    uint32_t replication_factor = fileRecord(file).replication_factor;
+    return replication_factor > 0 ? static_cast<int32_t>(replication_factor) : 1;
+}
+
+size_t MetadataImage::fileChunkCount(size_t file) const {
+    return fileRecord(file).chunk_count;
+}
+
+ChunkId MetadataImage::fileChunkId(size_t file, size_t position) const {
+    const FileRecord& record = fileRecord(file);
+    if (position >= record.chunk_count || position >= header->file_chunk_count ||
+        record.first_chunk > header->file_chunk_count - position - 1) {
+        return NO_CHUNK;
+    }
+    return reinterpret_cast<const ChunkId*>(base + header->file_chunks_offset)[record.first_chunk + position];
+}
+
+std::optional<size_t> MetadataImage::findChunk(ChunkId chunk_id) const {
+    size_t low = 0;
+    size_t high = header->chunk_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        ChunkId middle_id = chunkRecord(middle).chunk_id;
+        if (middle_id == chunk_id) {
+            return middle;
+        }
+        if (middle_id < chunk_id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return std::nullopt;
+}
+
+ChunkId MetadataImage::chunkId(size_t chunk) const {
+    return chunkRecord(chunk).chunk_id;
+}
+
+std::string_view MetadataImage::chunkOwner(size_t chunk) const {
+    uint64_t owner = chunkRecord(chunk).owner_file;
+    if (owner >= header->file_count) {
+        return {};
+    }
+    return fileName(owner);
+}
+
+size_t MetadataImage::chunkReplicaCount(size_t chunk) const {
+    return chunkRecord(chunk).replica_count;
+}
+
+std::string_view MetadataImage::chunkReplica(size_t chunk, size_t position) const {
+    return address(chunkReplicaAddress(chunk, position));
+}
+
+size_t MetadataImage::chunkReplicaAddress(size_t chunk, size_t position) const {
+    const ChunkRecord& record = chunkRecord(chunk);
+    if (position >= record.replica_count || position >= header->replica_count ||
+        record.first_replica > header->replica_count - position - 1) {
+        return addressCount();
+    }
+    uint32_t address = reinterpret_cast<const uint32_t*>(base + header->replicas_offset)[record.first_replica + position];
+    return address < header->address_count ? address : addressCount();
+}
+
+size_t MetadataImage::addressCount() const {
+    return header->address_count;
+}
+
+std::string_view MetadataImage::address(size_t index) const {
+    if (index >= header->address_count) {
+        return {};
+    }
+    return str(reinterpret_cast<const StringRef*>(base + header->addresses_offset)[index]);
+}
+
+void MetadataImageBuilder::addFile(std::string_view filename, int64_t total_size, int64_t chunk_size,
+                                   int64_t created_at_ms, int32_t replication_factor,
+                                   std::vector<ChunkId> chunk_ids) {
+    files.push_back({filename, total_size, chunk_size, created_at_ms, replication_factor, std::move(chunk_ids)});
+}
+
+void MetadataImageBuilder::addChunk(ChunkId chunk_id, std::string_view owner,
+                                    std::vector<std::string_view> replicas) {
+    chunks.push_back({chunk_id, owner, std::move(replicas)});
+}
+
+std::string MetadataImageBuilder::build(uint64_t next_segment, uint64_t chunk_counter) {
+    std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.filename < b.filename; });
+    std::sort(chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b) { return a.chunk_id < b.chunk_id; });
+
+    std::string strings;
+    auto addString = [&strings](std::string_view value) {
+        StringRef ref{strings.size(), static_cast<uint32_t>(value.size()), 0};
+        strings.append(value);
+        return ref;
+    };
+
+    std::vector<FileRecord> file_records;
+    std::vector<ChunkId> file_chunks;
+    file_records.reserve(files.size());
+    for (const auto& file : files) {
+        FileRecord record{};
+        record.filename = addString(file.filename);
+        record.first_chunk = file_chunks.size();
+        record.chunk_count = static_cast<uint32_t>(file.chunk_ids.size());
+        record.replication_factor = static_cast<uint32_t>(file.replication_factor);
+        record.total_size = file.total_size;
+        record.chunk_size = file.chunk_size;
+        record.created_at_ms = file.created_at_ms;
+        file_records.push_back(record);
+
+        file_chunks.insert(file_chunks.end(), file.chunk_ids.begin(), file.chunk_ids.end());
+    }
+
+    // A handful of DataNodes hold every replica, so each address is stored once
+    std::unordered_map<std::string_view, uint32_t> address_index;
+    std::vector<StringRef> addresses;
+    std::vector<ChunkRecord> chunk_records;
+    std::vector<uint32_t> replicas;
+    chunk_records.reserve(chunks.size());
+    for (const auto& chunk : chunks) {
+        ChunkRecord record{};
+        record.chunk_id = chunk.chunk_id;
+        record.first_replica = replicas.size();
+        record.replica_count = static_cast<uint32_t>(chunk.replicas.size());
+
+        auto owner = std::lower_bound(files.begin(), files.end(), chunk.owner,
+                                      [](const File& file, std::string_view name) { return file.filename < name; });
+        record.owner_file = (!chunk.owner.empty() && owner != files.end() && owner->filename == chunk.owner)
+                                ? static_cast<uint64_t>(owner - files.begin())
+                                : NO_FILE;
+        chunk_records.push_back(record);
+
+        for (const auto& replica : chunk.replicas) {
+            auto [it, inserted] = address_index.emplace(replica, static_cast<uint32_t>(addresses.size()));
+            if (inserted) {
+                addresses.push_back(addString(replica));
+            }
+            replicas.push_back(it->second);
+        }
+    }
+
+    ImageHeader header{};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.next_segment = next_segment;
+    header.chunk_counter = chunk_counter;
+
+    uint64_t offset = sizeof(ImageHeader);
+    auto place = [&offset](uint64_t count, uint64_t record_size, uint64_t& section_offset) {
+        section_offset = offset;
+        offset = alignUp(offset + count * record_size);
+    };
+
+    header.file_count = file_records.size();
+    place(header.file_count, sizeof(FileRecord), header.files_offset);
+    header.file_chunk_count = file_chunks.size();
+    place(header.file_chunk_count, sizeof(ChunkId), header.file_chunks_offset);
+    header.chunk_count = chunk_records.size();
+    place(header.chunk_count, sizeof(ChunkRecord), header.chunks_offset);
+    header.replica_count = replicas.size();
+    place(header.replica_count, sizeof(uint32_t), header.replicas_offset);
+    header.address_count = addresses.size();
+    place(header.address_count, sizeof(StringRef), header.addresses_offset);
+    header.strings_size = strings.size();
+    place(header.strings_size, 1, header.strings_offset);
+    header.image_size = offset;
+    header.header_crc = headerCrc(header);
+
+    std::string image(header.image_size, '\0');
+    auto copySection = [&image](uint64_t section_offset, const void* data, size_t size) {
+        if (size > 0) {
+            std::memcpy(&image[section_offset], data, size);
+        }
+    };
+    copySection(0, &header, sizeof(header));
+    copySection(header.files_offset, file_records.data(), file_records.size() * sizeof(FileRecord));
+    copySection(header.file_chunks_offset, file_chunks.data(), file_chunks.size() * sizeof(ChunkId));
+    copySection(header.chunks_offset, chunk_records.data(), chunk_records.size() * sizeof(ChunkRecord));
+    copySection(header.replicas_offset, replicas.data(), replicas.size() * sizeof(uint32_t));
+    copySection(header.addresses_offset, addresses.data(), addresses.size() * sizeof(StringRef));
+    copySection(header.strings_offset, strings.data(), strings.size());
+    return image;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "chunk_id.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <cstdint>
+
+// Flat, memory-mappable snapshot of the MetaServer's file and chunk tables.
+// Every table is an array of fixed-size records sorted by key, with strings
+// kept in one pool, so lookups binary-search the mapping directly and opening
+// an image costs the same no matter how many chunks it holds. Nothing is
+// parsed up front; pages are faulted in as lookups touch them.
+//
+// Layout, all offsets from the start of the file and 8-byte aligned:
+//   ImageHeader
+//   FileRecord[file_count]          sorted by filename
+//   ChunkId[file_chunk_count]       each file's chunk ids, in chunk order
+//   ChunkRecord[chunk_count]        sorted by chunk id
+//   uint32_t[replica_count]         each chunk's replicas, as address indexes
+//   StringRef[address_count]        DataNode addresses
+//   string pool
+namespace metadata_image {
+
+constexpr uint32_t MAGIC = 0x474d494d;  // "MIMG"
+constexpr uint32_t VERSION = 2;  // 1 kept chunk ids as strings
+constexpr uint64_t NO_FILE = UINT64_MAX;
+
+struct StringRef {
+    uint64_t offset;  // Into the string pool
+    uint32_t size;
+    uint32_t reserved;
+};
+
+struct ImageHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t image_size;
+    uint64_t next_segment;      // First metadata log segment not folded into the image
+    uint64_t chunk_counter;
+    uint64_t file_count;
+    uint64_t files_offset;
+    uint64_t file_chunk_count;
+    uint64_t file_chunks_offset;
+    uint64_t chunk_count;
+    uint64_t chunks_offset;
+    uint64_t replica_count;
+    uint64_t replicas_offset;
+    uint64_t address_count;
+    uint64_t addresses_offset;
+    uint64_t strings_size;
+    uint64_t strings_offset;
+    uint32_t header_crc;        // Over every field above
+    uint32_t reserved;
+};
+
+struct FileRecord {
+    StringRef filename;
+    uint64_t first_chunk;       // Index into the file chunk id table
+    uint32_t chunk_count;
+    uint32_t replication_factor;  // 0 in images from before per-file replication
+    int64_t total_size;
+    int64_t chunk_size;
+    int64_t created_at_ms;      // Milliseconds since the epoch
+};
+
+struct ChunkRecord {
+    ChunkId chunk_id;
+    uint64_t first_replica;     // Index into the replica table
+    uint32_t replica_count;
+    uint32_t reserved;
+    uint64_t owner_file;        // Index into the file table, or NO_FILE
+};
+
+}  // namespace metadata_image
+
+// A read-only, mmap'ed image. Safe to share between threads.
+class MetadataImage {
+private:
+    int fd = -1;
+    const char* base = nullptr;
+    size_t mapped_size = 0;
+    const metadata_image::ImageHeader* header = nullptr;
+
+    MetadataImage() = default;
+
+    std::string_view str(const metadata_image::StringRef& ref) const;
+    const metadata_image::FileRecord& fileRecord(size_t index) const;
+    const metadata_image::ChunkRecord& chunkRecord(size_t index) const;
+
+public:
+    ~MetadataImage();
+
+    MetadataImage(const MetadataImage&) = delete;
+    MetadataImage& operator=(const MetadataImage&) = delete;
+
+    // Map the image at path; nullptr if it's missing, truncated, or from an
+    // unknown version. Only the header is checked, the rest is read lazily.
+    static std::unique_ptr<MetadataImage> open(const std::string& path);
+
+    uint64_t nextSegment() const { return header->next_segment; }
+    uint64_t chunkCounter() const { return header->chunk_counter; }
+    size_t fileCount() const { return header->file_count; }
+    size_t chunkCount() const { return header->chunk_count; }
+
+    // Files, by index in filename order
+    std::optional<size_t> findFile(std::string_view filename) const;
+    std::string_view fileName(size_t file) const;
+    int64_t fileTotalSize(size_t file) const;
+    int64_t fileChunkSize(size_t file) const;
+    int64_t fileCreatedAtMs(size_t file) const;
+    int32_t fileReplicationFactor(size_t file) const;
+    size_t fileChunkCount(size_t file) const;
+    ChunkId fileChunkId(size_t file, size_t position) const;  // NO_CHUNK for a sparse slot
+
+    // Chunks, by index in chunk id order
+    std::optional<size_t> findChunk(ChunkId chunk_id) const;
+    ChunkId chunkId(size_t chunk) const;
+    std::string_view chunkOwner(size_t chunk) const;  // Empty if unknown
+    size_t chunkReplicaCount(size_t chunk) const;
+    std::string_view chunkReplica(size_t chunk, size_t position) const;
+    // Index of the replica's address; addressCount() if the record is damaged
+    size_t chunkReplicaAddress(size_t chunk, size_t position) const;
+    
+    // The distinct DataNode addresses replicas refer to
+    size_t addressCount() const;
+    std::string_view address(size_t index) const;  // Empty if out of range
+};
+
+// Assembles an image in memory. The views handed in must stay valid until
+// build() returns.
+class MetadataImageBuilder {
+private:
+    struct File {
+        std::string_view filename;
+        int64_t total_size;
+        int64_t chunk_size;
+        int64_t created_at_ms;
+        int32_t replication_factor;
+        std::vector<ChunkId> chunk_ids;
+    };
+
+    struct Chunk {
+        ChunkId chunk_id;
+        std::string_view owner;
+        std::vector<std::string_view> replicas;
+    };
+
+    std::vector<File> files;
+    std::vector<Chunk> chunks;
+
+public:
+    void addFile(std::string_view filename, int64_t total_size, int64_t chunk_size, int64_t created_at_ms,
+                 int32_t replication_factor, std::vector<ChunkId> chunk_ids);
+    void addChunk(ChunkId chunk_id, std::string_view owner, std::vector<std::string_view> replicas);
+
+    size_t fileCount() const { return files.size(); }
+    size_t chunkCount() const { return chunks.size(); }
+
+    // Sort the tables and lay out the image bytes
+    std::string build(uint64_t next_segment, uint64_t chunk_counter);
+};
@@ -0,0 +1,335 @@
+#include "metadata_log.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const std::string SEGMENT_PREFIX = "edits_";
+
+// Segment number from a file name like "edits_12"; false for anything else
+static bool segmentNumber(const std::string& name, uint64_t& number) {
+    if (name.size() <= SEGMENT_PREFIX.size() || name.compare(0, SEGMENT_PREFIX.size(), SEGMENT_PREFIX) != 0 ||
+        !std::all_of(name.begin() + SEGMENT_PREFIX.size(), name.end(),
+                     [](unsigned char c) { return std::isdigit(c); })) {
+        return false;
+    }
+    number = std::stoull(name.substr(SEGMENT_PREFIX.size()));
+    return true;
+}
+
+uint32_t crc32(const char* data, size_t size, uint32_t crc) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> entries{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value & 1) ? 0xedb88320u ^ (value >> 1) : value >> 1;
+            }
+            entries[i] = value;
+        }
+        return entries;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static bool syncDirectory(const fs::path& directory) {
+    int dir_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(dir_fd) == 0;
+    ::close(dir_fd);
+    return ok;
+}
+
+bool writeFileDurably(const std::string& path, const std::string& contents) {
+    std::string temp_path = path + ".tmp";
+    int file_fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file_fd < 0) {
+        return false;
+    }
+
+    bool ok = true;
+    size_t written = 0;
+    while (ok && written < contents.size()) {
+        ssize_t result = ::write(file_fd, contents.data() + written, contents.size() - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = result > 0;
+        written += ok ? static_cast<size_t>(result) : 0;
+    }
+    ok = ok && ::fsync(file_fd) == 0;
+    ::close(file_fd);
+
+    std::error_code ec;
+    if (ok) {
+        fs::rename(temp_path, path, ec);
+        ok = !ec;
+    }
+    if (!ok) {
+        fs::remove(temp_path, ec);
+        return false;
+    }
+
+    fs::path parent = fs::path(path).parent_path();
+    return syncDirectory(parent.empty() ? fs::path(".") : parent);
+}
+
+void BinaryWriter::putU32(uint32_t value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void BinaryWriter::putU64(uint64_t value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void BinaryWriter::putI64(int64_t value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void BinaryWriter::putString(const std::string& value) {
+    putU32(static_cast<uint32_t>(value.size()));
+    buffer.append(value);
+}
+
+bool BinaryReader::take(void* out, size_t size) {
+    if (failed || static_cast<size_t>(end - position) < size) {
+        failed = true;
+        return false;
+    }
+    std::memcpy(out, position, size);
+    position += size;
+    return true;
+}
+
+uint32_t BinaryReader::getU32() {
+    uint32_t value = 0;
+    take(&value, sizeof(value));
+    return value;
+}
+
+uint64_t BinaryReader::getU64() {
+    uint64_t value = 0;
+    take(&value, sizeof(value));
+    return value;
+}
+
+int64_t BinaryReader::getI64() {
+    int64_t value = 0;
+    take(&value, sizeof(value));
+    return value;
+}
+
+std::string BinaryReader::getString() {
+    uint32_t size = getU32();
+    if (failed || static_cast<size_t>(end - position) < size) {
+        failed = true;
+        return "";
+    }
+    std::string value(position, size);
+    position += size;
+    return value;
+}
+
+MetadataLog::MetadataLog(const std::string& directory) : directory(directory) {
+}
+
+MetadataLog::~MetadataLog() {
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        stopping = true;
+    }
+    flush_needed.notify_one();
+    if (flusher.joinable()) {
+        flusher.join();  // Drains whatever is still pending
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+std::string MetadataLog::segmentPath(uint64_t number) const {
+    return (fs::path(directory) / (SEGMENT_PREFIX + std::to_string(number))).string();
+}
+
+bool MetadataLog::openSegment(uint64_t number) {
+    int new_fd = ::open(segmentPath(number).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (new_fd < 0) {
+        std::cerr << "[ERROR] Failed to open metadata log segment " << segmentPath(number) << "\n";
+        return false;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = new_fd;
+    segment = number;
+
+    // The new segment's directory entry must survive a crash too
+    syncDirectory(directory);
+    return true;
+}
+
+bool MetadataLog::open(uint64_t first_segment, const std::function<void(const std::string& payload)>& apply) {
+    std::error_code ec;
+    fs::create_directories(directory, ec);
+    if (ec) {
+        std::cerr << "[ERROR] Failed to create metadata directory " << directory << ": " << ec.message() << "\n";
+        return false;
+    }
+
+    std::vector<uint64_t> segments;
+    for (const auto& entry : fs::directory_iterator(directory, ec)) {
+        uint64_t number;
+        if (segmentNumber(entry.path().filename().string(), number)) {
+            segments.push_back(number);
+        }
+    }
+    std::sort(segments.begin(), segments.end());
+
+    uint64_t records = 0;
+    for (uint64_t number : segments) {
+        if (number < first_segment) {
+            continue;  // Already folded into the checkpoint
+        }
+
+        std::ifstream file(segmentPath(number), std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        size_t offset = 0;
+        while (contents.size() - offset >= 2 * sizeof(uint32_t)) {
+            BinaryReader header(contents.data() + offset, 2 * sizeof(uint32_t));
+            uint32_t size = header.getU32();
+            uint32_t crc = header.getU32();
+            size_t payload_offset = offset + 2 * sizeof(uint32_t);
+            if (contents.size() - payload_offset < size ||
+                crc32(contents.data() + payload_offset, size) != crc) {
+                break;
+            }
+
+            apply(contents.substr(payload_offset, size));
+            records++;
+            offset = payload_offset + size;
+        }
+
+        if (offset != contents.size()) {
+            std::cerr << "[WARNING] Metadata log segment " << number << " ends in a torn record; "
+                      << (contents.size() - offset) << " bytes ignored\n";
+        }
+    }
+
+    if (records > 0) {
+        std::cout << "[INFO] Replayed " << records << " metadata log records\n";
+    }
+
+    uint64_t next_segment = segments.empty() ? first_segment : std::max(first_segment, segments.back() + 1);
+    if (!openSegment(next_segment)) {
+        return false;
+    }
+
+    flusher = std::thread(&MetadataLog::flushLoop, this);
+    return true;
+}
+
+uint64_t MetadataLog::append(const std::string& payload) {
+    BinaryWriter header;
+    header.putU32(static_cast<uint32_t>(payload.size()));
+    header.putU32(crc32(payload.data(), payload.size()));
+
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        pending.append(header.data());
+        pending.append(payload);
+        lsn = ++appended_lsn;
+    }
+    flush_needed.notify_one();
+    return lsn;
+}
+
+bool MetadataLog::sync(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(log_mutex);
+    flushed.wait(lock, [&] { return durable_lsn >= lsn || failed; });
+    return durable_lsn >= lsn;
+}
+
+void MetadataLog::flushLoop() {
+    std::unique_lock<std::mutex> lock(log_mutex);
+    while (true) {
+        flush_needed.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty()) {
+            break;  // Stopping with nothing left to write
+        }
+
+        // Everything that piled up while the previous batch was syncing goes out together
+        std::string batch;
+        batch.swap(pending);
+        uint64_t batch_lsn = appended_lsn;
+        int batch_fd = fd;
+        flushing = true;
+        lock.unlock();
+
+        bool ok = true;
+        size_t written = 0;
+        while (ok && written < batch.size()) {
+            ssize_t result = ::write(batch_fd, batch.data() + written, batch.size() - written);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            ok = result > 0;
+            written += ok ? static_cast<size_t>(result) : 0;
+        }
+        ok = ok && ::fdatasync(batch_fd) == 0;
+
+        lock.lock();
+        flushing = false;
+        sync_count++;
+        if (ok && !failed) {
+            durable_lsn = batch_lsn;
+        } else if (!failed) {
+            std::cerr << "[ERROR] Failed to write metadata log segment " << segment << "\n";
+            failed = true;
+        }
+        flushed.notify_all();
+    }
+}
+
+uint64_t MetadataLog::rollSegment() {
+    std::unique_lock<std::mutex> lock(log_mutex);
+    flush_needed.notify_one();
+    flushed.wait(lock, [this] { return failed || (pending.empty() && !flushing); });
+
+    if (!failed && !openSegment(segment + 1)) {
+        failed = true;
+    }
+    return segment;
+}
+
+void MetadataLog::removeSegmentsBefore(uint64_t number) {
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(directory, ec)) {
+        uint64_t segment_number;
+        if (segmentNumber(entry.path().filename().string(), segment_number) && segment_number < number) {
+            fs::remove(entry.path(), ec);
+        }
+    }
+}
+
+uint64_t MetadataLog::syncCount() {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    return sync_count;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <cstdint>
+
+// CRC-32 (IEEE), for catching torn or corrupted records and images
+uint32_t crc32(const char* data, size_t size, uint32_t crc = 0);
+
+// Replace the file at path with contents so that a crash leaves either the
+// old or the new version: write a temp file, fsync, rename, fsync the directory
+bool writeFileDurably(const std::string& path, const std::string& contents);
+
+// Appends fixed-width integers and length-prefixed strings to a byte buffer.
+// Integers are stored in host byte order; metadata files aren't meant to
+// move between machines of different endianness.
+class BinaryWriter {
+private:
+    std::string buffer;
+
+public:
+    void putU32(uint32_t value);
+    void putU64(uint64_t value);
+    void putI64(int64_t value);
+    void putString(const std::string& value);
+
+    const std::string& data() const { return buffer; }
+    std::string release() { return std::move(buffer); }
+};
+
+// Reads what BinaryWriter wrote. Any read past the end fails and leaves the
+// reader failed, so callers can decode a whole record and check ok() once.
+class BinaryReader {
+private:
+    const char* position;
+    const char* end;
+    bool failed = false;
+
+    bool take(void* out, size_t size);
+
+public:
+    BinaryReader(const char* data, size_t size) : position(data), end(data + size) {}
+
+    uint32_t getU32();
+    uint64_t getU64();
+    int64_t getI64();
+    std::string getString();
+
+    bool ok() const { return !failed; }
+    bool atEnd() const { return position == end; }
+};
+
+// Append-only operation log for the MetaServer's metadata, split into
+// numbered segment files (edits_<n>) so a checkpoint can retire the ones it
+// covers. Each record is framed as [length][crc][payload]; replay stops at
+// the first short or corrupt record, which is where a crash tore the tail.
+//
+// Appends only buffer the record. One flusher thread writes whatever has
+// accumulated and makes it durable with a single fdatasync, so concurrent
+// writers share a sync (group commit) instead of paying one each.
+class MetadataLog {
+private:
+    std::string directory;
+
+    std::mutex log_mutex;
+    std::condition_variable flush_needed;
+    std::condition_variable flushed;
+    std::string pending;           // Records appended but not yet written
+    uint64_t appended_lsn = 0;     // Sequence number of the last appended record
+    uint64_t durable_lsn = 0;      // Everything up to here is on disk
+    bool failed = false;           // A write or sync failed; nothing further is durable
+    bool stopping = false;
+    bool flushing = false;
+
+    uint64_t segment = 0;          // Segment currently appended to
+    int fd = -1;
+
+    uint64_t sync_count = 0;
+
+    std::thread flusher;
+
+    std::string segmentPath(uint64_t number) const;
+    bool openSegment(uint64_t number);
+    void flushLoop();
+
+public:
+    explicit MetadataLog(const std::string& directory);
+    ~MetadataLog();
+
+    MetadataLog(const MetadataLog&) = delete;
+    MetadataLog& operator=(const MetadataLog&) = delete;
+
+    // Replay every record in segments numbered first_segment and up, in
+    // order, then start appending to a fresh segment after them
+    bool open(uint64_t first_segment, const std::function<void(const std::string& payload)>& apply);
+
+    // Buffer a record; returns its sequence number for sync()
+    uint64_t append(const std::string& payload);
+
+    // Block until the record with this sequence number is durable.
+    // False if the log failed before getting it to disk.
+    bool sync(uint64_t lsn);
+
+    // Make everything appended so far durable and continue in a new segment;
+    // returns the new segment's number. Callers must keep appends out while
+    // this runs so the split point is well defined.
+    uint64_t rollSegment();
+
+    // Delete segments a checkpoint has made redundant
+    void removeSegmentsBefore(uint64_t number);
+
+    // fdatasync calls so far; with group commit this grows slower than the record count
+    uint64_t syncCount();
+};
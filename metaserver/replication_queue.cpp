@@ -0,0 +1,36 @@
+#include "replication_queue.hpp"
+
+void ReplicationQueue::update(ChunkId chunk_id, int32_t live, int32_t wanted, int64_t bytes) {
+    remove(chunk_id);
+    if (live <= 0 || live >= wanted) {
+        return;
+    }
+    order.insert(Key{live, wanted - live, chunk_id});
+    chunks.emplace(chunk_id, UnderReplicatedChunk{chunk_id, live, wanted, bytes});
+}
+
+void ReplicationQueue::remove(ChunkId chunk_id) {
+    auto it = chunks.find(chunk_id);
+    if (it == chunks.end()) {
+        return;
+    }
+    const UnderReplicatedChunk& chunk = it->second;
+    order.erase(Key{chunk.live, chunk.wanted - chunk.live, chunk_id});
+    chunks.erase(it);
+}
+
+bool ReplicationQueue::contains(ChunkId chunk_id) const {
+    return chunks.count(chunk_id) > 0;
+}
+
+size_t ReplicationQueue::size() const {
+    return chunks.size();
+}
+
+std::vector<UnderReplicatedChunk> ReplicationQueue::front(size_t count) const {
+    std::vector<UnderReplicatedChunk> result;
+    for (auto it = order.begin(); it != order.end() && result.size() < count; ++it) {
+        result.push_back(chunks.at(it->chunk_id));
+    }
+    return result;
+}
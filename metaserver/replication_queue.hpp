@@ -0,0 +1,54 @@
+#pragma once
+
+#include "chunk_id.hpp"
+#include <cstdint>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+// A chunk waiting for more replicas
+struct UnderReplicatedChunk {
+    ChunkId chunk_id;
+    int32_t live;    // Replicas on DataNodes that are still up
+    int32_t wanted;  // The file's replication factor
+    int64_t bytes;   // What copying it costs, at most
+};
+
+// Chunks with fewer live replicas than their file asks for, most at risk
+// first: a chunk down to its last copy goes ahead of one that lost a single
+// replica of three. Among chunks with as many copies left, the one missing
+// more goes first, then the older one. Not thread-safe; the Manager guards it.
+class ReplicationQueue {
+private:
+    struct Key {
+        int32_t live;
+        int32_t missing;
+        ChunkId chunk_id;
+
+        bool operator<(const Key& other) const {
+            if (live != other.live) {
+                return live < other.live;
+            }
+            if (missing != other.missing) {
+                return missing > other.missing;
+            }
+            return chunk_id < other.chunk_id;
+        }
+    };
+
+    std::set<Key> order;
+    std::unordered_map<ChunkId, UnderReplicatedChunk> chunks;
+
+public:
+    // Record the chunk's replica counts. It is queued while it has at least one
+    // live replica and fewer than wanted, and dropped otherwise; with no live
+    // replica there is nothing left to copy from.
+    void update(ChunkId chunk_id, int32_t live, int32_t wanted, int64_t bytes);
+    void remove(ChunkId chunk_id);
+
+    bool contains(ChunkId chunk_id) const;
+    size_t size() const;
+
+    // Up to count chunks in priority order, left in the queue
+    std::vector<UnderReplicatedChunk> front(size_t count) const;
+};
@@ -0,0 +1,194 @@
+#include "server.hpp"
+
+using ::grpc::Status;
+using ::grpc::ServerContext;
+
+// Larger files aren't worth holding whole in the file tier
+constexpr int MAX_FILE_CACHE_CHUNKS = 256;
+
+RPCServiceImpl::RPCServiceImpl(Manager* aManager, FileLocationCache* aFileCache)
+    : theManager(aManager), theFileCache(aFileCache) {
+}
+
+Status RPCServiceImpl::RegisterDataNode(ServerContext* context, const ::DataNodeInfo* request, ::Ack* response) {
+    bool success = theManager->registerDataNode(
+        request->address(),
+        request->available_space()
+    );
+    
+    response->set_ok(success);
+    response->set_message(success ? "DataNode registered successfully" : "Failed to register DataNode");
+    
+    return Status::OK; 
+}
+
+Status RPCServiceImpl::Heartbeat(ServerContext* context, const ::DataNodeHeartbeat* request, ::HeartbeatResponse* response) {
+    bool need_full_report = false;
+    
+    if (request->full_report()) {
+        std::vector<ChunkId> chunks(request->stored_chunk_ids().begin(), request->stored_chunk_ids().end());
+        theManager->updateDataNodeHeartbeat(
+            request->address(),
+            chunks,
+            request->available_space(),
+            request->current_load(),
+            request->sequence(),
+            request->capacity()
+        );
+    } else {
+        std::vector<ChunkId> added(request->added_chunk_ids().begin(), request->added_chunk_ids().end());
+        std::vector<ChunkId> removed(request->removed_chunk_ids().begin(), request->removed_chunk_ids().end());
+        need_full_report = !theManager->applyChunkReport(
+            request->address(),
+            request->sequence(),
+            added,
+            removed,
+            request->available_space(),
+            request->current_load(),
+            request->capacity()
+        );
+    }
+    
+    response->set_ok(true);
+    response->set_need_full_report(need_full_report);
+    for (const auto& task : theManager->takeReplicationTasks(request->address())) {
+        ChunkCopy* copy = response->add_chunks_to_copy();
+        copy->set_chunk_id(task.chunk_id);
+        copy->set_target_address(task.target_address);
+    }
+    for (ChunkId chunk_id : theManager->takeDeletionTasks(request->address())) {
+        response->add_chunks_to_delete(chunk_id);
+    }
+    
+    return Status::OK; 
+}
+
+Status RPCServiceImpl::GetFileLocation(ServerContext* context, const ::FileLocationRequest* request, ::FileLocationResponse* response) {
+    uint64_t generation = 0;
+    if (theFileCache) {
+        auto cached = theFileCache->get(request->filename());
+        if (cached) {
+            response->CopyFrom(*cached);
+            return Status::OK;
+        }
+        generation = theFileCache->generation(request->filename());
+    }
+    
+    int64_t chunk_size = 0;
+    bool complete = false;
+    auto [found, locations] = theManager->getFileLocation(request->filename(), &chunk_size, &complete);
+    
+    if (!found) {
+        response->set_found(false);
+        return Status::OK;
+    }
+    
+    response->set_found(true);
+    response->set_chunk_size(chunk_size);
+    for (const auto& loc : locations) {
+        auto* chunk_loc = response->add_chunks();
+        chunk_loc->set_chunk_id(loc.chunk_id);
+        chunk_loc->set_chunk_index(loc.chunk_index);
+        for (DataNodeId node : loc.datanode_ids) {
+            chunk_loc->add_datanode_addresses(theManager->dataNodeAddress(node));
+        }
+    }
+    
+    // A partial answer would stick after the missing replicas come back
+    if (theFileCache && complete && response->chunks_size() <= MAX_FILE_CACHE_CHUNKS) {
+        theFileCache->put(request->filename(), std::make_shared<const FileLocationResponse>(*response), generation);
+    }
+    
+    return Status::OK;
+}
+
+Status RPCServiceImpl::AllocateChunkLocation(ServerContext* context, const ::ChunkAllocationRequest* request, ::ChunkLocation* response) {
+    int64_t file_chunk_size = request->file_chunk_size() > 0 ? request->file_chunk_size() : DEFAULT_CHUNK_SIZE;
+    
+    if (request->chunk_index() < 0 || request->chunk_size() < 0 || request->file_chunk_size() < 0) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Negative chunk index or size");
+    }
+    if (request->chunk_size() > file_chunk_size) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Chunk larger than the file's chunk size");
+    }
+    if (request->replication_factor() < 0 || request->replication_factor() > MAX_REPLICATION_FACTOR) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Replication factor out of range");
+    }
+    
+    int32_t replication_factor = request->replication_factor() > 0 ? request->replication_factor() : DEFAULT_REPLICATION_FACTOR;
+    
+    auto [chunk_id, datanode_addresses] = theManager->allocateChunkLocation(
+        request->filename(),
+        request->chunk_index(),
+        request->chunk_size(),
+        file_chunk_size,
+        replication_factor
+    );
+    
+    if (chunk_id == NO_CHUNK) {
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, 
+                           "No available DataNode for chunk allocation");
+    }
+    
+    response->set_chunk_id(chunk_id);
+    response->set_chunk_index(request->chunk_index());
+    for (const auto& addr : datanode_addresses) {
+        response->add_datanode_addresses(addr);
+    }
+    
+    return Status::OK;
+}
+
+Status RPCServiceImpl::AllocateChunks(ServerContext* context, const ::ChunkBatchAllocationRequest* request, ::ChunkBatchAllocationResponse* response) {
+    int64_t file_chunk_size = request->file_chunk_size() > 0 ? request->file_chunk_size() : DEFAULT_CHUNK_SIZE;
+    
+    if (request->file_chunk_size() < 0) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Negative chunk size");
+    }
+    if (request->chunks_size() == 0) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "No chunks to allocate");
+    }
+    if (request->replication_factor() < 0 || request->replication_factor() > MAX_REPLICATION_FACTOR) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Replication factor out of range");
+    }
+    int32_t replication_factor = request->replication_factor() > 0 ? request->replication_factor() : DEFAULT_REPLICATION_FACTOR;
+    
+    std::vector<std::pair<int32_t, int64_t>> chunks;
+    chunks.reserve(request->chunks_size());
+    for (const auto& chunk : request->chunks()) {
+        if (chunk.chunk_index() < 0 || chunk.chunk_size() < 0) {
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Negative chunk index or size");
+        }
+        if (chunk.chunk_size() > file_chunk_size) {
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Chunk larger than the file's chunk size");
+        }
+        chunks.emplace_back(chunk.chunk_index(), chunk.chunk_size());
+    }
+    
+    auto allocations = theManager->allocateChunks(request->filename(), chunks, file_chunk_size, replication_factor);
+    
+    if (allocations.empty()) {
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, 
+                           "No available DataNode for chunk allocation");
+    }
+    
+    for (const auto& allocation : allocations) {
+        auto* chunk_loc = response->add_chunks();
+        chunk_loc->set_chunk_id(allocation.chunk_id);
+        chunk_loc->set_chunk_index(allocation.chunk_index);
+        for (const auto& addr : allocation.datanode_addresses) {
+            chunk_loc->add_datanode_addresses(addr);
+        }
+    }
+    
+    return Status::OK;
+}
+
+Status RPCServiceImpl::DeleteFile(ServerContext* context, const ::FileDeletionRequest* request, ::Ack* response) {
+    bool success = theManager->deleteFile(request->filename());
+    
+    response->set_ok(success);
+    response->set_message(success ? "File deleted" : "No such file, or the deletion could not be logged");
+    
+    return Status::OK;
+}
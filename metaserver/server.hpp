@@ -0,0 +1,26 @@
+#pragma once
+
+#include "manager.hpp"
+#include "dfs.grpc.pb.h"
+#include <grpcpp/grpcpp.h>
+
+// gRPC front end for the MetaServer's Manager
+class RPCServiceImpl final : public MetaService::Service {
+private:
+    Manager* theManager;
+    FileLocationCache* theFileCache;  // Optional whole-file answer cache
+public:
+    RPCServiceImpl(Manager* aManager, FileLocationCache* aFileCache = nullptr);
+
+    grpc::Status RegisterDataNode(grpc::ServerContext* context, const ::DataNodeInfo* request, ::Ack* response) override;
+
+    grpc::Status Heartbeat(grpc::ServerContext* context, const ::DataNodeHeartbeat* request, ::HeartbeatResponse* response) override;
+
+    grpc::Status GetFileLocation(grpc::ServerContext* context, const ::FileLocationRequest* request, ::FileLocationResponse* response) override;
+
+    grpc::Status AllocateChunkLocation(grpc::ServerContext* context, const ::ChunkAllocationRequest* request, ::ChunkLocation* response) override;
+
+    grpc::Status AllocateChunks(grpc::ServerContext* context, const ::ChunkBatchAllocationRequest* request, ::ChunkBatchAllocationResponse* response) override;
+
+    grpc::Status DeleteFile(grpc::ServerContext* context, const ::FileDeletionRequest* request, ::Ack* response) override;
+};
@@ -1,7 +1,10 @@
 #include <gtest/gtest.h>
 #include "../utils/test_utils.hpp"
 #include "mini_dfs_client.hpp"
+#include "manager.hpp"
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
 #include <thread>
 
 class FullSystemTest : public ::testing::Test {
@@ -103,6 +106,518 @@ TEST_F(FullSystemTest, LargeFileMultipleChunks) {
     test_utils::expectFilesEqual(test_file.path(), filename);
 }
 
+TEST_F(FullSystemTest, PipelinedUploadWithBoundedWindow) {
+    // 5MB file through a window smaller than the file forces the reader to
+    // block on in-flight chunks while they are stored out of order
+    const size_t file_size = 5 * 1024 * 1024 + 12345;
+    auto data = test_utils::generateRandomData(file_size);
+    
+    test_utils::TempFile test_file;
+    std::ofstream out(test_file.path(), std::ios::binary);
+    out.write(data.data(), data.size());
+    out.close();
+    
+    TransferOptions options;
+    options.parallelism = 4;
+    options.maxInflightBytes = 2 * 1024 * 1024;
+    
+    auto channel = grpc::CreateChannel(metaserver_->address(), grpc::InsecureChannelCredentials());
+    MiniDfsClient pipelined_client(channel, options);
+    pipelined_client.UploadFile(test_file.path());
+    
+    int chunk_count = 0;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(datanode_temp_->path())) {
+        if (entry.path().extension() == ".chunk") {
+            chunk_count++;
+        }
+    }
+    EXPECT_EQ(chunk_count, 6) << "Expected 6 chunks for a 5MB+ file";
+    
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    client_->DownloadFile(filename);
+    
+    test_utils::expectFilesEqual(test_file.path(), filename);
+}
+
+TEST_F(FullSystemTest, ParallelDownloadWithBoundedWindow) {
+    const size_t file_size = 7 * 1024 * 1024 + 100;
+    auto data = test_utils::generateRandomData(file_size);
+    
+    test_utils::TempFile test_file;
+    std::ofstream out(test_file.path(), std::ios::binary);
+    out.write(data.data(), data.size());
+    out.close();
+    
+    client_->UploadFile(test_file.path());
+    
+    // Chunks complete out of order and are written at their own offsets
+    TransferOptions options;
+    options.parallelism = 4;
+    options.maxInflightBytes = 2 * 1024 * 1024;
+    
+    auto channel = grpc::CreateChannel(metaserver_->address(), grpc::InsecureChannelCredentials());
+    MiniDfsClient parallel_client(channel, options);
+    
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    parallel_client.DownloadFile(filename);
+    
+    EXPECT_EQ(std::filesystem::file_size(filename), file_size);
+    test_utils::expectFilesEqual(test_file.path(), filename);
+}
+
+TEST_F(FullSystemTest, DataNodeChannelsReusedAcrossFiles) {
+    TransferOptions options;
+    options.channelsPerEndpoint = 2;
+    
+    auto channel = grpc::CreateChannel(metaserver_->address(), grpc::InsecureChannelCredentials());
+    MiniDfsClient pooled_client(channel, options);
+    
+    std::vector<std::unique_ptr<test_utils::TempFile>> files;
+    for (int i = 0; i < 10; ++i) {
+        auto data = test_utils::generateRandomData(1024 * 1024 + 1 + i);  // 2 chunks each
+        auto file = std::make_unique<test_utils::TempFile>(std::string(data.begin(), data.end()));
+        pooled_client.UploadFile(file->path());
+        files.push_back(std::move(file));
+    }
+    
+    for (const auto& file : files) {
+        std::string filename = std::filesystem::path(file->path()).filename().string();
+        pooled_client.DownloadFile(filename);
+        test_utils::expectFilesEqual(file->path(), filename);
+    }
+    
+    // 40 chunk transfers to one DataNode never opened more than the per-endpoint limit
+    EXPECT_GT(pooled_client.GetOpenChannelCount(), 0);
+    EXPECT_LE(pooled_client.GetOpenChannelCount(), 2);
+}
+
+TEST_F(FullSystemTest, CachedLocationsRefreshedAfterDataNodeMove) {
+    auto data = test_utils::generateRandomData(2 * 1024 * 1024 + 7);
+    test_utils::TempFile test_file(std::string(data.begin(), data.end()));
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    
+    client_->UploadFile(test_file.path());
+    
+    // First download caches locations that only name the original DataNode
+    client_->DownloadFile(filename);
+    test_utils::expectFilesEqual(test_file.path(), filename);
+    
+    // Bring the same storage back up under a new address
+    datanode_->stop();
+    datanode_ = std::make_unique<test_utils::TestDataNode>(
+        test_utils::createTestAddress(),
+        metaserver_->address(),
+        datanode_temp_->path()
+    );
+    ASSERT_TRUE(datanode_->start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    
+    // The cached DataNode is unreachable, so the client must drop the entry
+    // and pick up the new replica from the MetaServer
+    std::filesystem::remove(filename);
+    client_->DownloadFile(filename);
+    test_utils::expectFilesEqual(test_file.path(), filename);
+}
+
+TEST_F(FullSystemTest, ReplicatedUploadSurvivesDataNodeLoss) {
+    test_utils::TempDirectory second_temp;
+    auto second = std::make_unique<test_utils::TestDataNode>(
+        test_utils::createTestAddress(),
+        metaserver_->address(),
+        second_temp.path()
+    );
+    ASSERT_TRUE(second->start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    
+    auto data = test_utils::generateRandomData(3 * 1024 * 1024 + 11);
+    test_utils::TempFile test_file(std::string(data.begin(), data.end()));
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    
+    TransferOptions options;
+    options.replicationFactor = 2;
+    auto channel = grpc::CreateChannel(metaserver_->address(), grpc::InsecureChannelCredentials());
+    MiniDfsClient client(channel, options);
+    client.UploadFile(test_file.path());
+    
+    // Both DataNodes hold every chunk
+    auto countChunks = [](const std::string& path) {
+        size_t count = 0;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
+            count += entry.path().extension() == ".chunk" ? 1 : 0;
+        }
+        return count;
+    };
+    EXPECT_EQ(countChunks(datanode_temp_->path()), 4);
+    EXPECT_EQ(countChunks(second_temp.path()), 4);
+    
+    // Either copy serves the file once the other node is gone
+    datanode_->stop();
+    datanode_.reset();
+    client.DownloadFile(filename);
+    test_utils::expectFilesEqual(test_file.path(), filename);
+    second->stop();
+}
+
+TEST_F(FullSystemTest, OversizedReplicaFallsBackToAnother) {
+    test_utils::TempDirectory second_temp;
+    auto second = std::make_unique<test_utils::TestDataNode>(
+        test_utils::createTestAddress(),
+        metaserver_->address(),
+        second_temp.path()
+    );
+    ASSERT_TRUE(second->start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    
+    auto data = test_utils::generateRandomData(3 * 1024 * 1024 + 11);
+    test_utils::TempFile test_file(std::string(data.begin(), data.end()));
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    
+    TransferOptions options;
+    options.replicationFactor = 2;
+    auto channel = grpc::CreateChannel(metaserver_->address(), grpc::InsecureChannelCredentials());
+    MiniDfsClient client(channel, options);
+    client.UploadFile(test_file.path());
+    
+    // Every chunk on the first node grows past the chunk size, the last one included
+    size_t grown = 0;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(datanode_temp_->path())) {
+        if (entry.path().extension() == ".chunk") {
+            std::ofstream chunk(entry.path(), std::ios::binary | std::ios::app);
+            chunk << std::string(2 * 1024 * 1024, 'x');
+            grown++;
+        }
+    }
+    EXPECT_EQ(grown, 4);
+    
+    client.DownloadFile(filename);
+    test_utils::expectFilesEqual(test_file.path(), filename);
+    
+    std::vector<char> range;
+    ASSERT_TRUE(client.ReadRange(filename, 3 * 1024 * 1024 - 5, 16, range));
+    EXPECT_EQ(range, std::vector<char>(data.end() - 16, data.end()));
+    second->stop();
+}
+
+TEST_F(FullSystemTest, PipelinedStoreReachesEveryReplica) {
+    test_utils::TempDirectory second_temp;
+    test_utils::TempDirectory third_temp;
+    test_utils::TestDataNode second(test_utils::createTestAddress(), metaserver_->address(), second_temp.path());
+    test_utils::TestDataNode third(test_utils::createTestAddress(), metaserver_->address(), third_temp.path());
+    ASSERT_TRUE(second.start());
+    ASSERT_TRUE(third.start());
+    
+    auto stub = DataNodeService::NewStub(
+        grpc::CreateChannel(datanode_->address(), grpc::InsecureChannelCredentials()));
+    auto data = test_utils::generateRandomData(200 * 1024 + 3);
+    
+    // Only the head hears from the writer; it relays down the chain
+    auto store = [&](ChunkId chunk_id, const std::vector<std::string>& downstream) {
+        Ack ack;
+        grpc::ClientContext context;
+        auto writer = stub->StoreChunkStream(&context, &ack);
+        for (size_t sent = 0; sent < data.size(); sent += 64 * 1024) {
+            ChunkData frame;
+            if (sent == 0) {
+                frame.set_chunk_id(chunk_id);
+                for (const auto& address : downstream) {
+                    frame.add_downstream_addresses(address);
+                }
+            }
+            frame.set_data(data.data() + sent, std::min<size_t>(64 * 1024, data.size() - sent));
+            if (!writer->Write(frame)) {
+                break;
+            }
+        }
+        writer->WritesDone();
+        EXPECT_TRUE(writer->Finish().ok());
+        return ack;
+    };
+    
+    Ack ack = store(77, {second.address(), third.address()});
+    EXPECT_TRUE(ack.ok()) << ack.message();
+    test_utils::expectChunkExists(datanode_temp_->path(), 77);
+    test_utils::expectChunkExists(second_temp.path(), 77);
+    test_utils::expectChunkExists(third_temp.path(), 77);
+    
+    // A dead link fails the write, and the ack names where
+    ack = store(78, {second.address(), "127.0.0.1:1"});
+    EXPECT_FALSE(ack.ok());
+    EXPECT_NE(ack.message().find("127.0.0.1:1"), std::string::npos) << ack.message();
+    
+    second.stop();
+    third.stop();
+}
+
+TEST_F(FullSystemTest, LostReplicasAreCopiedToAnotherNode) {
+    test_utils::TempDirectory second_temp;
+    test_utils::TempDirectory third_temp;
+    test_utils::TestDataNode second(test_utils::createTestAddress(), metaserver_->address(), second_temp.path());
+    ASSERT_TRUE(second.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    
+    auto data = test_utils::generateRandomData(3 * 1024 * 1024 + 11);
+    test_utils::TempFile test_file(std::string(data.begin(), data.end()));
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    
+    TransferOptions options;
+    options.replicationFactor = 2;
+    auto channel = grpc::CreateChannel(metaserver_->address(), grpc::InsecureChannelCredentials());
+    MiniDfsClient client(channel, options);
+    client.UploadFile(test_file.path());
+    
+    // A fresh node joins as one of the replicas is lost, once both have
+    // reported their chunks; the MetaServer would notice the silence after a
+    // minute, the test says so right away
+    test_utils::TestDataNode third(test_utils::createTestAddress(), metaserver_->address(), third_temp.path());
+    ASSERT_TRUE(third.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    Manager* manager = metaserver_->manager();
+    std::string lost = datanode_->address();
+    datanode_->stop();
+    datanode_.reset();
+    manager->removeDataNode(lost);
+    EXPECT_EQ(manager->getUnderReplicatedCount(), 4);
+    
+    // The survivor is the only source, so it gets a few copies at a time,
+    // with its next heartbeat; the new node's reports complete them
+    EXPECT_EQ(manager->scheduleReplication(64 * 1024 * 1024), MAX_REPLICATION_STREAMS);
+    for (int i = 0; i < 100 && manager->getUnderReplicatedCount() > 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        manager->scheduleReplication(64 * 1024 * 1024);
+    }
+    EXPECT_EQ(manager->getUnderReplicatedCount(), 0);
+    
+    // The new node alone can serve the file
+    second.stop();
+    client.DownloadFile(filename);
+    test_utils::expectFilesEqual(test_file.path(), filename);
+    third.stop();
+}
+
+TEST_F(FullSystemTest, ReplicateChunkBetweenDataNodes) {
+    test_utils::TempDirectory second_temp;
+    test_utils::TestDataNode second(test_utils::createTestAddress(), metaserver_->address(), second_temp.path());
+    ASSERT_TRUE(second.start());
+    
+    auto source = DataNodeService::NewStub(
+        grpc::CreateChannel(datanode_->address(), grpc::InsecureChannelCredentials()));
+    auto target = DataNodeService::NewStub(
+        grpc::CreateChannel(second.address(), grpc::InsecureChannelCredentials()));
+    auto data = test_utils::generateRandomData(300 * 1024 + 5);
+    {
+        ChunkData chunk;
+        chunk.set_chunk_id(91);
+        chunk.set_data(data.data(), data.size());
+        Ack ack;
+        grpc::ClientContext context;
+        ASSERT_TRUE(source->StoreChunk(&context, chunk, &ack).ok());
+        ASSERT_TRUE(ack.ok());
+    }
+    
+    auto replicate = [&](ChunkId chunk_id, const std::string& to, Ack& ack) {
+        ChunkCopy copy;
+        copy.set_chunk_id(chunk_id);
+        copy.set_target_address(to);
+        grpc::ClientContext context;
+        return source->ReplicateChunk(&context, copy, &ack);
+    };
+    
+    // The copy goes source to target without passing through the caller
+    Ack ack;
+    ASSERT_TRUE(replicate(91, second.address(), ack).ok());
+    EXPECT_TRUE(ack.ok()) << ack.message();
+    {
+        ChunkRequest request;
+        request.set_chunk_id(91);
+        ChunkData copy;
+        grpc::ClientContext context;
+        ASSERT_TRUE(target->ReadChunk(&context, request, &copy).ok());
+        EXPECT_EQ(copy.data(), std::string(data.begin(), data.end()));
+    }
+    
+    EXPECT_EQ(replicate(92, second.address(), ack).error_code(), grpc::StatusCode::NOT_FOUND);
+    ASSERT_TRUE(replicate(91, "127.0.0.1:1", ack).ok());
+    EXPECT_FALSE(ack.ok());
+    
+    // Bytes that don't match the checksum sent ahead of them are turned away
+    {
+        Ack store_ack;
+        grpc::ClientContext context;
+        auto writer = target->StoreChunkStream(&context, &store_ack);
+        ChunkData frame;
+        frame.set_chunk_id(93);
+        frame.set_checksum(std::string(64, '0'));
+        frame.set_data(data.data(), data.size());
+        ASSERT_TRUE(writer->Write(frame));
+        writer->WritesDone();
+        ASSERT_TRUE(writer->Finish().ok());
+        EXPECT_FALSE(store_ack.ok());
+    }
+    ChunkRequest request;
+    request.set_chunk_id(93);
+    ChunkData missing;
+    grpc::ClientContext context;
+    EXPECT_EQ(target->ReadChunk(&context, request, &missing).error_code(), grpc::StatusCode::NOT_FOUND);
+    
+    second.stop();
+}
+
+TEST_F(FullSystemTest, RebalancingMovesChunksToNewNode) {
+    auto data = test_utils::generateRandomData(8 * 1024 * 1024);
+    test_utils::TempFile test_file(std::string(data.begin(), data.end()));
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    
+    TransferOptions options;
+    options.replicationFactor = 1;
+    auto channel = grpc::CreateChannel(metaserver_->address(), grpc::InsecureChannelCredentials());
+    MiniDfsClient client(channel, options);
+    client.UploadFile(test_file.path());
+    
+    // An empty node joins next to the one holding all eight chunks; both
+    // report their capacity with their heartbeats
+    test_utils::TempDirectory second_temp;
+    test_utils::TestDataNode second(test_utils::createTestAddress(), metaserver_->address(), second_temp.path());
+    ASSERT_TRUE(second.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    
+    auto countChunks = [](const std::string& path) {
+        size_t count = 0;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
+            count += entry.path().extension() == ".chunk" ? 1 : 0;
+        }
+        return count;
+    };
+    ASSERT_EQ(countChunks(datanode_temp_->path()), 8);
+    
+    // The nodes hold 1 GB each, so a band of 0.1% leaves them four chunks
+    // apiece; the old node deletes each copy once the new one has it
+    Manager* manager = metaserver_->manager();
+    for (int i = 0; i < 100; ++i) {
+        if (countChunks(datanode_temp_->path()) == 4 && countChunks(second_temp.path()) == 4) {
+            break;
+        }
+        manager->scheduleRebalance(0.001, 64 * 1024 * 1024);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    EXPECT_EQ(countChunks(datanode_temp_->path()), 4);
+    EXPECT_EQ(countChunks(second_temp.path()), 4);
+    
+    client.DownloadFile(filename);
+    test_utils::expectFilesEqual(test_file.path(), filename);
+    second.stop();
+}
+
+TEST_F(FullSystemTest, ReadRangeAcrossChunks) {
+    const size_t file_size = 3 * 1024 * 1024 + 4321;
+    auto data = test_utils::generateRandomData(file_size);
+    test_utils::TempFile test_file(std::string(data.begin(), data.end()));
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    
+    client_->UploadFile(test_file.path());
+    
+    // Straddles the boundary between chunks 0 and 1
+    std::vector<char> out;
+    ASSERT_TRUE(client_->ReadRange(filename, 1024 * 1024 - 100, 300, out));
+    EXPECT_EQ(out, std::vector<char>(data.begin() + 1024 * 1024 - 100, data.begin() + 1024 * 1024 + 200));
+    
+    // Footer read only touches the last chunk
+    ASSERT_TRUE(client_->ReadRange(filename, file_size - 64, 64, out));
+    EXPECT_EQ(out, std::vector<char>(data.end() - 64, data.end()));
+    
+    // Ranges past the end of the file come back short
+    ASSERT_TRUE(client_->ReadRange(filename, file_size - 10, 1000, out));
+    EXPECT_EQ(out.size(), 10);
+    ASSERT_TRUE(client_->ReadRange(filename, file_size + 10, 1000, out));
+    EXPECT_TRUE(out.empty());
+    
+    // Nothing was written locally
+    EXPECT_FALSE(std::filesystem::exists(filename));
+    
+    EXPECT_FALSE(client_->ReadRange("no_such_file.bin", 0, 10, out));
+}
+
+TEST_F(FullSystemTest, StreamedChunkLargerThanMessageLimit) {
+    // 8MB is over gRPC's default 4MB message limit, so only the streaming RPCs can move it
+    const size_t chunk_size = 8 * 1024 * 1024;
+    const ChunkId BIG_CHUNK_ID = 1000000;
+    auto data = test_utils::generateRandomData(chunk_size);
+    
+    auto channel = grpc::CreateChannel(datanode_->address(), grpc::InsecureChannelCredentials());
+    auto stub = DataNodeService::NewStub(channel);
+    
+    Ack ack;
+    grpc::ClientContext store_context;
+    auto writer = stub->StoreChunkStream(&store_context, &ack);
+    for (size_t pos = 0; pos < chunk_size; pos += 256 * 1024) {
+        ChunkData frame;
+        if (pos == 0) {
+            frame.set_chunk_id(BIG_CHUNK_ID);
+        }
+        frame.set_data(data.data() + pos, 256 * 1024);
+        ASSERT_TRUE(writer->Write(frame));
+    }
+    writer->WritesDone();
+    ASSERT_TRUE(writer->Finish().ok());
+    ASSERT_TRUE(ack.ok()) << ack.message();
+    
+    ChunkRequest request;
+    request.set_chunk_id(BIG_CHUNK_ID);
+    grpc::ClientContext read_context;
+    auto reader = stub->ReadChunkStream(&read_context, request);
+    
+    std::vector<char> received;
+    ChunkData frame;
+    while (reader->Read(&frame)) {
+        received.insert(received.end(), frame.data().begin(), frame.data().end());
+    }
+    ASSERT_TRUE(reader->Finish().ok());
+    EXPECT_EQ(received, data);
+}
+
+TEST_F(FullSystemTest, PerFileChunkSize) {
+    // 7MB in 3MB chunks: two full chunks and a 1MB tail
+    const size_t file_size = 7 * 1024 * 1024;
+    const size_t chunk_size = 3 * 1024 * 1024;
+    auto data = test_utils::generateRandomData(file_size);
+    test_utils::TempFile test_file(std::string(data.begin(), data.end()));
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    
+    client_->UploadFile(test_file.path(), chunk_size);
+    
+    int chunk_count = 0;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(datanode_temp_->path())) {
+        if (entry.path().extension() == ".chunk") {
+            chunk_count++;
+        }
+    }
+    EXPECT_EQ(chunk_count, 3) << "Expected 3 chunks for a 7MB file with 3MB chunks";
+    
+    // Readers learn the chunk size from the MetaServer
+    std::vector<char> out;
+    ASSERT_TRUE(client_->ReadRange(filename, chunk_size - 10, 20, out));
+    EXPECT_EQ(out, std::vector<char>(data.begin() + chunk_size - 10, data.begin() + chunk_size + 10));
+    
+    client_->DownloadFile(filename);
+    test_utils::expectFilesEqual(test_file.path(), filename);
+}
+
+TEST_F(FullSystemTest, UploadAllocatesInBatches) {
+    // 8 chunks allocated 3 at a time: batches of 3, 3 and 2
+    const size_t file_size = 7 * 1024 * 1024 + 1;
+    auto data = test_utils::generateRandomData(file_size);
+    test_utils::TempFile test_file(std::string(data.begin(), data.end()));
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    
+    TransferOptions options;
+    options.allocationBatchSize = 3;
+    auto channel = grpc::CreateChannel(metaserver_->address(), grpc::InsecureChannelCredentials());
+    MiniDfsClient batched_client(channel, options);
+    batched_client.UploadFile(test_file.path());
+    
+    client_->DownloadFile(filename);
+    test_utils::expectFilesEqual(test_file.path(), filename);
+}
+
 TEST_F(FullSystemTest, EmptyFileHandling) {
     // Create empty file
     test_utils::TempFile empty_file("");
@@ -205,6 +720,62 @@ TEST_F(FullSystemTest, FileOverwrite) {
     EXPECT_EQ(content2, updated_content);
 }
 
+TEST_F(FullSystemTest, DeletedFileIsReclaimedFromDataNodes) {
+    auto data = test_utils::generateRandomData(2 * 1024 * 1024 + 7);
+    test_utils::TempFile test_file(std::string(data.begin(), data.end()));
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    client_->UploadFile(test_file.path());
+    
+    Manager* manager = metaserver_->manager();
+    auto [found, locations] = manager->getFileLocation(filename);
+    ASSERT_TRUE(found);
+    ASSERT_EQ(locations.size(), 3);
+    auto stored = [this](ChunkId chunk_id) {
+        try {
+            test_utils::expectChunkExists(datanode_->storagePath(), chunk_id);
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    };
+    for (const auto& location : locations) {
+        EXPECT_TRUE(stored(location.chunk_id));
+    }
+    
+    EXPECT_TRUE(client_->DeleteFile(filename));
+    EXPECT_FALSE(manager->getFileLocation(filename).first);
+    EXPECT_FALSE(client_->DeleteFile(filename));
+    
+    // The DataNode drops the chunks when its next heartbeat is answered
+    auto anyStored = [&]() {
+        return std::any_of(locations.begin(), locations.end(),
+                           [&](const ChunkLocationInfo& location) { return stored(location.chunk_id); });
+    };
+    for (int i = 0; i < 50 && anyStored(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    EXPECT_FALSE(anyStored());
+    
+    // The name is free for a new file
+    client_->UploadFile(test_file.path());
+    client_->DownloadFile(filename);
+    test_utils::expectFilesEqual(test_file.path(), filename);
+}
+
+TEST_F(FullSystemTest, FailedUploadLeavesNoFile) {
+    auto data = test_utils::generateRandomData(3 * 1024 * 1024 + 5);
+    test_utils::TempFile test_file(std::string(data.begin(), data.end()));
+    std::string filename = std::filesystem::path(test_file.path()).filename().string();
+    
+    // The MetaServer still places chunks on the DataNode, which is gone
+    datanode_->stop();
+    datanode_.reset();
+    client_->UploadFile(test_file.path());
+    
+    EXPECT_FALSE(metaserver_->manager()->getFileLocation(filename).first);
+    EXPECT_EQ(metaserver_->manager()->getFileCount(), 0);
+}
+
 TEST_F(FullSystemTest, NonExistentFileDownload) {
     // Try to download a file that doesn't exist
     // This should fail gracefully without crashing
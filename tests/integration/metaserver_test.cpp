@@ -2,6 +2,12 @@
 #include "../utils/test_utils.hpp"
 #include "dfs.grpc.pb.h"
 #include <grpcpp/grpcpp.h>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <cmath>
+#include "manager.hpp"
+#include "metadata_image.hpp"
 
 class MetaServerTest : public ::testing::Test {
 protected:
@@ -59,8 +65,10 @@ TEST_F(MetaServerTest, DataNodeHeartbeat) {
     heartbeat.set_address("localhost:50052");
     heartbeat.set_available_space(9 * 1024 * 1024 * 1024L); // Updated space
     heartbeat.set_current_load(5);
-    heartbeat.add_stored_chunk_ids("chunk1");
-    heartbeat.add_stored_chunk_ids("chunk2");
+    heartbeat.set_sequence(1);
+    heartbeat.set_full_report(true);
+    heartbeat.add_stored_chunk_ids(1);
+    heartbeat.add_stored_chunk_ids(2);
     
     HeartbeatResponse hb_response;
     grpc::ClientContext hb_context;
@@ -70,9 +78,150 @@ TEST_F(MetaServerTest, DataNodeHeartbeat) {
     EXPECT_TRUE(hb_response.ok());
 }
 
+TEST_F(MetaServerTest, DeltaHeartbeats) {
+    DataNodeInfo reg_info;
+    reg_info.set_address("localhost:50052");
+    reg_info.set_available_space(10 * 1024 * 1024 * 1024L);
+    Ack reg_response;
+    grpc::ClientContext reg_context;
+    ASSERT_TRUE(stub_->RegisterDataNode(&reg_context, reg_info, &reg_response).ok());
+    
+    std::vector<ChunkId> chunk_ids(3);
+    for (int i = 0; i < 3; ++i) {
+        std::vector<std::string> datanode_addrs;
+        ASSERT_TRUE(client_->allocateChunk("delta.dat", i, 1024, chunk_ids[i], datanode_addrs));
+    }
+    
+    auto send = [this](uint64_t sequence, bool full, const std::vector<ChunkId>& chunks,
+                       const std::vector<ChunkId>& removed = {}) {
+        DataNodeHeartbeat heartbeat;
+        heartbeat.set_address("localhost:50053");
+        heartbeat.set_available_space(10 * 1024 * 1024 * 1024L);
+        heartbeat.set_sequence(sequence);
+        heartbeat.set_full_report(full);
+        for (ChunkId chunk_id : chunks) {
+            if (full) {
+                heartbeat.add_stored_chunk_ids(chunk_id);
+            } else {
+                heartbeat.add_added_chunk_ids(chunk_id);
+            }
+        }
+        for (ChunkId chunk_id : removed) {
+            heartbeat.add_removed_chunk_ids(chunk_id);
+        }
+        
+        HeartbeatResponse response;
+        grpc::ClientContext context;
+        EXPECT_TRUE(stub_->Heartbeat(&context, heartbeat, &response).ok());
+        EXPECT_TRUE(response.ok());
+        return response.need_full_report();
+    };
+    auto replicaCount = [this](int chunk_index) {
+        auto locations = client_->getFileLocation("delta.dat");
+        return locations.size() == 3 ? locations[chunk_index].datanode_addresses_size() : -1;
+    };
+    
+    // Deltas from a node the MetaServer hasn't had a full report from are refused
+    EXPECT_TRUE(send(1, false, {chunk_ids[0]}));
+    EXPECT_EQ(replicaCount(0), 1);
+    
+    EXPECT_FALSE(send(1, true, {chunk_ids[0]}));
+    EXPECT_EQ(replicaCount(0), 2);
+    
+    // Only the changes travel from here on
+    EXPECT_FALSE(send(2, false, {chunk_ids[1]}));
+    EXPECT_EQ(replicaCount(1), 2);
+    EXPECT_FALSE(send(3, false, {chunk_ids[2]}, {chunk_ids[0]}));
+    EXPECT_EQ(replicaCount(0), 1);
+    EXPECT_EQ(replicaCount(2), 2);
+    
+    // A retried report is applied again harmlessly; a gap asks for a full report
+    EXPECT_FALSE(send(3, false, {chunk_ids[2]}, {chunk_ids[0]}));
+    EXPECT_EQ(replicaCount(2), 2);
+    EXPECT_TRUE(send(5, false, {chunk_ids[0]}));
+    EXPECT_EQ(replicaCount(0), 1);
+    
+    // The full report replaces what the node was known to hold
+    EXPECT_FALSE(send(6, true, {chunk_ids[0]}));
+    EXPECT_EQ(replicaCount(0), 2);
+    EXPECT_EQ(replicaCount(1), 1);
+    EXPECT_EQ(replicaCount(2), 1);
+}
+
+TEST(ManagerReportTest, FullReportDropsReplicasTheNodeLacks) {
+    const int64_t MB = 1024 * 1024;
+    auto allocateAndReport = [MB](Manager& manager) {
+        manager.registerDataNode("localhost:50052", 100 * MB);
+        manager.registerDataNode("localhost:50053", 100 * MB);
+        auto allocations = manager.allocateChunks("partial.dat", {{0, MB}}, MB, 2);
+        EXPECT_EQ(allocations.size(), 1);
+        if (allocations.size() != 1 || allocations[0].datanode_addresses.size() != 2) {
+            return size_t{0};
+        }
+        
+        // The pipeline never got the chunk to the second node
+        manager.updateDataNodeHeartbeat(allocations[0].datanode_addresses[0], {allocations[0].chunk_id}, 100 * MB, 0, 1);
+        manager.updateDataNodeHeartbeat(allocations[0].datanode_addresses[1], {}, 100 * MB, 0, 1);
+        
+        auto [found, locations] = manager.getFileLocation("partial.dat");
+        EXPECT_TRUE(found);
+        EXPECT_EQ(locations.size(), 1);
+        return locations.empty() ? size_t{0} : locations[0].datanode_ids.size();
+    };
+    
+    // Once the write had time to land, the missing replica is dropped and
+    // the chunk waits for a new copy
+    {
+        Cache cache(1000);
+        Manager manager(&cache, nullptr, std::chrono::milliseconds(0));
+        EXPECT_EQ(allocateAndReport(manager), 1);
+        EXPECT_EQ(manager.getUnderReplicatedCount(), 1);
+    }
+    
+    // A write that may still be under way keeps its replica
+    Cache cache(1000);
+    Manager manager(&cache);
+    EXPECT_EQ(allocateAndReport(manager), 2);
+    EXPECT_EQ(manager.getUnderReplicatedCount(), 0);
+}
+
+TEST(ManagerReportTest, FullReportDropsReplicasRecordedBeforeRestart) {
+    test_utils::TempDirectory metadata_dir;
+    const int64_t MB = 1024 * 1024;
+    std::vector<ChunkAllocation> allocations;
+    {
+        Cache cache(1000);
+        Manager manager(&cache);
+        ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+        manager.registerDataNode("localhost:50052", 100 * MB);
+        allocations = manager.allocateChunks("imaged.dat", {{0, MB}, {1, MB}}, MB, 1);
+        ASSERT_TRUE(manager.checkpoint());
+    }
+    ASSERT_EQ(allocations.size(), 2);
+    
+    // One replica comes from the image, the other from the node itself
+    Cache cache(1000);
+    Manager manager(&cache, nullptr, std::chrono::milliseconds(0));
+    ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+    manager.updateDataNodeHeartbeat("localhost:50052", {allocations[1].chunk_id}, 100 * MB, 0, 1);
+    manager.updateDataNodeHeartbeat("localhost:50053", {allocations[0].chunk_id}, 100 * MB, 0, 1);
+    
+    auto [found, locations] = manager.getFileLocation("imaged.dat");
+    ASSERT_TRUE(found);
+    ASSERT_EQ(locations.size(), 2);
+    ASSERT_EQ(locations[0].datanode_ids.size(), 1);
+    EXPECT_EQ(manager.dataNodeAddress(locations[0].datanode_ids[0]), "localhost:50053");
+    ASSERT_EQ(locations[1].datanode_ids.size(), 1);
+    EXPECT_EQ(manager.dataNodeAddress(locations[1].datanode_ids[0]), "localhost:50052");
+    
+    // A replica reported after the restart is dropped the same way
+    manager.updateDataNodeHeartbeat("localhost:50053", {}, 100 * MB, 0, 2);
+    EXPECT_EQ(manager.getFileLocation("imaged.dat").second.size(), 1);
+}
+
 TEST_F(MetaServerTest, ChunkAllocationWithoutDataNodes) {
     // Try to allocate chunk without any registered DataNodes
-    std::string chunk_id;
+    ChunkId chunk_id;
     std::vector<std::string> datanode_addrs;
     
     bool success = client_->allocateChunk("test_file.txt", 0, 1024, chunk_id, datanode_addrs);
@@ -92,13 +241,13 @@ TEST_F(MetaServerTest, ChunkAllocationWithDataNode) {
     ASSERT_TRUE(stub_->RegisterDataNode(&reg_context, info, &reg_response).ok());
     
     // Now try chunk allocation
-    std::string chunk_id;
+    ChunkId chunk_id;
     std::vector<std::string> datanode_addrs;
     
     bool success = client_->allocateChunk("test_file.txt", 0, 1024, chunk_id, datanode_addrs);
     
     EXPECT_TRUE(success);
-    EXPECT_FALSE(chunk_id.empty());
+    EXPECT_NE(chunk_id, NO_CHUNK);
     EXPECT_EQ(datanode_addrs.size(), 1);
     EXPECT_EQ(datanode_addrs[0], "localhost:50052");
 }
@@ -114,24 +263,24 @@ TEST_F(MetaServerTest, MultipleChunkAllocation) {
     ASSERT_TRUE(stub_->RegisterDataNode(&reg_context, info, &reg_response).ok());
     
     // Allocate multiple chunks for the same file
-    std::vector<std::string> chunk_ids;
+    std::vector<ChunkId> chunk_ids;
     const int num_chunks = 5;
     
     for (int i = 0; i < num_chunks; ++i) {
-        std::string chunk_id;
+        ChunkId chunk_id;
         std::vector<std::string> datanode_addrs;
         
         bool success = client_->allocateChunk("large_file.bin", i, 1024 * 1024, chunk_id, datanode_addrs);
         
         EXPECT_TRUE(success) << "Failed to allocate chunk " << i;
-        EXPECT_FALSE(chunk_id.empty()) << "Empty chunk ID for chunk " << i;
+        EXPECT_NE(chunk_id, NO_CHUNK) << "Empty chunk ID for chunk " << i;
         EXPECT_EQ(datanode_addrs.size(), 1) << "Wrong number of DataNodes for chunk " << i;
         
         chunk_ids.push_back(chunk_id);
     }
     
     // Verify all chunk IDs are unique
-    std::set<std::string> unique_ids(chunk_ids.begin(), chunk_ids.end());
+    std::set<ChunkId> unique_ids(chunk_ids.begin(), chunk_ids.end());
     EXPECT_EQ(unique_ids.size(), num_chunks) << "Duplicate chunk IDs generated";
 }
 
@@ -153,10 +302,10 @@ TEST_F(MetaServerTest, FileLocationAfterChunkAllocation) {
     
     // Allocate chunks for a file
     const int num_chunks = 3;
-    std::vector<std::string> expected_chunk_ids;
+    std::vector<ChunkId> expected_chunk_ids;
     
     for (int i = 0; i < num_chunks; ++i) {
-        std::string chunk_id;
+        ChunkId chunk_id;
         std::vector<std::string> datanode_addrs;
         
         ASSERT_TRUE(client_->allocateChunk("test_file.dat", i, 1024, chunk_id, datanode_addrs));
@@ -170,11 +319,225 @@ TEST_F(MetaServerTest, FileLocationAfterChunkAllocation) {
     
     for (size_t i = 0; i < locations.size(); ++i) {
         EXPECT_EQ(locations[i].chunk_id(), expected_chunk_ids[i]);
+        EXPECT_EQ(locations[i].chunk_index(), static_cast<int32_t>(i));
         EXPECT_EQ(locations[i].datanode_addresses_size(), 1);
         EXPECT_EQ(locations[i].datanode_addresses(0), "localhost:50052");
     }
 }
 
+TEST_F(MetaServerTest, FileLocationTierTracksChanges) {
+    DataNodeInfo info;
+    info.set_address("localhost:50052");
+    info.set_available_space(10 * 1024 * 1024 * 1024L);
+    
+    Ack reg_response;
+    grpc::ClientContext reg_context;
+    ASSERT_TRUE(stub_->RegisterDataNode(&reg_context, info, &reg_response).ok());
+    
+    std::vector<ChunkId> chunk_ids(2);
+    for (int i = 0; i < 2; ++i) {
+        std::vector<std::string> datanode_addrs;
+        ASSERT_TRUE(client_->allocateChunk("hot_file.dat", i, 1024, chunk_ids[i], datanode_addrs));
+    }
+    
+    // Repeated lookups are answered from the whole-file entry
+    auto first = client_->getFileLocation("hot_file.dat");
+    auto second = client_->getFileLocation("hot_file.dat");
+    ASSERT_EQ(first.size(), 2);
+    ASSERT_EQ(second.size(), 2);
+    EXPECT_EQ(second[1].chunk_id(), chunk_ids[1]);
+    
+    // A new replica reported by heartbeat invalidates the file's entry
+    DataNodeHeartbeat heartbeat;
+    heartbeat.set_address("localhost:50053");
+    heartbeat.set_available_space(10 * 1024 * 1024 * 1024L);
+    heartbeat.set_sequence(1);
+    heartbeat.set_full_report(true);
+    heartbeat.add_stored_chunk_ids(chunk_ids[0]);
+    HeartbeatResponse hb_response;
+    grpc::ClientContext hb_context;
+    ASSERT_TRUE(stub_->Heartbeat(&hb_context, heartbeat, &hb_response).ok());
+    
+    auto replicated = client_->getFileLocation("hot_file.dat");
+    ASSERT_EQ(replicated.size(), 2);
+    EXPECT_EQ(replicated[0].datanode_addresses_size(), 2);
+    EXPECT_EQ(replicated[1].datanode_addresses_size(), 1);
+    
+    // So does growing the file
+    ChunkId chunk_id;
+    std::vector<std::string> datanode_addrs;
+    ASSERT_TRUE(client_->allocateChunk("hot_file.dat", 2, 1024, chunk_id, datanode_addrs));
+    
+    auto grown = client_->getFileLocation("hot_file.dat");
+    ASSERT_EQ(grown.size(), 3);
+    EXPECT_EQ(grown[2].chunk_id(), chunk_id);
+}
+
+TEST_F(MetaServerTest, PerFileChunkSize) {
+    DataNodeInfo info;
+    info.set_address("localhost:50052");
+    info.set_available_space(10 * 1024 * 1024 * 1024L);
+    
+    Ack reg_response;
+    grpc::ClientContext reg_context;
+    ASSERT_TRUE(stub_->RegisterDataNode(&reg_context, info, &reg_response).ok());
+    
+    const int64_t bulk_chunk_size = 64 * 1024 * 1024;
+    for (int i = 0; i < 2; ++i) {
+        ChunkAllocationRequest request;
+        request.set_filename("bulk.dat");
+        request.set_chunk_index(i);
+        request.set_chunk_size(i == 0 ? bulk_chunk_size : 1000);
+        request.set_file_chunk_size(bulk_chunk_size);
+        
+        ChunkLocation response;
+        grpc::ClientContext context;
+        ASSERT_TRUE(stub_->AllocateChunkLocation(&context, request, &response).ok());
+    }
+    
+    // A chunk can't exceed its file's chunk size
+    ChunkAllocationRequest oversized;
+    oversized.set_filename("small.dat");
+    oversized.set_chunk_index(0);
+    oversized.set_chunk_size(2 * 1024 * 1024);
+    oversized.set_file_chunk_size(1024 * 1024);
+    ChunkLocation oversized_response;
+    grpc::ClientContext oversized_context;
+    EXPECT_EQ(stub_->AllocateChunkLocation(&oversized_context, oversized, &oversized_response).error_code(),
+              grpc::StatusCode::INVALID_ARGUMENT);
+    
+    // The chunk size is recorded with the file and reported to readers
+    FileLocationRequest request;
+    request.set_filename("bulk.dat");
+    FileLocationResponse response;
+    grpc::ClientContext context;
+    ASSERT_TRUE(stub_->GetFileLocation(&context, request, &response).ok());
+    EXPECT_TRUE(response.found());
+    EXPECT_EQ(response.chunk_size(), bulk_chunk_size);
+    EXPECT_EQ(response.chunks_size(), 2);
+    
+    // Files allocated without one get the default
+    ChunkId chunk_id;
+    std::vector<std::string> datanode_addrs;
+    ASSERT_TRUE(client_->allocateChunk("default.dat", 0, 1024, chunk_id, datanode_addrs));
+    FileLocationRequest default_request;
+    default_request.set_filename("default.dat");
+    FileLocationResponse default_response;
+    grpc::ClientContext default_context;
+    ASSERT_TRUE(stub_->GetFileLocation(&default_context, default_request, &default_response).ok());
+    EXPECT_EQ(default_response.chunk_size(), 1024 * 1024);
+}
+
+TEST_F(MetaServerTest, BatchChunkAllocation) {
+    for (const std::string address : {"localhost:50052", "localhost:50053"}) {
+        DataNodeInfo info;
+        info.set_address(address);
+        info.set_available_space(100 * 1024 * 1024);
+        Ack reg_response;
+        grpc::ClientContext reg_context;
+        ASSERT_TRUE(stub_->RegisterDataNode(&reg_context, info, &reg_response).ok());
+    }
+    
+    ChunkBatchAllocationRequest request;
+    request.set_filename("batched.dat");
+    request.set_replication_factor(1);
+    for (int i = 0; i < 10; ++i) {
+        ChunkSpec* spec = request.add_chunks();
+        spec->set_chunk_index(i);
+        spec->set_chunk_size(i < 9 ? 1024 * 1024 : 100);
+    }
+    
+    ChunkBatchAllocationResponse response;
+    grpc::ClientContext context;
+    ASSERT_TRUE(stub_->AllocateChunks(&context, request, &response).ok());
+    ASSERT_EQ(response.chunks_size(), 10);
+    
+    // Placement is charged per chunk, so the batch spreads over both nodes
+    std::map<std::string, int> per_node;
+    for (int i = 0; i < response.chunks_size(); ++i) {
+        EXPECT_EQ(response.chunks(i).chunk_index(), i);
+        ASSERT_EQ(response.chunks(i).datanode_addresses_size(), 1);
+        per_node[response.chunks(i).datanode_addresses(0)]++;
+    }
+    EXPECT_EQ(per_node.size(), 2);
+    
+    auto locations = client_->getFileLocation("batched.dat");
+    ASSERT_EQ(locations.size(), 10);
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(locations[i].chunk_id(), response.chunks(i).chunk_id());
+    }
+}
+
+TEST_F(MetaServerTest, BatchChunkAllocationIsAllOrNothing) {
+    DataNodeInfo info;
+    info.set_address("localhost:50052");
+    info.set_available_space(3 * 1024 * 1024);
+    Ack reg_response;
+    grpc::ClientContext reg_context;
+    ASSERT_TRUE(stub_->RegisterDataNode(&reg_context, info, &reg_response).ok());
+    
+    // Room for three chunks, not four
+    ChunkBatchAllocationRequest request;
+    request.set_filename("too_big.dat");
+    for (int i = 0; i < 4; ++i) {
+        ChunkSpec* spec = request.add_chunks();
+        spec->set_chunk_index(i);
+        spec->set_chunk_size(1024 * 1024);
+    }
+    ChunkBatchAllocationResponse response;
+    grpc::ClientContext context;
+    EXPECT_EQ(stub_->AllocateChunks(&context, request, &response).error_code(),
+              grpc::StatusCode::RESOURCE_EXHAUSTED);
+    EXPECT_TRUE(client_->getFileLocation("too_big.dat").empty());
+    
+    // The failed batch released its reservations
+    request.mutable_chunks()->RemoveLast();
+    ChunkBatchAllocationResponse retry_response;
+    grpc::ClientContext retry_context;
+    EXPECT_TRUE(stub_->AllocateChunks(&retry_context, request, &retry_response).ok());
+    EXPECT_EQ(retry_response.chunks_size(), 3);
+    
+    ChunkBatchAllocationRequest empty_request;
+    empty_request.set_filename("nothing.dat");
+    ChunkBatchAllocationResponse empty_response;
+    grpc::ClientContext empty_context;
+    EXPECT_EQ(stub_->AllocateChunks(&empty_context, empty_request, &empty_response).error_code(),
+              grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST_F(MetaServerTest, LargeFileLocationLookup) {
+    DataNodeInfo info;
+    info.set_address("localhost:50052");
+    info.set_available_space(100 * 1024 * 1024 * 1024L);
+    Ack reg_response;
+    grpc::ClientContext reg_context;
+    ASSERT_TRUE(stub_->RegisterDataNode(&reg_context, info, &reg_response).ok());
+    
+    // Far more chunks than the MetaServer's location cache holds
+    const int num_chunks = 10000;
+    ChunkBatchAllocationRequest request;
+    request.set_filename("huge.dat");
+    for (int i = 0; i < num_chunks; ++i) {
+        ChunkSpec* spec = request.add_chunks();
+        spec->set_chunk_index(i);
+        spec->set_chunk_size(1024);
+    }
+    ChunkBatchAllocationResponse allocated;
+    grpc::ClientContext alloc_context;
+    ASSERT_TRUE(stub_->AllocateChunks(&alloc_context, request, &allocated).ok());
+    
+    // Twice: once cold, once partly served from the cache
+    for (int pass = 0; pass < 2; ++pass) {
+        auto locations = client_->getFileLocation("huge.dat");
+        ASSERT_EQ(locations.size(), num_chunks);
+        for (int i = 0; i < num_chunks; ++i) {
+            ASSERT_EQ(locations[i].chunk_index(), i);
+            ASSERT_EQ(locations[i].chunk_id(), allocated.chunks(i).chunk_id());
+            ASSERT_EQ(locations[i].datanode_addresses_size(), 1);
+        }
+    }
+}
+
 TEST_F(MetaServerTest, LoadBalancingWithMultipleDataNodes) {
     // Register multiple DataNodes with different capacities
     std::vector<std::string> datanode_addrs = {
@@ -205,10 +568,10 @@ TEST_F(MetaServerTest, LoadBalancingWithMultipleDataNodes) {
     const int num_allocations = 10;
     
     for (int i = 0; i < num_allocations; ++i) {
-        std::string chunk_id;
+        ChunkId chunk_id;
         std::vector<std::string> assigned_nodes;
         
-        ASSERT_TRUE(client_->allocateChunk("balanced_file.bin", i, 1024 * 1024, chunk_id, assigned_nodes));
+        ASSERT_TRUE(client_->allocateChunk("balanced_file.bin", i, 1024 * 1024, chunk_id, assigned_nodes, 1));
         ASSERT_EQ(assigned_nodes.size(), 1);
         
         allocations_per_node[assigned_nodes[0]]++;
@@ -230,7 +593,7 @@ TEST_F(MetaServerTest, StaleDataNodeCleanup) {
     ASSERT_TRUE(stub_->RegisterDataNode(&reg_context, info, &reg_response).ok());
     
     // Allocate a chunk successfully
-    std::string chunk_id;
+    ChunkId chunk_id;
     std::vector<std::string> datanode_addrs;
     ASSERT_TRUE(client_->allocateChunk("test_file.txt", 0, 1024, chunk_id, datanode_addrs));
     
@@ -247,6 +610,8 @@ TEST_F(MetaServerTest, StaleDataNodeCleanup) {
     heartbeat.set_address("localhost:50052");
     heartbeat.set_available_space(info.available_space());
     heartbeat.set_current_load(0);
+    heartbeat.set_sequence(1);
+    heartbeat.set_full_report(true);
     
     HeartbeatResponse hb_response;
     grpc::ClientContext hb_context;
@@ -278,7 +643,7 @@ TEST_F(MetaServerTest, ConcurrentClientRequests) {
             
             for (int i = 0; i < requests_per_thread; ++i) {
                 std::string filename = "thread_" + std::to_string(t) + "_file_" + std::to_string(i);
-                std::string chunk_id;
+                ChunkId chunk_id;
                 std::vector<std::string> datanode_addrs;
                 
                 if (thread_client.allocateChunk(filename, 0, 1024, chunk_id, datanode_addrs)) {
@@ -299,4 +664,634 @@ TEST_F(MetaServerTest, ConcurrentClientRequests) {
     int total_requests = num_threads * requests_per_thread;
     EXPECT_EQ(successful_allocations.load(), total_requests);
     EXPECT_EQ(failed_allocations.load(), 0);
-}
\ No newline at end of file
+}
+
+TEST(ManagerPersistenceTest, NamespaceSurvivesRestart) {
+    test_utils::TempDirectory metadata_dir;
+    const int64_t space = 10 * 1024 * 1024 * 1024L;
+    
+    std::vector<ChunkId> checkpointed_ids;
+    std::vector<ChunkId> logged_ids;
+    {
+        Cache cache(1000);
+        Manager manager(&cache);
+        ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+        manager.registerDataNode("localhost:50052", space);
+        
+        for (const auto& allocation : manager.allocateChunks("checkpointed.dat", {{0, 1024}, {1, 512}}, 1024)) {
+            checkpointed_ids.push_back(allocation.chunk_id);
+        }
+        ASSERT_TRUE(manager.checkpoint());
+        
+        // Only in the log tail
+        for (const auto& allocation : manager.allocateChunks("logged.dat", {{0, 2048}}, 4096)) {
+            logged_ids.push_back(allocation.chunk_id);
+        }
+    }
+    
+    Cache cache(1000);
+    Manager manager(&cache);
+    ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+    manager.registerDataNode("localhost:50052", space);
+    EXPECT_EQ(manager.getFileCount(), 2);
+    
+    auto [found, locations] = manager.getFileLocation("checkpointed.dat");
+    ASSERT_TRUE(found);
+    ASSERT_EQ(locations.size(), 2);
+    EXPECT_EQ(locations[0].chunk_id, checkpointed_ids[0]);
+    EXPECT_EQ(locations[1].chunk_id, checkpointed_ids[1]);
+    ASSERT_EQ(locations[1].datanode_ids.size(), 1);
+    EXPECT_EQ(manager.dataNodeAddress(locations[1].datanode_ids[0]), "localhost:50052");
+    
+    int64_t chunk_size = 0;
+    auto [logged_found, logged_locations] = manager.getFileLocation("logged.dat", &chunk_size);
+    ASSERT_TRUE(logged_found);
+    ASSERT_EQ(logged_locations.size(), 1);
+    EXPECT_EQ(logged_locations[0].chunk_id, logged_ids[0]);
+    EXPECT_EQ(chunk_size, 4096);
+    
+    // Ids issued before the restart are never reused
+    auto fresh = manager.allocateChunks("fresh.dat", {{0, 1024}}, 1024);
+    ASSERT_EQ(fresh.size(), 1);
+    EXPECT_EQ(std::count(checkpointed_ids.begin(), checkpointed_ids.end(), fresh[0].chunk_id), 0);
+    EXPECT_NE(fresh[0].chunk_id, logged_ids[0]);
+}
+
+TEST(ManagerPersistenceTest, ChangesOnTopOfImageSurviveNextCheckpoint) {
+    test_utils::TempDirectory metadata_dir;
+    const int64_t space = 10 * 1024 * 1024 * 1024L;
+    
+    std::vector<ChunkId> chunk_ids;
+    {
+        Cache cache(1000);
+        Manager manager(&cache);
+        ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+        manager.registerDataNode("localhost:50052", space);
+        for (const auto& allocation : manager.allocateChunks("growing.dat", {{0, 1024}, {1, 1024}}, 1024)) {
+            chunk_ids.push_back(allocation.chunk_id);
+        }
+        manager.allocateChunks("untouched.dat", {{0, 1024}}, 1024);
+        ASSERT_TRUE(manager.checkpoint());
+    }
+    
+    // Served from the image, then changed: a new replica and a new chunk
+    {
+        Cache cache(1000);
+        Manager manager(&cache);
+        ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+        manager.registerDataNode("localhost:50052", space);
+        EXPECT_EQ(manager.getFileCount(), 2);
+        
+        manager.updateDataNodeHeartbeat("localhost:50053", {chunk_ids[0]}, space, 0);
+        auto grown = manager.allocateChunks("growing.dat", {{2, 512}}, 1024, 1);
+        ASSERT_EQ(grown.size(), 1);
+        chunk_ids.push_back(grown[0].chunk_id);
+        
+        auto [found, locations] = manager.getFileLocation("growing.dat");
+        ASSERT_TRUE(found);
+        ASSERT_EQ(locations.size(), 3);
+        EXPECT_EQ(locations[0].datanode_ids.size(), 2);
+        EXPECT_EQ(manager.getFileCount(), 2);
+        
+        ASSERT_TRUE(manager.checkpoint());
+    }
+    
+    Cache cache(1000);
+    Manager manager(&cache);
+    ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+    manager.registerDataNode("localhost:50052", space);
+    manager.registerDataNode("localhost:50053", space);
+    EXPECT_EQ(manager.getFileCount(), 2);
+    
+    auto [found, locations] = manager.getFileLocation("growing.dat");
+    ASSERT_TRUE(found);
+    ASSERT_EQ(locations.size(), 3);
+    for (size_t i = 0; i < locations.size(); ++i) {
+        EXPECT_EQ(locations[i].chunk_id, chunk_ids[i]);
+    }
+    EXPECT_EQ(locations[0].datanode_ids.size(), 2);
+    EXPECT_EQ(locations[2].datanode_ids.size(), 1);
+    EXPECT_TRUE(manager.getFileLocation("untouched.dat").first);
+}
+
+TEST(ManagerPersistenceTest, DeletionsSurviveRestart) {
+    test_utils::TempDirectory metadata_dir;
+    const int64_t space = 10 * 1024 * 1024 * 1024L;
+    {
+        Cache cache(1000);
+        Manager manager(&cache);
+        ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+        manager.registerDataNode("localhost:50052", space);
+        manager.allocateChunks("imaged.dat", {{0, 1024}}, 1024);
+        manager.allocateChunks("kept.dat", {{0, 1024}}, 1024);
+        ASSERT_TRUE(manager.checkpoint());
+        
+        // One deletion shadows the image, the other a file only in the log
+        manager.allocateChunks("logged.dat", {{0, 1024}}, 1024);
+        EXPECT_TRUE(manager.deleteFile("imaged.dat"));
+        EXPECT_TRUE(manager.deleteFile("logged.dat"));
+        EXPECT_EQ(manager.getFileCount(), 1);
+    }
+    
+    {
+        Cache cache(1000);
+        Manager manager(&cache);
+        ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+        EXPECT_EQ(manager.getFileCount(), 1);
+        EXPECT_FALSE(manager.getFileLocation("imaged.dat").first);
+        EXPECT_FALSE(manager.getFileLocation("logged.dat").first);
+        
+        // Written again under the same name, then checkpointed without the old copy
+        manager.registerDataNode("localhost:50052", space);
+        ASSERT_EQ(manager.allocateChunks("imaged.dat", {{0, 512}}, 1024).size(), 1);
+        EXPECT_EQ(manager.getFileCount(), 2);
+        ASSERT_TRUE(manager.checkpoint());
+    }
+    
+    Cache cache(1000);
+    Manager manager(&cache);
+    ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+    manager.registerDataNode("localhost:50052", space);
+    EXPECT_EQ(manager.getFileCount(), 2);
+    auto [found, locations] = manager.getFileLocation("imaged.dat");
+    ASSERT_TRUE(found);
+    EXPECT_EQ(locations.size(), 1);
+    EXPECT_TRUE(manager.getFileLocation("kept.dat").first);
+}
+
+TEST(ManagerPersistenceTest, RewriteStartsTheFileOver) {
+    test_utils::TempDirectory metadata_dir;
+    Cache cache(1000);
+    Manager manager(&cache);
+    ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+    manager.registerDataNode("localhost:50052", 10 * 1024 * 1024 * 1024L);
+    
+    // Three 1 KB chunks, then written again as a single chunk of a 2 KB chunk size
+    ASSERT_EQ(manager.allocateChunks("shrunk.dat", {{0, 1024}, {1, 1024}, {2, 1024}}, 1024, 1).size(), 3);
+    auto rewritten = manager.allocateChunks("shrunk.dat", {{0, 1500}}, 2048, 1);
+    ASSERT_EQ(rewritten.size(), 1);
+    
+    int64_t chunk_size = 0;
+    auto [found, locations] = manager.getFileLocation("shrunk.dat", &chunk_size);
+    ASSERT_TRUE(found);
+    ASSERT_EQ(locations.size(), 1);
+    EXPECT_EQ(locations[0].chunk_id, rewritten[0].chunk_id);
+    EXPECT_EQ(chunk_size, 2048);
+    
+    ASSERT_TRUE(manager.checkpoint());
+    auto image = MetadataImage::open(metadata_dir.path() + "/image");
+    ASSERT_NE(image, nullptr);
+    auto file = image->findFile("shrunk.dat");
+    ASSERT_TRUE(file.has_value());
+    EXPECT_EQ(image->fileTotalSize(*file), 1500);
+    EXPECT_EQ(image->fileChunkSize(*file), 2048);
+    ASSERT_EQ(image->fileChunkCount(*file), 1);
+    EXPECT_EQ(image->fileChunkId(*file, 0), rewritten[0].chunk_id);
+}
+
+TEST(ManagerPlacementTest, PicksLeastLoadedNodeWithRoom) {
+    Cache cache(1000);
+    Manager manager(&cache);
+    const int64_t MB = 1024 * 1024;
+    manager.registerDataNode("localhost:50052", 10 * MB);
+    manager.registerDataNode("localhost:50053", 100 * MB);
+    manager.registerDataNode("localhost:50054", 1024);  // Too full for a 1 MB chunk
+    
+    auto placed = [&](int32_t chunk_index, int64_t chunk_size) {
+        auto [chunk_id, nodes] = manager.allocateChunkLocation("placed.dat", chunk_index, chunk_size, MB, 1);
+        return nodes.size() == 1 ? nodes[0] : std::string();
+    };
+    
+    // Equal load goes to the most free space; each pick raises its node's load
+    EXPECT_EQ(placed(0, MB), "localhost:50053");
+    EXPECT_EQ(placed(1, MB), "localhost:50052");
+    EXPECT_EQ(placed(2, MB), "localhost:50053");
+    
+    // The idle but nearly full node still takes what fits
+    EXPECT_EQ(placed(3, 512), "localhost:50054");
+    
+    // Heartbeats reposition a node
+    manager.updateDataNodeHeartbeat("localhost:50052", {}, 50 * MB, 0);
+    EXPECT_EQ(placed(4, MB), "localhost:50052");
+    
+    // Only live nodes are candidates
+    manager.removeStaleDataNodes();  // Everyone heartbeated just now
+    EXPECT_EQ(manager.getDataNodeCount(), 3);
+    manager.removeDataNode("localhost:50052");
+    manager.removeDataNode("localhost:50053");
+    EXPECT_EQ(placed(5, MB), "");
+    EXPECT_EQ(placed(5, 256), "localhost:50054");
+}
+
+TEST(ManagerPlacementTest, ReplicasGoToDistinctNodes) {
+    Cache cache(1000);
+    Manager manager(&cache);
+    const int64_t MB = 1024 * 1024;
+    manager.registerDataNode("localhost:50052", 100 * MB);
+    manager.registerDataNode("localhost:50053", 100 * MB);
+    manager.registerDataNode("localhost:50054", 100 * MB);
+    manager.registerDataNode("localhost:50055", 1024);  // No room for a full chunk
+    
+    auto allocations = manager.allocateChunks("replicated.dat", {{0, MB}, {1, MB}}, MB, 3);
+    ASSERT_EQ(allocations.size(), 2);
+    for (const auto& allocation : allocations) {
+        std::set<std::string> nodes(allocation.datanode_addresses.begin(), allocation.datanode_addresses.end());
+        EXPECT_EQ(allocation.datanode_addresses.size(), 3);
+        EXPECT_EQ(nodes.size(), 3);
+        EXPECT_EQ(nodes.count("localhost:50055"), 0);
+    }
+    
+    // Fewer nodes with room than asked for: placed on all of them, under-replicated
+    auto [chunk_id, nodes] = manager.allocateChunkLocation("wide.dat", 0, MB, MB, 5);
+    EXPECT_NE(chunk_id, NO_CHUNK);
+    EXPECT_EQ(nodes.size(), 3);
+    
+    // Lookups list every live replica
+    auto [found, locations] = manager.getFileLocation("replicated.dat");
+    ASSERT_TRUE(found);
+    ASSERT_EQ(locations.size(), 2);
+    EXPECT_EQ(locations[0].datanode_ids.size(), 3);
+}
+
+TEST_F(MetaServerTest, ReplicationFactorOutOfRange) {
+    ChunkAllocationRequest request;
+    request.set_filename("too_many.dat");
+    request.set_chunk_index(0);
+    request.set_chunk_size(1024);
+    request.set_replication_factor(MAX_REPLICATION_FACTOR + 1);
+    
+    ChunkLocation response;
+    grpc::ClientContext context;
+    EXPECT_EQ(stub_->AllocateChunkLocation(&context, request, &response).error_code(),
+              grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST(ManagerReplicationTest, RestoresReplicasOfLostNode) {
+    Cache cache(1000);
+    Manager manager(&cache);
+    const int64_t MB = 1024 * 1024;
+    const std::vector<std::string> addresses = {"localhost:50052", "localhost:50053", "localhost:50054"};
+    for (const auto& address : addresses) {
+        manager.registerDataNode(address, 100 * MB);
+    }
+    
+    auto allocations = manager.allocateChunks("recovered.dat", {{0, MB}, {1, MB}}, MB, 2);
+    ASSERT_EQ(allocations.size(), 2);
+    std::map<std::string, std::vector<ChunkId>> stored;
+    for (const auto& allocation : allocations) {
+        for (const auto& address : allocation.datanode_addresses) {
+            stored[address].push_back(allocation.chunk_id);
+        }
+    }
+    for (const auto& [address, chunks] : stored) {
+        manager.updateDataNodeHeartbeat(address, chunks, 100 * MB, 0);
+    }
+    EXPECT_EQ(manager.getUnderReplicatedCount(), 0);
+    EXPECT_EQ(manager.scheduleReplication(64 * MB), 0);
+    
+    // Every chunk the lost node held is one replica short
+    std::string lost = allocations[0].datanode_addresses[0];
+    manager.removeDataNode(lost);
+    size_t short_chunks = stored[lost].size();
+    EXPECT_EQ(manager.getUnderReplicatedCount(), short_chunks);
+    EXPECT_EQ(manager.scheduleReplication(64 * MB), short_chunks);
+    EXPECT_EQ(manager.scheduleReplication(64 * MB), 0);  // Already under way
+    
+    // Each copy goes from a surviving holder to the node without the chunk
+    size_t tasks_seen = 0;
+    for (const auto& address : addresses) {
+        for (const auto& task : manager.takeReplicationTasks(address)) {
+            const auto& holders = stored[address];
+            EXPECT_NE(std::find(holders.begin(), holders.end(), task.chunk_id), holders.end());
+            EXPECT_NE(task.target_address, lost);
+            EXPECT_NE(task.target_address, address);
+            
+            auto& target_chunks = stored[task.target_address];
+            EXPECT_EQ(std::find(target_chunks.begin(), target_chunks.end(), task.chunk_id), target_chunks.end());
+            target_chunks.push_back(task.chunk_id);
+            tasks_seen++;
+        }
+        EXPECT_TRUE(manager.takeReplicationTasks(address).empty());  // Handed out once
+    }
+    EXPECT_EQ(tasks_seen, short_chunks);
+    
+    // Copies land when their targets report them
+    for (const auto& address : addresses) {
+        if (address != lost) {
+            manager.updateDataNodeHeartbeat(address, stored[address], 100 * MB, 0);
+        }
+    }
+    EXPECT_EQ(manager.getUnderReplicatedCount(), 0);
+    
+    auto [found, locations] = manager.getFileLocation("recovered.dat");
+    ASSERT_TRUE(found);
+    ASSERT_EQ(locations.size(), 2);
+    for (const auto& location : locations) {
+        ASSERT_EQ(location.datanode_ids.size(), 2);
+        for (DataNodeId node : location.datanode_ids) {
+            EXPECT_NE(manager.dataNodeAddress(node), lost);
+        }
+    }
+}
+
+TEST(ManagerReplicationTest, RestoresReplicasOfNodeGoneAcrossRestart) {
+    test_utils::TempDirectory metadata_dir;
+    const int64_t MB = 1024 * 1024;
+    std::vector<ChunkAllocation> allocations;
+    {
+        Cache cache(1000);
+        Manager manager(&cache);
+        ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+        manager.registerDataNode("localhost:50052", 100 * MB);
+        manager.registerDataNode("localhost:50053", 100 * MB);
+        allocations = manager.allocateChunks("survivor.dat", {{0, MB}}, MB, 2);
+        ASSERT_EQ(allocations.size(), 1);
+    }
+    
+    // One holder comes back, the other never does; a new node has room
+    Cache cache(1000);
+    Manager manager(&cache);
+    ASSERT_TRUE(manager.openMetadata(metadata_dir.path()));
+    const std::string& back = allocations[0].datanode_addresses[0];
+    manager.updateDataNodeHeartbeat(back, {allocations[0].chunk_id}, 100 * MB, 0, 1);
+    manager.registerDataNode("localhost:50054", 100 * MB);
+    EXPECT_EQ(manager.getUnderReplicatedCount(), 0);
+    
+    manager.recheckReplicas();
+    EXPECT_EQ(manager.getUnderReplicatedCount(), 1);
+    EXPECT_EQ(manager.scheduleReplication(64 * MB), 1);
+    auto tasks = manager.takeReplicationTasks(back);
+    ASSERT_EQ(tasks.size(), 1);
+    EXPECT_EQ(tasks[0].chunk_id, allocations[0].chunk_id);
+    EXPECT_EQ(tasks[0].target_address, "localhost:50054");
+}
+
+TEST(ManagerReplicationTest, MostEndangeredChunksFirstWithinBudget) {
+    Cache cache(1000);
+    Manager manager(&cache);
+    const int64_t MB = 1024 * 1024;
+    const std::vector<std::string> addresses = {"localhost:50052", "localhost:50053", "localhost:50054"};
+    for (const auto& address : addresses) {
+        manager.registerDataNode(address, 100 * MB);
+    }
+    
+    // One chunk on every node, one on two of them
+    auto [wide_chunk, wide_nodes] = manager.allocateChunkLocation("wide.dat", 0, MB, MB, 3);
+    auto [narrow_chunk, narrow_nodes] = manager.allocateChunkLocation("narrow.dat", 0, MB, MB, 2);
+    ASSERT_EQ(wide_nodes.size(), 3);
+    ASSERT_EQ(narrow_nodes.size(), 2);
+    for (const auto& address : addresses) {
+        std::vector<ChunkId> chunks = {wide_chunk};
+        if (std::find(narrow_nodes.begin(), narrow_nodes.end(), address) != narrow_nodes.end()) {
+            chunks.push_back(narrow_chunk);
+        }
+        manager.updateDataNodeHeartbeat(address, chunks, 100 * MB, 0);
+    }
+    
+    // Lose all but one holder of each: both are down to their last copy, and
+    // the wide chunk is missing more
+    std::string survivor = narrow_nodes[1];
+    for (const auto& address : addresses) {
+        if (address != survivor) {
+            manager.removeDataNode(address);
+        }
+    }
+    manager.registerDataNode("localhost:50055", 100 * MB);
+    EXPECT_EQ(manager.getUnderReplicatedCount(), 2);
+    
+    // A budget of one chunk per round
+    EXPECT_EQ(manager.scheduleReplication(MB), 1);
+    auto tasks = manager.takeReplicationTasks(survivor);
+    ASSERT_EQ(tasks.size(), 1);
+    EXPECT_EQ(tasks[0].chunk_id, wide_chunk);
+    EXPECT_EQ(tasks[0].target_address, "localhost:50055");
+    
+    EXPECT_EQ(manager.scheduleReplication(MB), 1);
+    tasks = manager.takeReplicationTasks(survivor);
+    ASSERT_EQ(tasks.size(), 1);
+    EXPECT_EQ(tasks[0].chunk_id, narrow_chunk);
+    EXPECT_EQ(manager.getUnderReplicatedCount(), 2);  // Both still in flight
+}
+
+TEST(ManagerReplicationTest, UnderReplicatedAllocationCatchesUpWhenNodesJoin) {
+    Cache cache(1000);
+    Manager manager(&cache);
+    const int64_t MB = 1024 * 1024;
+    manager.registerDataNode("localhost:50052", 100 * MB);
+    
+    auto [chunk_id, nodes] = manager.allocateChunkLocation("lonely.dat", 0, MB, MB, 2);
+    ASSERT_EQ(nodes.size(), 1);
+    EXPECT_EQ(manager.getUnderReplicatedCount(), 1);
+    
+    // Nothing to copy until the write lands, and nowhere to copy it to
+    EXPECT_EQ(manager.scheduleReplication(64 * MB), 0);
+    manager.updateDataNodeHeartbeat("localhost:50052", {chunk_id}, 99 * MB, 0);
+    EXPECT_EQ(manager.scheduleReplication(64 * MB), 0);
+    
+    manager.registerDataNode("localhost:50053", 100 * MB);
+    EXPECT_EQ(manager.scheduleReplication(64 * MB), 1);
+    auto tasks = manager.takeReplicationTasks("localhost:50052");
+    ASSERT_EQ(tasks.size(), 1);
+    EXPECT_EQ(tasks[0].chunk_id, chunk_id);
+    EXPECT_EQ(tasks[0].target_address, "localhost:50053");
+    
+    manager.updateDataNodeHeartbeat("localhost:50053", {chunk_id}, 99 * MB, 0);
+    EXPECT_EQ(manager.getUnderReplicatedCount(), 0);
+}
+
+TEST(ManagerRebalanceTest, MovesChunksToNewNodesUntilWithinBand) {
+    Cache cache(1000);
+    Manager manager(&cache);
+    const int64_t MB = 1024 * 1024;
+    const int64_t capacity = 100 * MB;
+    std::map<std::string, std::set<ChunkId>> stored;
+    auto report = [&](const std::string& address) {
+        const auto& chunks = stored[address];
+        manager.updateDataNodeHeartbeat(address, std::vector<ChunkId>(chunks.begin(), chunks.end()),
+                                        capacity - static_cast<int64_t>(chunks.size()) * MB, 0, 0, capacity);
+    };
+    auto utilization = [&](const std::string& address) {
+        return static_cast<double>(stored[address].size()) * MB / capacity;
+    };
+    
+    // An old node holds everything; two new ones join empty
+    const std::string old_node = "localhost:50052";
+    manager.registerDataNode(old_node, capacity);
+    std::vector<std::pair<int32_t, int64_t>> chunks;
+    for (int32_t i = 0; i < 20; ++i) {
+        chunks.emplace_back(i, MB);
+    }
+    auto allocations = manager.allocateChunks("old.dat", chunks, MB, 1);
+    ASSERT_EQ(allocations.size(), 20);
+    for (const auto& allocation : allocations) {
+        stored[old_node].insert(allocation.chunk_id);
+    }
+    report(old_node);
+    for (const std::string address : {"localhost:50053", "localhost:50054"}) {
+        manager.registerDataNode(address, capacity);
+        report(address);
+    }
+    
+    const double band = 0.05;
+    size_t moved = 0;
+    for (int round = 0; round < 20; ++round) {
+        size_t scheduled = manager.scheduleRebalance(band, 64 * MB);
+        if (scheduled == 0) {
+            break;
+        }
+        EXPECT_LE(scheduled, MAX_REPLICATION_STREAMS);
+        
+        auto tasks = manager.takeReplicationTasks(old_node);
+        ASSERT_EQ(tasks.size(), scheduled);
+        for (const auto& task : tasks) {
+            EXPECT_NE(task.target_address, old_node);
+            stored[task.target_address].insert(task.chunk_id);
+        }
+        
+        // The old node keeps its replicas until the new ones are confirmed
+        EXPECT_TRUE(manager.takeDeletionTasks(old_node).empty());
+        for (const std::string address : {"localhost:50053", "localhost:50054"}) {
+            report(address);
+        }
+        auto deletions = manager.takeDeletionTasks(old_node);
+        ASSERT_EQ(deletions.size(), scheduled);
+        for (ChunkId chunk_id : deletions) {
+            EXPECT_EQ(stored[old_node].erase(chunk_id), 1);
+        }
+        report(old_node);
+        moved += scheduled;
+    }
+    EXPECT_GT(moved, 0);
+    
+    // Every node within the band of the cluster's 20% of 300 MB, and each
+    // chunk still has exactly one replica
+    const double mean = 20.0 / 300;
+    for (const auto& [address, chunk_ids] : stored) {
+        EXPECT_LE(std::abs(utilization(address) - mean), band) << address;
+    }
+    EXPECT_EQ(manager.scheduleRebalance(band, 64 * MB), 0);
+    auto [found, locations] = manager.getFileLocation("old.dat");
+    ASSERT_TRUE(found);
+    ASSERT_EQ(locations.size(), 20);
+    for (const auto& location : locations) {
+        ASSERT_EQ(location.datanode_ids.size(), 1);
+        EXPECT_EQ(stored[manager.dataNodeAddress(location.datanode_ids[0])].count(location.chunk_id), 1);
+    }
+}
+
+TEST(ManagerRebalanceTest, WaitsForReplicationAndLeavesBalancedClustersAlone) {
+    Cache cache(1000);
+    Manager manager(&cache);
+    const int64_t MB = 1024 * 1024;
+    manager.registerDataNode("localhost:50052", 100 * MB);
+    auto [chunk_id, nodes] = manager.allocateChunkLocation("short.dat", 0, MB, MB, 2);
+    ASSERT_EQ(nodes.size(), 1);
+    manager.updateDataNodeHeartbeat("localhost:50052", {chunk_id}, 50 * MB, 0, 0, 100 * MB);
+    manager.updateDataNodeHeartbeat("localhost:50053", {}, 100 * MB, 0, 0, 100 * MB);
+    
+    // Half full next to empty, but the chunk is short a replica: recovery first
+    EXPECT_EQ(manager.getUnderReplicatedCount(), 1);
+    EXPECT_EQ(manager.scheduleRebalance(0.1, 64 * MB), 0);
+    
+    // Nodes within the band don't move anything
+    manager.updateDataNodeHeartbeat("localhost:50053", {chunk_id}, 55 * MB, 0, 0, 100 * MB);
+    EXPECT_EQ(manager.getUnderReplicatedCount(), 0);
+    EXPECT_EQ(manager.scheduleRebalance(0.1, 64 * MB), 0);
+}
+
+TEST(ManagerDeletionTest, DeletedFilesChunksAreDeletedFromTheirReplicas) {
+    Cache cache(1000);
+    Manager manager(&cache);
+    const int64_t MB = 1024 * 1024;
+    const std::vector<std::string> addresses = {"localhost:50052", "localhost:50053", "localhost:50054"};
+    for (const auto& address : addresses) {
+        manager.registerDataNode(address, 100 * MB);
+    }
+    
+    auto allocations = manager.allocateChunks("doomed.dat", {{0, MB}, {1, MB}}, MB, 2);
+    ASSERT_EQ(allocations.size(), 2);
+    manager.allocateChunks("kept.dat", {{0, MB}}, MB, 2);
+    std::map<std::string, std::set<ChunkId>> stored;
+    for (const auto& allocation : allocations) {
+        for (const auto& address : allocation.datanode_addresses) {
+            stored[address].insert(allocation.chunk_id);
+        }
+    }
+    
+    EXPECT_TRUE(manager.deleteFile("doomed.dat"));
+    EXPECT_FALSE(manager.deleteFile("doomed.dat"));
+    EXPECT_FALSE(manager.getFileLocation("doomed.dat").first);
+    EXPECT_TRUE(manager.getFileLocation("kept.dat").first);
+    EXPECT_EQ(manager.getFileCount(), 1);
+    
+    // Each replica is deleted by the node holding it, once
+    for (const auto& address : addresses) {
+        auto deletions = manager.takeDeletionTasks(address);
+        EXPECT_EQ(std::set<ChunkId>(deletions.begin(), deletions.end()), stored[address]);
+        EXPECT_TRUE(manager.takeDeletionTasks(address).empty());
+    }
+}
+
+TEST(ManagerDeletionTest, ShorterRewriteDeletesEveryOldChunk) {
+    Cache cache(1000);
+    Manager manager(&cache);
+    const int64_t MB = 1024 * 1024;
+    const std::string address = "localhost:50052";
+    manager.registerDataNode(address, 100 * MB);
+    
+    // The old tail has no new chunk in its place but is deleted all the same
+    auto first = manager.allocateChunks("shrunk.dat", {{0, MB}, {1, MB}, {2, MB}}, MB, 1);
+    ASSERT_EQ(first.size(), 3);
+    ASSERT_EQ(manager.allocateChunks("shrunk.dat", {{0, 1024}}, MB, 1).size(), 1);
+    
+    auto deletions = manager.takeDeletionTasks(address);
+    EXPECT_EQ(std::set<ChunkId>(deletions.begin(), deletions.end()),
+              std::set<ChunkId>({first[0].chunk_id, first[1].chunk_id, first[2].chunk_id}));
+    EXPECT_TRUE(manager.takeDeletionTasks(address).empty());
+}
+
+TEST(ManagerDeletionTest, OrphanedChunksAreDeletedInBatches) {
+    Cache cache(1000);
+    Manager manager(&cache);
+    const int64_t MB = 1024 * 1024;
+    const std::string address = "localhost:50052";
+    manager.registerDataNode(address, 100 * MB);
+    
+    // A rewrite replaces the file's chunk; the old one is reclaimed
+    auto first = manager.allocateChunks("rewritten.dat", {{0, 1024}}, MB, 1);
+    auto second = manager.allocateChunks("rewritten.dat", {{0, 1024}}, MB, 1);
+    ASSERT_EQ(first.size(), 1);
+    ASSERT_EQ(second.size(), 1);
+    EXPECT_EQ(manager.takeDeletionTasks(address), std::vector<ChunkId>{first[0].chunk_id});
+    
+    // Ids issued here that no file owns, as left behind by an upload whose
+    // file was deleted meanwhile, are orphans; ids above the counter aren't
+    // this MetaServer's to judge
+    std::vector<ChunkId> reported = {first[0].chunk_id, second[0].chunk_id};
+    auto filler = manager.allocateChunks("filler.dat", {{0, 0}}, MB, 1);  // No DataNode needed
+    for (size_t i = 0; i < MAX_DELETIONS_PER_HEARTBEAT + 10; ++i) {
+        filler = manager.allocateChunks("filler.dat", {{0, 0}}, MB, 1);
+        reported.push_back(filler[0].chunk_id);
+    }
+    ChunkId unissued = filler[0].chunk_id + 1000;
+    reported.push_back(unissued);
+    manager.updateDataNodeHeartbeat(address, reported, 100 * MB, 0);
+    
+    std::set<ChunkId> deleted;
+    auto batch = manager.takeDeletionTasks(address);
+    EXPECT_EQ(batch.size(), MAX_DELETIONS_PER_HEARTBEAT);
+    deleted.insert(batch.begin(), batch.end());
+    batch = manager.takeDeletionTasks(address);
+    EXPECT_EQ(batch.size(), reported.size() - 2 - MAX_DELETIONS_PER_HEARTBEAT);
+    deleted.insert(batch.begin(), batch.end());
+    EXPECT_TRUE(manager.takeDeletionTasks(address).empty());
+    
+    EXPECT_TRUE(deleted.count(first[0].chunk_id));
+    EXPECT_FALSE(deleted.count(second[0].chunk_id));
+    EXPECT_FALSE(deleted.count(unissued));
+    
+    auto [found, locations] = manager.getFileLocation("rewritten.dat");
+    ASSERT_TRUE(found);
+    ASSERT_EQ(locations.size(), 1);
+    EXPECT_EQ(locations[0].chunk_id, second[0].chunk_id);
+}
@@ -3,6 +3,9 @@
 #include "unit_test_utils.hpp"
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
 
 class CacheTest : public ::testing::Test {
 protected:
@@ -10,11 +13,11 @@ protected:
         cache_ = std::make_unique<Cache>(3); // Small capacity for testing
     }
     
-    ChunkLocationInfo createTestChunkInfo(const std::string& chunk_id, 
-                                         const std::vector<std::string>& addresses) {
+    ChunkLocationInfo createTestChunkInfo(ChunkId chunk_id, 
+                                         const std::vector<DataNodeId>& nodes) {
         ChunkLocationInfo info;
         info.chunk_id = chunk_id;
-        info.datanode_addresses = addresses;
+        info.datanode_ids = nodes;
         return info;
     }
     
@@ -22,119 +25,139 @@ protected:
 };
 
 TEST_F(CacheTest, BasicPutAndGet) {
-    auto info = createTestChunkInfo("chunk1", {"node1", "node2"});
+    auto info = createTestChunkInfo(1, {1, 2});
     
-    cache_->put("chunk1", info);
+    cache_->put(1, info);
     
-    auto retrieved = cache_->get("chunk1");
+    auto retrieved = cache_->get(1);
     ASSERT_TRUE(retrieved.has_value());
-    EXPECT_EQ(retrieved->chunk_id, "chunk1");
-    EXPECT_EQ(retrieved->datanode_addresses.size(), 2);
-    EXPECT_EQ(retrieved->datanode_addresses[0], "node1");
-    EXPECT_EQ(retrieved->datanode_addresses[1], "node2");
+    EXPECT_EQ(retrieved->chunk_id, 1);
+    EXPECT_EQ(retrieved->datanode_ids.size(), 2);
+    EXPECT_EQ(retrieved->datanode_ids[0], 1);
+    EXPECT_EQ(retrieved->datanode_ids[1], 2);
 }
 
 TEST_F(CacheTest, GetNonExistentChunk) {
-    auto result = cache_->get("nonexistent");
+    auto result = cache_->get(999);
     EXPECT_FALSE(result.has_value());
 }
 
 TEST_F(CacheTest, UpdateExistingChunk) {
-    auto info1 = createTestChunkInfo("chunk1", {"node1"});
-    auto info2 = createTestChunkInfo("chunk1", {"node2", "node3"});
+    auto info1 = createTestChunkInfo(1, {1});
+    auto info2 = createTestChunkInfo(1, {2, 3});
     
-    cache_->put("chunk1", info1);
-    cache_->put("chunk1", info2);
+    cache_->put(1, info1);
+    cache_->put(1, info2);
     
-    auto retrieved = cache_->get("chunk1");
+    auto retrieved = cache_->get(1);
     ASSERT_TRUE(retrieved.has_value());
-    EXPECT_EQ(retrieved->datanode_addresses.size(), 2);
-    EXPECT_EQ(retrieved->datanode_addresses[0], "node2");
-    EXPECT_EQ(retrieved->datanode_addresses[1], "node3");
+    EXPECT_EQ(retrieved->datanode_ids.size(), 2);
+    EXPECT_EQ(retrieved->datanode_ids[0], 2);
+    EXPECT_EQ(retrieved->datanode_ids[1], 3);
 }
 
 TEST_F(CacheTest, LRUEviction) {
-    auto info1 = createTestChunkInfo("chunk1", {"node1"});
-    auto info2 = createTestChunkInfo("chunk2", {"node2"});
-    auto info3 = createTestChunkInfo("chunk3", {"node3"});
-    auto info4 = createTestChunkInfo("chunk4", {"node4"});
+    auto info1 = createTestChunkInfo(1, {1});
+    auto info2 = createTestChunkInfo(2, {2});
+    auto info3 = createTestChunkInfo(3, {3});
+    auto info4 = createTestChunkInfo(4, {4});
     
     // Fill cache to capacity
-    cache_->put("chunk1", info1);
-    cache_->put("chunk2", info2);
-    cache_->put("chunk3", info3);
+    cache_->put(1, info1);
+    cache_->put(2, info2);
+    cache_->put(3, info3);
     
     EXPECT_EQ(cache_->size(), 3);
     
     // Add one more item, should evict least recently used (chunk1)
-    cache_->put("chunk4", info4);
+    cache_->put(4, info4);
     
     EXPECT_EQ(cache_->size(), 3);
-    EXPECT_FALSE(cache_->get("chunk1").has_value()); // Should be evicted
-    EXPECT_TRUE(cache_->get("chunk2").has_value());
-    EXPECT_TRUE(cache_->get("chunk3").has_value());
-    EXPECT_TRUE(cache_->get("chunk4").has_value());
+    EXPECT_FALSE(cache_->get(1).has_value()); // Should be evicted
+    EXPECT_TRUE(cache_->get(2).has_value());
+    EXPECT_TRUE(cache_->get(3).has_value());
+    EXPECT_TRUE(cache_->get(4).has_value());
 }
 
 TEST_F(CacheTest, LRUOrderingWithGet) {
-    auto info1 = createTestChunkInfo("chunk1", {"node1"});
-    auto info2 = createTestChunkInfo("chunk2", {"node2"});
-    auto info3 = createTestChunkInfo("chunk3", {"node3"});
-    auto info4 = createTestChunkInfo("chunk4", {"node4"});
+    auto info1 = createTestChunkInfo(1, {1});
+    auto info2 = createTestChunkInfo(2, {2});
+    auto info3 = createTestChunkInfo(3, {3});
+    auto info4 = createTestChunkInfo(4, {4});
     
     // Fill cache
-    cache_->put("chunk1", info1);
-    cache_->put("chunk2", info2);
-    cache_->put("chunk3", info3);
+    cache_->put(1, info1);
+    cache_->put(2, info2);
+    cache_->put(3, info3);
     
     // Access chunk1, making it most recently used
-    cache_->get("chunk1");
+    cache_->get(1);
     
     // Add chunk4, should evict chunk2 (now least recently used)
-    cache_->put("chunk4", info4);
+    cache_->put(4, info4);
     
-    EXPECT_TRUE(cache_->get("chunk1").has_value());  // Should still exist
-    EXPECT_FALSE(cache_->get("chunk2").has_value()); // Should be evicted
-    EXPECT_TRUE(cache_->get("chunk3").has_value());
-    EXPECT_TRUE(cache_->get("chunk4").has_value());
+    EXPECT_TRUE(cache_->get(1).has_value());  // Should still exist
+    EXPECT_FALSE(cache_->get(2).has_value()); // Should be evicted
+    EXPECT_TRUE(cache_->get(3).has_value());
+    EXPECT_TRUE(cache_->get(4).has_value());
+}
+
+TEST_F(CacheTest, GetSharedAvoidsCopies) {
+    cache_->put(1, createTestChunkInfo(1, {1, 2}));
+    
+    // Hits share one entry rather than copying it
+    auto first = cache_->getShared(1);
+    auto second = cache_->getShared(1);
+    ASSERT_NE(first, nullptr);
+    EXPECT_EQ(first.get(), second.get());
+    EXPECT_EQ(first->datanode_ids.size(), 2);
+    EXPECT_EQ(cache_->getShared(999), nullptr);
+    
+    // A held entry outlives its eviction and isn't changed by later puts
+    cache_->put(1, createTestChunkInfo(1, {3}));
+    cache_->put(2, createTestChunkInfo(2, {2}));
+    cache_->put(3, createTestChunkInfo(3, {3}));
+    cache_->put(4, createTestChunkInfo(4, {4}));
+    EXPECT_FALSE(cache_->get(1).has_value());
+    EXPECT_EQ(first->datanode_ids[0], 1);
 }
 
 TEST_F(CacheTest, RemoveChunk) {
-    auto info1 = createTestChunkInfo("chunk1", {"node1"});
-    auto info2 = createTestChunkInfo("chunk2", {"node2"});
+    auto info1 = createTestChunkInfo(1, {1});
+    auto info2 = createTestChunkInfo(2, {2});
     
-    cache_->put("chunk1", info1);
-    cache_->put("chunk2", info2);
+    cache_->put(1, info1);
+    cache_->put(2, info2);
     
     EXPECT_EQ(cache_->size(), 2);
-    EXPECT_TRUE(cache_->get("chunk1").has_value());
+    EXPECT_TRUE(cache_->get(1).has_value());
     
-    cache_->remove("chunk1");
+    cache_->remove(1);
     
     EXPECT_EQ(cache_->size(), 1);
-    EXPECT_FALSE(cache_->get("chunk1").has_value());
-    EXPECT_TRUE(cache_->get("chunk2").has_value());
+    EXPECT_FALSE(cache_->get(1).has_value());
+    EXPECT_TRUE(cache_->get(2).has_value());
 }
 
 TEST_F(CacheTest, RemoveNonExistentChunk) {
-    cache_->remove("nonexistent");
+    cache_->remove(999);
     EXPECT_EQ(cache_->size(), 0);
 }
 
 TEST_F(CacheTest, ClearCache) {
-    auto info1 = createTestChunkInfo("chunk1", {"node1"});
-    auto info2 = createTestChunkInfo("chunk2", {"node2"});
+    auto info1 = createTestChunkInfo(1, {1});
+    auto info2 = createTestChunkInfo(2, {2});
     
-    cache_->put("chunk1", info1);
-    cache_->put("chunk2", info2);
+    cache_->put(1, info1);
+    cache_->put(2, info2);
     
     EXPECT_EQ(cache_->size(), 2);
     
     cache_->clear();
     
     EXPECT_EQ(cache_->size(), 0);
-    EXPECT_FALSE(cache_->get("chunk1").has_value());
-    EXPECT_FALSE(cache_->get("chunk2").has_value());
+    EXPECT_FALSE(cache_->get(1).has_value());
+    EXPECT_FALSE(cache_->get(2).has_value());
 }
 
 TEST_F(CacheTest, ThreadSafety) {
@@ -148,10 +171,8 @@ TEST_F(CacheTest, ThreadSafety) {
     for (int t = 0; t < num_threads; ++t) {
         threads.emplace_back([&, t]() {
             for (int i = 0; i < operations_per_thread; ++i) {
-                std::string chunk_id = "chunk_" + std::to_string(t) + "_" + std::to_string(i);
-                std::string node_addr = "node_" + std::to_string(t);
-                
-                auto info = createTestChunkInfo(chunk_id, {node_addr});
+                ChunkId chunk_id = t * operations_per_thread + i + 1;
+                auto info = createTestChunkInfo(chunk_id, {static_cast<DataNodeId>(t)});
                 
                 // Put and get
                 cache_->put(chunk_id, info);
@@ -172,4 +193,245 @@ TEST_F(CacheTest, ThreadSafety) {
     // Due to LRU eviction, not all operations will succeed, but there should be no crashes
     EXPECT_GT(successful_operations.load(), 0);
     EXPECT_LE(cache_->size(), 3); // Capacity limit
-}
\ No newline at end of file
+}
+
+TEST_F(CacheTest, SmallCachesKeepExactLRU) {
+    // Shards below MIN_SHARD_CAPACITY would make eviction order unpredictable
+    EXPECT_EQ(Cache(3).shardCount(), 1);
+    EXPECT_EQ(Cache(3, 16).shardCount(), 1);
+    EXPECT_EQ(Cache(100000, 16).shardCount(), 16);
+}
+
+TEST_F(CacheTest, ShardedCapacityAndOperations) {
+    Cache cache(1024, 8);
+    ASSERT_EQ(cache.shardCount(), 8);
+    
+    for (int i = 0; i < 5000; ++i) {
+        ChunkId chunk_id = i + 1;
+        cache.put(chunk_id, createTestChunkInfo(chunk_id, {1}));
+    }
+    EXPECT_LE(cache.size(), 1024);
+    EXPECT_GT(cache.size(), 900);  // Hashing spreads entries over all shards
+    
+    // The most recent entries survived, and remove/clear reach every shard
+    for (int i = 4990; i < 5000; ++i) {
+        ChunkId chunk_id = i + 1;
+        ASSERT_TRUE(cache.get(chunk_id).has_value());
+        cache.remove(chunk_id);
+        EXPECT_FALSE(cache.get(chunk_id).has_value());
+    }
+    cache.clear();
+    EXPECT_EQ(cache.size(), 0);
+}
+
+TEST_F(CacheTest, HitMissCounters) {
+    cache_->put(1, createTestChunkInfo(1, {1}));
+    cache_->get(1);
+    cache_->getShared(1);
+    cache_->get(999);
+    
+    CacheStats stats = cache_->stats();
+    EXPECT_EQ(stats.hits, 2);
+    EXPECT_EQ(stats.misses, 1);
+}
+
+TEST_F(CacheTest, FrequencySketchCountsAndAges) {
+    FrequencySketch sketch(100);
+    for (int i = 0; i < 5; ++i) {
+        sketch.increment(42);
+    }
+    EXPECT_EQ(sketch.estimate(42), 5);
+    EXPECT_EQ(sketch.estimate(43), 0);
+    
+    // Counters saturate rather than wrap
+    for (int i = 0; i < 20; ++i) {
+        sketch.increment(7);
+    }
+    EXPECT_EQ(sketch.estimate(7), 15);
+    
+    // After 10x capacity additions everything is halved
+    for (uint64_t key = 1000; key < 2000; ++key) {
+        sketch.increment(key);
+    }
+    EXPECT_LT(sketch.estimate(42), 5);
+    EXPECT_LT(sketch.estimate(7), 15);
+}
+
+// A small hot set looked up steadily while a long one-pass scan streams
+// through; returns the hot set's hit rate during the scan. Between two
+// lookups of a hot entry the scan touches more chunks than the cache holds,
+// so recency alone can't keep it.
+static double hotSetHitRateDuringScan(Cache& cache) {
+    const ChunkId HOT_BASE = 1;
+    const ChunkId SCAN_BASE = 1000;
+    auto lookup = [&cache](ChunkId chunk_id) {
+        if (cache.get(chunk_id).has_value()) {
+            return true;
+        }
+        ChunkLocationInfo info;
+        info.chunk_id = chunk_id;
+        info.datanode_ids = {1};
+        cache.put(chunk_id, info);
+        return false;
+    };
+    
+    for (int round = 0; round < 5; ++round) {
+        for (int i = 0; i < 200; ++i) {
+            lookup(HOT_BASE + i);
+        }
+    }
+    
+    int hot_lookups = 0;
+    int hot_hits = 0;
+    for (int i = 0; i < 50000; ++i) {
+        lookup(SCAN_BASE + i);
+        if (i % 5 == 0) {
+            hot_hits += lookup(HOT_BASE + (i / 5) % 200) ? 1 : 0;
+            hot_lookups++;
+        }
+    }
+    return static_cast<double>(hot_hits) / hot_lookups;
+}
+
+TEST_F(CacheTest, TinyLFUResistsScans) {
+    Cache lru(1000, 1, CachePolicy::LRU);
+    Cache tinylfu(1000, 1, CachePolicy::TinyLFU);
+    
+    // The scan flushes a plain LRU but can't displace frequently used entries
+    EXPECT_LT(hotSetHitRateDuringScan(lru), 0.05);
+    EXPECT_GT(hotSetHitRateDuringScan(tinylfu), 0.9);
+    EXPECT_LE(tinylfu.size(), 1000);
+}
+
+TEST_F(CacheTest, TinyLFUBasicOperations) {
+    Cache cache(500, 4, CachePolicy::TinyLFU);
+    EXPECT_EQ(cache.getPolicy(), CachePolicy::TinyLFU);
+    
+    for (int i = 0; i < 300; ++i) {
+        ChunkId chunk_id = i + 1;
+        cache.put(chunk_id, createTestChunkInfo(chunk_id, {1}));
+    }
+    EXPECT_EQ(cache.size(), 300);  // Room in main for everything
+    
+    // Updates, removes and clear work whichever segment holds the entry
+    cache.put(1, createTestChunkInfo(1, {7}));
+    EXPECT_EQ(cache.get(1)->datanode_ids[0], 7);
+    cache.remove(1);
+    cache.remove(300);
+    EXPECT_FALSE(cache.get(1).has_value());
+    EXPECT_FALSE(cache.get(300).has_value());
+    EXPECT_EQ(cache.size(), 298);
+    cache.clear();
+    EXPECT_EQ(cache.size(), 0);
+}
+
+// Not a pass/fail check: prints hit throughput of one shard (a single global
+// lock, like the old cache) against the default sharding, 1 to 32 readers
+TEST_F(CacheTest, ReaderScalingBenchmark) {
+    const size_t capacity = 100000;
+    const int keys = 50000;
+    const auto duration = std::chrono::milliseconds(100);
+    
+    std::vector<ChunkId> chunk_ids;
+    for (int i = 0; i < keys; ++i) {
+        chunk_ids.push_back(i + 1);
+    }
+    
+    auto run = [&](Cache& cache, int num_threads) {
+        std::atomic<bool> stop{false};
+        std::atomic<uint64_t> total_hits{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t) {
+            threads.emplace_back([&, t]() {
+                uint64_t hits = 0;
+                size_t i = t * 7919;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    if (cache.getShared(chunk_ids[i % keys])) {
+                        hits++;
+                    }
+                    i += 31;
+                }
+                total_hits += hits;
+            });
+        }
+        std::this_thread::sleep_for(duration);
+        stop = true;
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return total_hits.load() * 1000.0 / duration.count();
+    };
+    
+    Cache single(capacity, 1);
+    Cache sharded(capacity);
+    for (ChunkId chunk_id : chunk_ids) {
+        auto info = createTestChunkInfo(chunk_id, {1, 2, 3});
+        single.put(chunk_id, info);
+        sharded.put(chunk_id, info);
+    }
+    
+    std::cout << "\nCache reader scaling (lookups/s), " << sharded.shardCount() << " shards:\n";
+    std::cout << "  threads   1 shard        sharded\n";
+    for (int num_threads : {1, 2, 4, 8, 16, 32}) {
+        double single_rate = run(single, num_threads);
+        double sharded_rate = run(sharded, num_threads);
+        std::cout << "  " << std::setw(7) << num_threads
+                  << std::setw(12) << static_cast<uint64_t>(single_rate)
+                  << std::setw(15) << static_cast<uint64_t>(sharded_rate) << "\n";
+        EXPECT_GT(sharded_rate, 0);
+    }
+}
+
+TEST_F(CacheTest, FileLocationCacheBasicOperations) {
+    FileAnswerCache<std::string> files(100);
+    
+    EXPECT_EQ(files.get("a.txt"), nullptr);
+    files.put("a.txt", std::make_shared<const std::string>("answer-a"), files.generation("a.txt"));
+    
+    auto entry = files.get("a.txt");
+    ASSERT_NE(entry, nullptr);
+    EXPECT_EQ(*entry, "answer-a");
+    
+    files.invalidate("a.txt");
+    EXPECT_EQ(files.get("a.txt"), nullptr);
+    EXPECT_EQ(files.size(), 0);
+    
+    CacheStats stats = files.stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 2);
+}
+
+TEST_F(CacheTest, FileLocationCacheDropsAnswersBuiltBeforeInvalidation) {
+    FileAnswerCache<std::string> files(100);
+    
+    // An answer assembled from metadata that changed meanwhile isn't cached
+    uint64_t generation = files.generation("a.txt");
+    files.invalidate("a.txt");
+    files.put("a.txt", std::make_shared<const std::string>("stale"), generation);
+    EXPECT_EQ(files.get("a.txt"), nullptr);
+    
+    generation = files.generation("a.txt");
+    files.clear();
+    files.put("a.txt", std::make_shared<const std::string>("stale"), generation);
+    EXPECT_EQ(files.get("a.txt"), nullptr);
+    
+    files.put("a.txt", std::make_shared<const std::string>("fresh"), files.generation("a.txt"));
+    ASSERT_NE(files.get("a.txt"), nullptr);
+    EXPECT_EQ(*files.get("a.txt"), "fresh");
+}
+
+TEST_F(CacheTest, FileLocationCacheEvictsLeastRecentlyUsed) {
+    FileAnswerCache<std::string> files(3, 1);
+    
+    for (int i = 0; i < 3; ++i) {
+        std::string name = "file_" + std::to_string(i);
+        files.put(name, std::make_shared<const std::string>(name), files.generation(name));
+    }
+    files.get("file_0");
+    files.put("file_3", std::make_shared<const std::string>("file_3"), files.generation("file_3"));
+    
+    EXPECT_EQ(files.size(), 3);
+    EXPECT_NE(files.get("file_0"), nullptr);
+    EXPECT_EQ(files.get("file_1"), nullptr);
+    EXPECT_NE(files.get("file_3"), nullptr);
+}
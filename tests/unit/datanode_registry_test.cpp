@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include "datanode_registry.hpp"
+#include <thread>
+#include <vector>
+
+TEST(DataNodeRegistryTest, InternAssignsStableIds) {
+    DataNodeRegistry registry;
+    EXPECT_EQ(registry.size(), 0);
+    EXPECT_FALSE(registry.find("node1:50052").has_value());
+
+    DataNodeId first = registry.intern("node1:50052");
+    DataNodeId second = registry.intern("node2:50052");
+    EXPECT_NE(first, second);
+    EXPECT_EQ(registry.intern("node1:50052"), first);
+    EXPECT_EQ(registry.find("node2:50052"), second);
+    EXPECT_EQ(registry.size(), 2);
+
+    EXPECT_EQ(registry.address(first), "node1:50052");
+    EXPECT_EQ(registry.address(second), "node2:50052");
+    EXPECT_EQ(registry.address(2), "");  // Never assigned
+    EXPECT_EQ(registry.address(NO_DATANODE), "");
+}
+
+TEST(DataNodeRegistryTest, AddressesStayPutAsRegistryGrows) {
+    DataNodeRegistry registry;
+    DataNodeId first = registry.intern("node0");
+    const std::string* address = &registry.address(first);
+
+    // Spans several blocks
+    for (int i = 1; i < 5000; ++i) {
+        EXPECT_EQ(registry.intern("node" + std::to_string(i)), static_cast<DataNodeId>(i));
+    }
+    EXPECT_EQ(&registry.address(first), address);
+    for (DataNodeId id : {0u, 63u, 64u, 191u, 192u, 4999u}) {
+        EXPECT_EQ(registry.address(id), "node" + std::to_string(id));
+    }
+}
+
+TEST(DataNodeRegistryTest, ConcurrentInternAndLookup) {
+    DataNodeRegistry registry;
+    const int num_threads = 8;
+    const int addresses_per_thread = 500;
+
+    // Every thread interns the same addresses and reads back whatever is assigned
+    std::vector<std::thread> threads;
+    std::vector<std::vector<DataNodeId>> seen(num_threads);
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < addresses_per_thread; ++i) {
+                std::string address = "node" + std::to_string(i);
+                DataNodeId id = registry.intern(address);
+                EXPECT_EQ(registry.address(id), address);
+                seen[t].push_back(id);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(registry.size(), addresses_per_thread);
+    for (int t = 1; t < num_threads; ++t) {
+        EXPECT_EQ(seen[t], seen[0]);
+    }
+}
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+#include "metadata_image.hpp"
+#include "metadata_log.hpp"
+#include "unit_test_utils.hpp"
+#include <fstream>
+#include <filesystem>
+#include <cstddef>
+
+class MetadataImageTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        temp_dir_ = std::make_unique<unit_test_utils::TempDirectory>();
+        path_ = temp_dir_->file_path("image");
+    }
+    
+    std::unique_ptr<unit_test_utils::TempDirectory> temp_dir_;
+    std::string path_;
+};
+
+TEST_F(MetadataImageTest, BuildAndLookUp) {
+    MetadataImageBuilder builder;
+    builder.addFile("b.txt", 3072, 1024, 1700000000000, 3, {3, NO_CHUNK, 5});
+    builder.addFile("a.txt", 100, 4096, 1700000000001, 1, {1});
+    builder.addChunk(5, "b.txt", {"node1:50052", "node2:50052"});
+    builder.addChunk(1, "a.txt", {"node2:50052"});
+    builder.addChunk(3, "b.txt", {"node1:50052"});
+    builder.addChunk(7, "", {});
+    ASSERT_TRUE(writeFileDurably(path_, builder.build(7, 42)));
+    
+    auto image = MetadataImage::open(path_);
+    ASSERT_NE(image, nullptr);
+    EXPECT_EQ(image->nextSegment(), 7);
+    EXPECT_EQ(image->chunkCounter(), 42);
+    EXPECT_EQ(image->fileCount(), 2);
+    EXPECT_EQ(image->chunkCount(), 4);
+    
+    auto file = image->findFile("b.txt");
+    ASSERT_TRUE(file.has_value());
+    EXPECT_EQ(image->fileName(*file), "b.txt");
+    EXPECT_EQ(image->fileTotalSize(*file), 3072);
+    EXPECT_EQ(image->fileChunkSize(*file), 1024);
+    EXPECT_EQ(image->fileCreatedAtMs(*file), 1700000000000);
+    EXPECT_EQ(image->fileReplicationFactor(*file), 3);
+    ASSERT_EQ(image->fileChunkCount(*file), 3);
+    EXPECT_EQ(image->fileChunkId(*file, 0), 3);
+    EXPECT_EQ(image->fileChunkId(*file, 1), NO_CHUNK);  // Sparse slot
+    EXPECT_EQ(image->fileChunkId(*file, 2), 5);
+    EXPECT_EQ(image->fileChunkId(*file, 3), NO_CHUNK);  // Out of range
+    
+    auto chunk = image->findChunk(5);
+    ASSERT_TRUE(chunk.has_value());
+    EXPECT_EQ(image->chunkOwner(*chunk), "b.txt");
+    ASSERT_EQ(image->chunkReplicaCount(*chunk), 2);
+    EXPECT_EQ(image->chunkReplica(*chunk, 0), "node1:50052");
+    EXPECT_EQ(image->chunkReplica(*chunk, 1), "node2:50052");
+    
+    auto stray = image->findChunk(7);
+    ASSERT_TRUE(stray.has_value());
+    EXPECT_EQ(image->chunkOwner(*stray), "");
+    EXPECT_EQ(image->chunkReplicaCount(*stray), 0);
+    
+    EXPECT_FALSE(image->findFile("missing.txt").has_value());
+    EXPECT_FALSE(image->findChunk(99).has_value());
+}
+
+TEST_F(MetadataImageTest, EmptyImage) {
+    MetadataImageBuilder builder;
+    ASSERT_TRUE(writeFileDurably(path_, builder.build(0, 0)));
+    
+    auto image = MetadataImage::open(path_);
+    ASSERT_NE(image, nullptr);
+    EXPECT_EQ(image->fileCount(), 0);
+    EXPECT_FALSE(image->findFile("a.txt").has_value());
+    EXPECT_FALSE(image->findChunk(1).has_value());
+}
+
+TEST_F(MetadataImageTest, RejectsDamagedImages) {
+    MetadataImageBuilder builder;
+    builder.addFile("a.txt", 100, 4096, 0, 1, {1});
+    builder.addChunk(1, "a.txt", {"node1:50052"});
+    std::string bytes = builder.build(1, 1);
+    
+    std::string corrupt = bytes;
+    corrupt[offsetof(metadata_image::ImageHeader, file_count)] ^= 0x01;
+    ASSERT_TRUE(writeFileDurably(path_, corrupt));
+    EXPECT_EQ(MetadataImage::open(path_), nullptr);
+    
+    ASSERT_TRUE(writeFileDurably(path_, bytes.substr(0, bytes.size() - 8)));
+    EXPECT_EQ(MetadataImage::open(path_), nullptr);
+    
+    ASSERT_TRUE(writeFileDurably(path_, "not an image"));
+    EXPECT_EQ(MetadataImage::open(path_), nullptr);
+    
+    EXPECT_EQ(MetadataImage::open(temp_dir_->file_path("missing")), nullptr);
+}
+
+TEST_F(MetadataImageTest, ManyChunksServedFromMapping) {
+    const int num_files = 2000;
+    const int chunks_per_file = 50;
+    
+    std::vector<std::string> names;
+    std::vector<std::vector<ChunkId>> ids(num_files);
+    names.reserve(num_files);
+    for (int f = 0; f < num_files; ++f) {
+        names.push_back("file_" + std::to_string(f));
+        for (int c = 0; c < chunks_per_file; ++c) {
+            ids[f].push_back(static_cast<ChunkId>(f) * chunks_per_file + c + 1);
+        }
+    }
+    
+    const std::string nodes[] = {"node0", "node1", "node2"};
+    MetadataImageBuilder builder;
+    for (int f = 0; f < num_files; ++f) {
+        builder.addFile(names[f], chunks_per_file * 1024, 1024, 0, 1, ids[f]);
+        for (ChunkId id : ids[f]) {
+            builder.addChunk(id, names[f], {nodes[f % 3]});
+        }
+    }
+    ASSERT_TRUE(writeFileDurably(path_, builder.build(0, num_files * chunks_per_file)));
+    
+    auto image = MetadataImage::open(path_);
+    ASSERT_NE(image, nullptr);
+    EXPECT_EQ(image->chunkCount(), num_files * chunks_per_file);
+    
+    for (int f = 0; f < num_files; f += 97) {
+        auto file = image->findFile(names[f]);
+        ASSERT_TRUE(file.has_value());
+        ASSERT_EQ(image->fileChunkCount(*file), chunks_per_file);
+        for (int c = 0; c < chunks_per_file; c += 7) {
+            EXPECT_EQ(image->fileChunkId(*file, c), ids[f][c]);
+            auto chunk = image->findChunk(ids[f][c]);
+            ASSERT_TRUE(chunk.has_value());
+            EXPECT_EQ(image->chunkOwner(*chunk), names[f]);
+            EXPECT_EQ(image->chunkReplica(*chunk, 0), "node" + std::to_string(f % 3));
+        }
+    }
+}
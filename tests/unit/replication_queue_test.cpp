@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+#include "replication_queue.hpp"
+
+TEST(ReplicationQueueTest, FewestLiveReplicasFirst) {
+    ReplicationQueue queue;
+    queue.update(1, 2, 3, 100);  // Lost one of three
+    queue.update(2, 1, 3, 100);  // Down to its last copy
+    queue.update(3, 1, 2, 100);  // Last copy, but only one missing
+    queue.update(4, 2, 5, 100);  // As many left as chunk 1, more missing
+    
+    auto front = queue.front(10);
+    ASSERT_EQ(front.size(), 4);
+    EXPECT_EQ(front[0].chunk_id, 2);
+    EXPECT_EQ(front[1].chunk_id, 3);
+    EXPECT_EQ(front[2].chunk_id, 4);
+    EXPECT_EQ(front[3].chunk_id, 1);
+    EXPECT_EQ(front[0].live, 1);
+    EXPECT_EQ(front[0].wanted, 3);
+    EXPECT_EQ(front[0].bytes, 100);
+    
+    // Only as many as asked for, and nothing is taken out
+    EXPECT_EQ(queue.front(2).size(), 2);
+    EXPECT_EQ(queue.size(), 4);
+}
+
+TEST(ReplicationQueueTest, UpdatesMoveAndDropChunks) {
+    ReplicationQueue queue;
+    queue.update(1, 2, 3, 100);
+    queue.update(2, 2, 3, 100);
+    
+    // Another replica lost: moves ahead
+    queue.update(2, 1, 3, 100);
+    EXPECT_EQ(queue.front(1)[0].chunk_id, 2);
+    
+    // Fully replicated again: dropped
+    queue.update(2, 3, 3, 100);
+    EXPECT_FALSE(queue.contains(2));
+    EXPECT_EQ(queue.front(10).size(), 1);
+    
+    // No replica left to copy from, or no copies wanted: never queued
+    queue.update(3, 0, 3, 100);
+    queue.update(4, 1, 0, 100);
+    EXPECT_FALSE(queue.contains(3));
+    EXPECT_FALSE(queue.contains(4));
+    
+    queue.remove(1);
+    queue.remove(1);  // Already gone
+    EXPECT_EQ(queue.size(), 0);
+    EXPECT_TRUE(queue.front(10).empty());
+}
@@ -2,9 +2,11 @@
 #include "storage.hpp"
 #include "unit_test_utils.hpp"
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <thread>
 #include <atomic>
+#include <algorithm>
 
 class StorageTest : public ::testing::Test {
 protected:
@@ -22,7 +24,7 @@ protected:
 };
 
 TEST_F(StorageTest, StoreAndReadSmallChunk) {
-    std::string chunk_id = "test_chunk_1";
+    ChunkId chunk_id = 1;
     std::string content = "Hello, MiniDFS!";
     std::vector<char> data(content.begin(), content.end());
     
@@ -39,7 +41,7 @@ TEST_F(StorageTest, StoreAndReadSmallChunk) {
 }
 
 TEST_F(StorageTest, StoreLargeChunk) {
-    std::string chunk_id = "large_chunk";
+    ChunkId chunk_id = 2;
     auto data = unit_test_utils::generateRandomData(1024 * 1024); // 1MB
     
     EXPECT_TRUE(storage_->storeChunk(chunk_id, data));
@@ -50,7 +52,7 @@ TEST_F(StorageTest, StoreLargeChunk) {
 }
 
 TEST_F(StorageTest, StoreZeroSizeChunk) {
-    std::string chunk_id = "empty_chunk";
+    ChunkId chunk_id = 3;
     std::vector<char> empty_data;
     
     EXPECT_TRUE(storage_->storeChunk(chunk_id, empty_data));
@@ -60,8 +62,121 @@ TEST_F(StorageTest, StoreZeroSizeChunk) {
     EXPECT_TRUE(read_data.empty());
 }
 
+TEST_F(StorageTest, ReadChunkRange) {
+    ChunkId chunk_id = 4;
+    auto data = unit_test_utils::generateRandomData(64 * 1024);
+    ASSERT_TRUE(storage_->storeChunk(chunk_id, data));
+    
+    // Interior range
+    std::vector<char> out;
+    ASSERT_TRUE(storage_->readChunkRange(chunk_id, 1000, 500, out));
+    EXPECT_EQ(out, std::vector<char>(data.begin() + 1000, data.begin() + 1500));
+    
+    // Length 0 reads to the end, overlong lengths are clipped
+    ASSERT_TRUE(storage_->readChunkRange(chunk_id, 60000, 0, out));
+    EXPECT_EQ(out, std::vector<char>(data.begin() + 60000, data.end()));
+    ASSERT_TRUE(storage_->readChunkRange(chunk_id, 60000, 1024 * 1024, out));
+    EXPECT_EQ(out.size(), data.size() - 60000);
+    
+    // Whole chunk through the range API
+    ASSERT_TRUE(storage_->readChunkRange(chunk_id, 0, 0, out));
+    EXPECT_EQ(out, data);
+}
+
+TEST_F(StorageTest, ReadChunkRangeOutOfBounds) {
+    ChunkId chunk_id = 5;
+    std::vector<char> data(100, 'x');
+    ASSERT_TRUE(storage_->storeChunk(chunk_id, data));
+    
+    std::vector<char> out;
+    EXPECT_FALSE(storage_->readChunkRange(chunk_id, 100, 10, out));
+    EXPECT_FALSE(storage_->readChunkRange(chunk_id, -1, 10, out));
+    EXPECT_FALSE(storage_->readChunkRange(99, 0, 10, out));
+}
+
+TEST_F(StorageTest, ChunkWriterAppendsPieces) {
+    ChunkId chunk_id = 6;
+    auto data = unit_test_utils::generateRandomData(300 * 1024);
+    
+    auto writer = storage_->openChunkWriter(chunk_id);
+    for (size_t pos = 0; pos < data.size(); pos += 7000) {
+        size_t n = std::min<size_t>(7000, data.size() - pos);
+        ASSERT_TRUE(writer->append(data.data() + pos, n));
+    }
+    
+    // Nothing is visible until the writer commits
+    EXPECT_FALSE(storage_->hasChunk(chunk_id));
+    ASSERT_TRUE(writer->commit());
+    EXPECT_TRUE(storage_->hasChunk(chunk_id));
+    EXPECT_EQ(storage_->getUsedSpace(), static_cast<int64_t>(data.size()));
+    
+    // The incrementally computed checksum matches a whole-chunk read
+    unit_test_utils::expectDataEqual(data, storage_->readChunk(chunk_id));
+}
+
+TEST_F(StorageTest, ChunkWriterChecksExpectedChecksum) {
+    auto data = unit_test_utils::generateRandomData(40 * 1024);
+    ASSERT_TRUE(storage_->storeChunk(9, data));
+    std::string checksum = storage_->getChunkChecksum(9);
+    EXPECT_EQ(checksum.size(), 64);  // SHA-256 in hex
+    EXPECT_EQ(storage_->getChunkChecksum(10), "");
+    
+    // Bytes that don't match are never published
+    auto corrupted = data;
+    corrupted[1000] ^= 0x01;
+    auto writer = storage_->openChunkWriter(10);
+    ASSERT_TRUE(writer->append(corrupted.data(), corrupted.size()));
+    EXPECT_FALSE(writer->commit(checksum));
+    EXPECT_FALSE(storage_->hasChunk(10));
+    
+    writer = storage_->openChunkWriter(10);
+    ASSERT_TRUE(writer->append(data.data(), data.size()));
+    EXPECT_TRUE(writer->commit(checksum));
+    EXPECT_EQ(storage_->getChunkChecksum(10), checksum);
+}
+
+TEST_F(StorageTest, AbandonedChunkWriterLeavesNothing) {
+    {
+        auto writer = storage_->openChunkWriter(8);
+        std::vector<char> data(1000, 'a');
+        ASSERT_TRUE(writer->append(data.data(), data.size()));
+    }
+    
+    EXPECT_FALSE(storage_->hasChunk(8));
+    EXPECT_EQ(storage_->getUsedSpace(), 0);
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(temp_dir_->path())) {
+        EXPECT_FALSE(entry.is_regular_file()) << "Leftover file " << entry.path();
+    }
+}
+
+TEST_F(StorageTest, ReadChunkStreamFramesAndVerifies) {
+    ChunkId chunk_id = 7;
+    auto data = unit_test_utils::generateRandomData(100 * 1024);
+    ASSERT_TRUE(storage_->storeChunk(chunk_id, data));
+    
+    std::vector<char> out;
+    size_t frames = 0;
+    ASSERT_TRUE(storage_->readChunkStream(chunk_id, 0, 0, 16 * 1024, [&](const char* bytes, size_t size) {
+        EXPECT_LE(size, 16 * 1024);
+        out.insert(out.end(), bytes, bytes + size);
+        frames++;
+        return true;
+    }));
+    EXPECT_EQ(frames, 7);
+    EXPECT_EQ(out, data);
+    
+    // Corrupt the chunk on disk: the stream fails once the last frame is hashed
+    std::string chunk_path = temp_dir_->path() + "/07/7.chunk";
+    {
+        std::fstream file(chunk_path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(50000);
+        file.put(static_cast<char>(data[50000] ^ 0xff));
+    }
+    EXPECT_FALSE(storage_->readChunkStream(chunk_id, 0, 0, 16 * 1024, [](const char*, size_t) { return true; }));
+}
+
 TEST_F(StorageTest, OverwriteExistingChunk) {
-    std::string chunk_id = "overwrite_test";
+    ChunkId chunk_id = 10;
     std::vector<char> data1{'A', 'B', 'C'};
     std::vector<char> data2{'X', 'Y', 'Z', '1', '2', '3'};
     
@@ -82,12 +197,12 @@ TEST_F(StorageTest, OverwriteExistingChunk) {
 }
 
 TEST_F(StorageTest, ReadNonExistentChunk) {
-    auto read_data = storage_->readChunk("nonexistent");
+    auto read_data = storage_->readChunk(99);
     EXPECT_TRUE(read_data.empty());
 }
 
 TEST_F(StorageTest, DeleteChunk) {
-    std::string chunk_id = "delete_test";
+    ChunkId chunk_id = 11;
     auto data = unit_test_utils::generateRandomData(1024);
     
     // Store and verify
@@ -109,7 +224,7 @@ TEST_F(StorageTest, DeleteChunk) {
 }
 
 TEST_F(StorageTest, DeleteNonExistentChunk) {
-    EXPECT_FALSE(storage_->deleteChunk("nonexistent"));
+    EXPECT_FALSE(storage_->deleteChunk(99));
 }
 
 TEST_F(StorageTest, CapacityManagement) {
@@ -118,15 +233,15 @@ TEST_F(StorageTest, CapacityManagement) {
     
     // Try to store chunk larger than capacity
     auto large_data = unit_test_utils::generateRandomData(200);
-    EXPECT_FALSE(small_storage->storeChunk("too_large", large_data));
+    EXPECT_FALSE(small_storage->storeChunk(1, large_data));
     
     // Store chunk that fits
     auto small_data = unit_test_utils::generateRandomData(50);
-    EXPECT_TRUE(small_storage->storeChunk("fits", small_data));
+    EXPECT_TRUE(small_storage->storeChunk(2, small_data));
     
     // Try to store another chunk that would exceed capacity
     auto another_data = unit_test_utils::generateRandomData(60);
-    EXPECT_FALSE(small_storage->storeChunk("too_much", another_data));
+    EXPECT_FALSE(small_storage->storeChunk(3, another_data));
 }
 
 TEST_F(StorageTest, SpaceTracking) {
@@ -140,8 +255,8 @@ TEST_F(StorageTest, SpaceTracking) {
     auto data1 = unit_test_utils::generateRandomData(1024);
     auto data2 = unit_test_utils::generateRandomData(2048);
     
-    EXPECT_TRUE(storage_->storeChunk("chunk1", data1));
-    EXPECT_TRUE(storage_->storeChunk("chunk2", data2));
+    EXPECT_TRUE(storage_->storeChunk(1, data1));
+    EXPECT_TRUE(storage_->storeChunk(2, data2));
     
     auto used_after = storage_->getUsedSpace();
     auto available_after = storage_->getAvailableSpace();
@@ -175,10 +290,10 @@ TEST_F(StorageTest, GetStoredChunkIds) {
     EXPECT_TRUE(chunk_ids.empty());
     
     // Store some chunks
-    std::vector<std::string> expected_ids = {"chunk1", "chunk2", "chunk3"};
+    std::vector<ChunkId> expected_ids = {1, 2, 3};
     auto data = unit_test_utils::generateRandomData(100);
     
-    for (const auto& id : expected_ids) {
+    for (ChunkId id : expected_ids) {
         EXPECT_TRUE(storage_->storeChunk(id, data));
     }
     
@@ -198,11 +313,11 @@ TEST_F(StorageTest, HealthCheck) {
     
     // Store a chunk
     auto data = unit_test_utils::generateRandomData(100);
-    EXPECT_TRUE(storage_->storeChunk("health_test", data));
+    EXPECT_TRUE(storage_->storeChunk(9, data));
     EXPECT_TRUE(storage_->performHealthCheck());
     
     // Manually delete the file to simulate corruption
-    auto chunk_path = temp_dir_->path() + "/he/health_test.chunk";
+    auto chunk_path = temp_dir_->path() + "/09/9.chunk";
     if (std::filesystem::exists(chunk_path)) {
         std::filesystem::remove(chunk_path);
     }
@@ -212,7 +327,7 @@ TEST_F(StorageTest, HealthCheck) {
 }
 
 TEST_F(StorageTest, PersistenceAcrossInstances) {
-    std::string chunk_id = "persistent_chunk";
+    ChunkId chunk_id = 12;
     auto data = unit_test_utils::generateRandomData(1024);
     
     // Store chunk in first instance
@@ -234,31 +349,52 @@ TEST_F(StorageTest, PersistenceAcrossInstances) {
 }
 
 TEST_F(StorageTest, DirectoryStructure) {
-    // Test that chunks are stored in correct subdirectories
-    std::vector<std::string> chunk_ids = {
-        "00abcd", // Should go in 00/ subdirectory
-        "11xyz",  // Should go in 11/ subdirectory
-        "ff123"   // Should go in ff/ subdirectory
+    // Test that chunks are stored in correct subdirectories, picked by the id's low byte
+    std::vector<std::pair<ChunkId, std::string>> chunk_ids = {
+        {0x100, "00"},
+        {0x111, "11"},
+        {0x1ff, "ff"}
     };
     
     auto data = unit_test_utils::generateRandomData(100);
     
-    for (const auto& chunk_id : chunk_ids) {
+    for (const auto& [chunk_id, expected_subdir] : chunk_ids) {
         EXPECT_TRUE(storage_->storeChunk(chunk_id, data));
         
         // Verify file exists in correct subdirectory
-        std::string expected_subdir = chunk_id.substr(0, 2);
-        std::string expected_path = temp_dir_->path() + "/" + expected_subdir + "/" + chunk_id + ".chunk";
+        std::string expected_path = temp_dir_->path() + "/" + expected_subdir + "/" + formatChunkId(chunk_id) + ".chunk";
         EXPECT_TRUE(std::filesystem::exists(expected_path)) 
             << "Chunk file not found at expected path: " << expected_path;
         
         // Verify metadata file exists too
-        std::string meta_path = temp_dir_->path() + "/" + expected_subdir + "/" + chunk_id + ".meta";
+        std::string meta_path = temp_dir_->path() + "/" + expected_subdir + "/" + formatChunkId(chunk_id) + ".meta";
         EXPECT_TRUE(std::filesystem::exists(meta_path))
             << "Metadata file not found at expected path: " << meta_path;
     }
 }
 
+TEST_F(StorageTest, ChunkIdsRoundTripThroughFileNames) {
+    ChunkId parsed = NO_CHUNK;
+    EXPECT_TRUE(parseChunkId(formatChunkId(18446744073709551615ULL), parsed));
+    EXPECT_EQ(parsed, 18446744073709551615ULL);
+    EXPECT_TRUE(parseChunkId("42", parsed));
+    EXPECT_EQ(parsed, 42);
+    
+    // Anything formatChunkId wouldn't have written is rejected
+    for (const char* text : {"", "0", "042", "42a", "-1", "18446744073709551616", "chunk_7"}) {
+        EXPECT_FALSE(parseChunkId(text, parsed)) << text;
+    }
+    
+    // Files that don't name a chunk are skipped when the storage reloads
+    auto data = unit_test_utils::generateRandomData(100);
+    ASSERT_TRUE(storage_->storeChunk(42, data));
+    std::ofstream(temp_dir_->path() + "/2a/not_a_chunk.chunk") << "junk";
+    
+    storage_.reset();
+    storage_ = std::make_unique<DataNodeStorage>(temp_dir_->path());
+    EXPECT_EQ(storage_->getStoredChunkIds(), std::vector<ChunkId>{42});
+}
+
 TEST_F(StorageTest, ConcurrentOperations) {
     const int num_threads = 5;
     const int chunks_per_thread = 10;
@@ -271,7 +407,7 @@ TEST_F(StorageTest, ConcurrentOperations) {
     for (int t = 0; t < num_threads; ++t) {
         threads.emplace_back([&, t]() {
             for (int i = 0; i < chunks_per_thread; ++i) {
-                std::string chunk_id = "thread_" + std::to_string(t) + "_chunk_" + std::to_string(i);
+                ChunkId chunk_id = t * chunks_per_thread + i + 1;
                 auto data = unit_test_utils::generateRandomData(100 + i); // Variable size
                 
                 if (storage_->storeChunk(chunk_id, data)) {
@@ -297,4 +433,48 @@ TEST_F(StorageTest, ConcurrentOperations) {
     EXPECT_EQ(successful_stores.load(), expected_operations);
     EXPECT_EQ(successful_reads.load(), expected_operations);
     EXPECT_EQ(storage_->getStoredChunkIds().size(), expected_operations);
-}
\ No newline at end of file
+}
+
+TEST_F(StorageTest, ChunkChangesAreReportedOnce) {
+    std::vector<char> data(100, 'x');
+    ASSERT_TRUE(storage_->storeChunk(1, data));
+    ASSERT_TRUE(storage_->storeChunk(2, data));
+    ASSERT_TRUE(storage_->deleteChunk(2));
+    
+    ChunkReport report = storage_->takeChunkChanges();
+    EXPECT_EQ(report.added, std::vector<ChunkId>{1});
+    EXPECT_EQ(report.removed, std::vector<ChunkId>{2});
+    
+    report = storage_->takeChunkChanges();
+    EXPECT_TRUE(report.added.empty());
+    EXPECT_TRUE(report.removed.empty());
+}
+
+TEST_F(StorageTest, RestoredChunkChangesYieldToNewerOnes) {
+    std::vector<char> data(100, 'x');
+    ASSERT_TRUE(storage_->storeChunk(1, data));
+    ASSERT_TRUE(storage_->storeChunk(2, data));
+    
+    // The report fails to send, and meanwhile chunk 1 is deleted
+    ChunkReport unsent = storage_->takeChunkChanges();
+    ASSERT_TRUE(storage_->deleteChunk(1));
+    storage_->restoreChunkChanges(unsent);
+    
+    ChunkReport report = storage_->takeChunkChanges();
+    EXPECT_EQ(report.added, std::vector<ChunkId>{2});
+    EXPECT_EQ(report.removed, std::vector<ChunkId>{1});
+}
+
+TEST_F(StorageTest, FullReportSupersedesChanges) {
+    std::vector<char> data(100, 'x');
+    ASSERT_TRUE(storage_->storeChunk(1, data));
+    ASSERT_TRUE(storage_->storeChunk(2, data));
+    
+    auto full = storage_->takeFullChunkReport();
+    std::sort(full.begin(), full.end());
+    EXPECT_EQ(full, (std::vector<ChunkId>{1, 2}));
+    
+    ChunkReport report = storage_->takeChunkChanges();
+    EXPECT_TRUE(report.added.empty());
+    EXPECT_TRUE(report.removed.empty());
+}
@@ -1,11 +1,13 @@
 #pragma once
 
+#include "chunk_id.hpp"
 #include <string>
 #include <vector>
 #include <filesystem>
 #include <fstream>
 #include <random>
 #include <stdexcept>
+#include <cstdio>
 #include <gtest/gtest.h>
 
 namespace unit_test_utils {
@@ -171,13 +173,11 @@ inline void expectFilesEqual(const std::string& file1, const std::string& file2)
     EXPECT_EQ(content1, content2) << "Files are not equal: " << file1 << " vs " << file2;
 }
 
-inline void expectChunkExists(const std::string& storage_path, const std::string& chunk_id) {
-    std::string subdir = chunk_id.substr(0, std::min(size_t(2), chunk_id.length()));
-    if (subdir.length() < 2) {
-        subdir = "00";
-    }
+inline void expectChunkExists(const std::string& storage_path, ChunkId chunk_id) {
+    char subdir[3];
+    std::snprintf(subdir, sizeof(subdir), "%02x", static_cast<unsigned>(chunk_id & 0xff));
     
-    std::string chunk_path = storage_path + "/" + subdir + "/" + chunk_id + ".chunk";
+    std::string chunk_path = storage_path + "/" + subdir + "/" + formatChunkId(chunk_id) + ".chunk";
     EXPECT_TRUE(std::filesystem::exists(chunk_path)) << "Chunk file doesn't exist: " << chunk_path;
 }
 
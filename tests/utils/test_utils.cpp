@@ -2,53 +2,36 @@
 #include <iostream>
 #include <sstream>
 #include <cstdlib>
+#include <cstdio>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include "cache.hpp"
 #include "manager.hpp"
+#include "server.hpp"
+#include "heartbeat.hpp"
 #include "storage.hpp"
+#include "service.hpp"
+#include "replicator.hpp"
 
 namespace test_utils {
 
-// DataNode Service Implementation for Testing
-class TestDataNodeServiceImpl final : public DataNodeService::Service {
+// DataNode service for testing: the production service over its own storage
+class TestDataNodeServiceImpl {
 private:
     std::unique_ptr<DataNodeStorage> storage_;
+    DataNodeServiceImpl service_;
+    ChunkReplicator replicator_;
     
 public:
-    explicit TestDataNodeServiceImpl(const std::string& storage_path) {
-        storage_ = std::make_unique<DataNodeStorage>(storage_path, 1000000000); // 1GB capacity
-    }
-    
-    grpc::Status StoreChunk(grpc::ServerContext* context, const ::ChunkData* request, ::Ack* response) override {
-        storage_->incrementLoad();
-        
-        std::vector<char> data(request->data().begin(), request->data().end());
-        bool success = storage_->storeChunk(request->chunk_id(), data);
-        
-        response->set_ok(success);
-        response->set_message(success ? "Chunk stored successfully" : "Failed to store chunk");
-        
-        storage_->decrementLoad();
-        return grpc::Status::OK;
-    }
-    
-    grpc::Status ReadChunk(grpc::ServerContext* context, const ::ChunkRequest* request, ::ChunkData* response) override {
-        storage_->incrementLoad();
-        
-        std::vector<char> data = storage_->readChunk(request->chunk_id());
-        
-        if (!data.empty()) {
-            response->set_chunk_id(request->chunk_id());
-            response->set_data(data.data(), data.size());
-            storage_->decrementLoad();
-            return grpc::Status::OK;
-        } else {
-            storage_->decrementLoad();
-            return grpc::Status(grpc::StatusCode::NOT_FOUND, "Chunk not found");
-        }
-    }
+    explicit TestDataNodeServiceImpl(const std::string& storage_path)
+        : storage_(std::make_unique<DataNodeStorage>(storage_path, 1000000000)), // 1GB capacity
+          service_(storage_.get()),
+          replicator_(storage_.get()) {}
+    
+    DataNodeStorage* storage() { return storage_.get(); }
+    DataNodeServiceImpl* service() { return &service_; }
+    ChunkReplicator* replicator() { return &replicator_; }
 };
 
 // TempFile implementation
@@ -175,73 +158,23 @@ std::vector<char> generatePatternData(size_t size, const std::string& pattern) {
     return data;
 }
 
-// TestMetaServer implementation
-class TestRPCServiceImpl final : public MetaService::Service {
+// TestMetaServer implementation: the production service over its own Manager
+class TestRPCServiceImpl {
 private:
     std::unique_ptr<Cache> cache_;
+    std::unique_ptr<FileLocationCache> file_cache_;
     std::unique_ptr<Manager> manager_;
+    RPCServiceImpl service_;
     
 public:
-    TestRPCServiceImpl() {
-        cache_ = std::make_unique<Cache>(1000);
-        manager_ = std::make_unique<Manager>(cache_.get());
-    }
-    
-    grpc::Status RegisterDataNode(grpc::ServerContext* context, const ::DataNodeInfo* request, ::Ack* response) override {
-        bool success = manager_->registerDataNode(request->address(), request->available_space());
-        response->set_ok(success);
-        response->set_message(success ? "DataNode registered successfully" : "Failed to register DataNode");
-        return grpc::Status::OK;
-    }
-    
-    grpc::Status Heartbeat(grpc::ServerContext* context, const ::DataNodeHeartbeat* request, ::HeartbeatResponse* response) override {
-        std::vector<std::string> chunks;
-        for (const auto& chunk : request->stored_chunk_ids()) {
-            chunks.push_back(chunk);
-        }
-        
-        bool success = manager_->updateDataNodeHeartbeat(
-            request->address(), chunks, request->available_space(), request->current_load());
-        
-        response->set_ok(success);
-        return grpc::Status::OK;
-    }
-    
-    grpc::Status GetFileLocation(grpc::ServerContext* context, const ::FileLocationRequest* request, ::FileLocationResponse* response) override {
-        auto [found, locations] = manager_->getFileLocation(request->filename());
-        
-        if (!found) {
-            response->set_found(false);
-            return grpc::Status::OK;
-        }
-        
-        response->set_found(true);
-        for (const auto& loc : locations) {
-            auto* chunk_loc = response->add_chunks();
-            chunk_loc->set_chunk_id(loc.chunk_id);
-            for (const auto& addr : loc.datanode_addresses) {
-                chunk_loc->add_datanode_addresses(addr);
-            }
-        }
-        
-        return grpc::Status::OK;
-    }
-    
-    grpc::Status AllocateChunkLocation(grpc::ServerContext* context, const ::ChunkAllocationRequest* request, ::ChunkLocation* response) override {
-        auto [chunk_id, datanode_addresses] = manager_->allocateChunkLocation(
-            request->filename(), request->chunk_index(), request->chunk_size());
-        
-        if (chunk_id.empty()) {
-            return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "No available DataNode");
-        }
-        
-        response->set_chunk_id(chunk_id);
-        for (const auto& addr : datanode_addresses) {
-            response->add_datanode_addresses(addr);
-        }
-        
-        return grpc::Status::OK;
-    }
+    TestRPCServiceImpl()
+        : cache_(std::make_unique<Cache>(1000)),
+          file_cache_(std::make_unique<FileLocationCache>(1000)),
+          manager_(std::make_unique<Manager>(cache_.get(), file_cache_.get())),
+          service_(manager_.get(), file_cache_.get()) {}
+    
+    RPCServiceImpl* service() { return &service_; }
+    Manager* manager() { return manager_.get(); }
 };
 
 TestMetaServer::TestMetaServer(const std::string& address) : address_(address) {
@@ -266,7 +199,7 @@ bool TestMetaServer::start() {
         
         grpc::ServerBuilder builder;
         builder.AddListeningPort(address_, grpc::InsecureServerCredentials());
-        builder.RegisterService(service_.get());
+        builder.RegisterService(service_->service());
         
         server_ = builder.BuildAndStart();
         if (!server_) {
@@ -311,6 +244,10 @@ std::string TestMetaServer::address() const {
     return address_;
 }
 
+Manager* TestMetaServer::manager() {
+    return service_ ? service_->manager() : nullptr;
+}
+
 // TestDataNode implementation
 TestDataNode::TestDataNode(const std::string& address,
                           const std::string& metaserver_addr,
@@ -330,6 +267,7 @@ TestDataNode::TestDataNode(const std::string& address,
             throw std::runtime_error("Failed to create temporary storage directory");
         }
         storage_path_ = temp_template;
+        owns_storage_ = true;
     } else {
         storage_path_ = storage_path;
     }
@@ -339,7 +277,7 @@ TestDataNode::~TestDataNode() {
     stop();
     
     // Clean up temporary storage if we created it
-    if (std::filesystem::exists(storage_path_)) {
+    if (owns_storage_ && std::filesystem::exists(storage_path_)) {
         std::filesystem::remove_all(storage_path_);
     }
 }
@@ -353,7 +291,7 @@ bool TestDataNode::start() {
         
         grpc::ServerBuilder builder;
         builder.AddListeningPort(address_, grpc::InsecureServerCredentials());
-        builder.RegisterService(service_.get());
+        builder.RegisterService(service_->service());
         
         server_ = builder.BuildAndStart();
         if (!server_) {
@@ -380,16 +318,18 @@ bool TestDataNode::start() {
             grpc::ClientContext register_context;
             stub->RegisterDataNode(&register_context, register_request, &register_response);
             
-            // Send periodic heartbeats
+            // Send periodic heartbeats like the real DataNode does
+            HeartbeatReporter reporter(address_, service_->storage());
             while (running_) {
-                DataNodeHeartbeat heartbeat;
-                heartbeat.set_address(address_);
-                heartbeat.set_available_space(800000000); // Simulate some usage
-                heartbeat.set_current_load(1);
-                
                 HeartbeatResponse heartbeat_response;
-                grpc::ClientContext heartbeat_context;
-                stub->Heartbeat(&heartbeat_context, heartbeat, &heartbeat_response);
+                if (reporter.send(stub.get(), &heartbeat_response).ok()) {
+                    for (ChunkId chunk_id : heartbeat_response.chunks_to_delete()) {
+                        service_->storage()->deleteChunk(chunk_id);
+                    }
+                    for (const auto& copy : heartbeat_response.chunks_to_copy()) {
+                        service_->replicator()->submit(copy);
+                    }
+                }
                 
                 std::this_thread::sleep_for(std::chrono::seconds(1));
             }
@@ -479,7 +419,7 @@ bool TestClient::uploadFile(const std::string& filename, const std::vector<char>
         size_t chunk_size = std::min(CHUNK_SIZE, data.size() - offset);
         
         // Allocate chunk location
-        std::string chunk_id;
+        ChunkId chunk_id;
         std::vector<std::string> datanode_addrs;
         
         if (!allocateChunk(filename, chunk_index, chunk_size, chunk_id, datanode_addrs)) {
@@ -511,12 +451,14 @@ std::vector<char> TestClient::downloadFile(const std::string& filename) {
 }
 
 bool TestClient::allocateChunk(const std::string& filename, int chunk_index,
-                              int64_t chunk_size, std::string& chunk_id,
-                              std::vector<std::string>& datanode_addrs) {
+                              int64_t chunk_size, ChunkId& chunk_id,
+                              std::vector<std::string>& datanode_addrs,
+                              int32_t replication_factor) {
     ChunkAllocationRequest request;
     request.set_filename(filename);
     request.set_chunk_index(chunk_index);
     request.set_chunk_size(chunk_size);
+    request.set_replication_factor(replication_factor);
     
     ChunkLocation response;
     grpc::ClientContext context;
@@ -579,13 +521,11 @@ void expectDataEqual(const std::vector<char>& data1, const std::vector<char>& da
     }
 }
 
-void expectChunkExists(const std::string& storage_path, const std::string& chunk_id) {
-    std::string subdir = chunk_id.substr(0, std::min(size_t(2), chunk_id.length()));
-    if (subdir.length() < 2) {
-        subdir = "00";
-    }
+void expectChunkExists(const std::string& storage_path, ChunkId chunk_id) {
+    char subdir[3];
+    std::snprintf(subdir, sizeof(subdir), "%02x", static_cast<unsigned>(chunk_id & 0xff));
     
-    std::string chunk_path = storage_path + "/" + subdir + "/" + chunk_id + ".chunk";
+    std::string chunk_path = storage_path + "/" + subdir + "/" + formatChunkId(chunk_id) + ".chunk";
     
     if (!std::filesystem::exists(chunk_path)) {
         throw std::runtime_error("Chunk file doesn't exist: " + chunk_path);
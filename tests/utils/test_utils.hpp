@@ -10,6 +10,9 @@
 #include <grpcpp/grpcpp.h>
 #include "dfs.grpc.pb.h"
 #include "cache.hpp"
+#include "chunk_id.hpp"
+
+class Manager;
 
 namespace test_utils {
 
@@ -79,6 +82,9 @@ public:
     void stop() override;
     bool isRunning() const override;
     std::string address() const override;
+    
+    // The server's Manager, for driving background work tests can't wait for
+    Manager* manager();
 };
 
 // Forward declare for TestDataNode
@@ -92,6 +98,7 @@ private:
     std::string address_;
     std::string metaserver_addr_;
     std::string storage_path_;
+    bool owns_storage_ = false;  // Only remove storage we created ourselves
     std::atomic<bool> running_{false};
     std::unique_ptr<TestDataNodeServiceImpl> service_;
     
@@ -122,15 +129,16 @@ public:
     
     // Low-level operations
     bool allocateChunk(const std::string& filename, int chunk_index, 
-                      int64_t chunk_size, std::string& chunk_id, 
-                      std::vector<std::string>& datanode_addrs);
+                      int64_t chunk_size, ChunkId& chunk_id, 
+                      std::vector<std::string>& datanode_addrs,
+                      int32_t replication_factor = 0);  // 0 = MetaServer default
     std::vector<ChunkLocation> getFileLocation(const std::string& filename);
 };
 
 // Assertion utilities
 void expectFilesEqual(const std::string& file1, const std::string& file2);
 void expectDataEqual(const std::vector<char>& data1, const std::vector<char>& data2);
-void expectChunkExists(const std::string& storage_path, const std::string& chunk_id);
+void expectChunkExists(const std::string& storage_path, ChunkId chunk_id);
 
 // Timing utilities
 class Timer {